@@ -0,0 +1,163 @@
+#ifndef __ARRAYS_HPP__
+#define __ARRAYS_HPP__
+
+// C headers
+#include <cstdint>
+
+// STL headers
+#include <vector>
+
+// lime headers
+#include <builtins.hpp>
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::vector;
+
+  // lime
+  using lime::environment;
+  using lime::lambda;
+  using lime::object;
+  using lime::value;
+
+  // A homogeneous array of unboxed 64-bit integers (type::int_array) or
+  // doubles (type::float_array). Like vectors, arrays are values: the mutating
+  // builtins copy the elements first if they are shared.
+  template< typename T >
+  class typed_array : public object {
+  public:
+    explicit typed_array(type t) : object(t) {}
+    typed_array(type t, const vector< T >& v) : object(t), items(v) {}
+    vector< T > items;
+  };
+
+  typedef typed_array< int64_t > int_array;
+  typedef typed_array< double > float_array;
+
+  const vector< int64_t >& get_int_array(const value& val);
+
+  const vector< double >& get_float_array(const value& val);
+
+  // true for integer and float arrays
+  bool is_array(const value& val);
+
+  long array_size(const value& val);
+
+  bool arrays_equal(const value& a, const value& b);
+
+  // true if the processor supports AVX2, which the vector kernels use when
+  // available
+  bool has_avx2();
+
+  class make_int_array : public binary_builtin {
+  public:
+    make_int_array();
+  };
+
+  class make_float_array : public binary_builtin {
+  public:
+    make_float_array();
+  };
+
+  class list_to_int_array : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  class list_to_float_array : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class array_range : public binary_builtin {
+  public:
+    array_range();
+  };
+
+  class array_to_list : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  class array_ref : public binary_builtin {
+  public:
+    array_ref();
+  };
+
+  class array_set : public mutating_builtin {
+  public:
+    array_set() : mutating_builtin(3) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class array_push : public mutating_builtin {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class array_add : public binary_builtin {
+  public:
+    array_add();
+  };
+
+  class array_multiply : public binary_builtin {
+  public:
+    array_multiply();
+  };
+
+  class array_scale : public binary_builtin {
+  public:
+    array_scale();
+  };
+
+  class array_dot : public binary_builtin {
+  public:
+    array_dot();
+  };
+
+  class array_sum : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class array_min : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class array_max : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class prefix_sum : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  void add_array_builtins(const shared_ptr< environment >& env_p);
+
+} // namespace lime
+
+#endif // __ARRAYS_HPP__
@@ -0,0 +1,66 @@
+#ifndef __BIGNUM_HPP__
+#define __BIGNUM_HPP__
+
+// C headers
+#include <cstdint>
+
+// STL headers
+#include <string>
+#include <vector>
+
+// lime headers
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::string;
+  using std::vector;
+
+  // lime
+  using lime::object;
+  using lime::value;
+
+  // The magnitude of a big integer, in base 2^32, least significant limb first
+  // and without leading zero limbs.
+  typedef vector< uint32_t > magnitude;
+
+  // An integer outside the range of immediate integers. Arithmetic always
+  // returns immediates when the result fits, so a bignum is never equal to an
+  // immediate integer.
+  class bignum : public object {
+  public:
+    bignum(bool neg, const magnitude& mag)
+      : object(type::bignum), negative(neg), digits(mag) {}
+    const bool negative;
+    const magnitude digits;
+  };
+
+  // the integer n as a value, boxed if it does not fit in an immediate
+  value make_integer(long n);
+
+  // true for immediate integers and bignums
+  bool is_integer(const value& val);
+
+  // the arithmetic operations on integers; they promote their result to a
+  // bignum when it overflows an immediate and demote it back when it fits
+  value integer_add(const value& a, const value& b);
+  value integer_subtract(const value& a, const value& b);
+  value integer_multiply(const value& a, const value& b);
+  value integer_quotient(const value& a, const value& b);
+  value integer_remainder(const value& a, const value& b);
+  int integer_compare(const value& a, const value& b);
+
+  string integer_to_string(const value& val);
+
+  // the nearest double to an integer
+  double integer_to_double(const value& val);
+
+  // the integer part of a finite double
+  value integer_from_double(double d);
+
+  // parses an optionally signed string of decimal digits
+  value parse_integer(const string& str);
+
+} // namespace lime
+
+#endif // __BIGNUM_HPP__
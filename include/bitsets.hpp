@@ -0,0 +1,113 @@
+#ifndef __BITSETS_HPP__
+#define __BITSETS_HPP__
+
+// C headers
+#include <cstdint>
+
+// STL headers
+#include <vector>
+
+// lime headers
+#include <builtins.hpp>
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::vector;
+
+  // lime
+  using lime::environment;
+  using lime::lambda;
+  using lime::object;
+  using lime::value;
+
+  // A set of the integers from 0 to size - 1, one bit each, packed into 64-bit
+  // words. The bits past size in the last word are always clear. Like vectors,
+  // bitsets are values.
+  class bitset_object : public object {
+  public:
+    explicit bitset_object(long n) : object(type::bitset), size(n), words((n + 63) / 64) {}
+    bitset_object(const bitset_object& other)
+      : object(type::bitset), size(other.size), words(other.words) {}
+    long size;
+    vector< uint64_t > words;
+  };
+
+  const bitset_object& get_bitset(const value& val);
+
+  bool bitsets_equal(const bitset_object& a, const bitset_object& b);
+
+  class make_bitset : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class bitset_set : public mutating_builtin {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class bitset_clear : public mutating_builtin {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class bitset_test : public binary_builtin {
+  public:
+    bitset_test();
+  };
+
+  class bitset_and : public binary_builtin {
+  public:
+    bitset_and();
+  };
+
+  class bitset_or : public binary_builtin {
+  public:
+    bitset_or();
+  };
+
+  class bitset_xor : public binary_builtin {
+  public:
+    bitset_xor();
+  };
+
+  class bitset_not : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class bitset_count : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class bitset_next : public binary_builtin {
+  public:
+    bitset_next();
+  };
+
+  class bitset_clear_stride : public mutating_builtin {
+  public:
+    bitset_clear_stride() : mutating_builtin(3) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class bitset_to_list : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  void add_bitset_builtins(const shared_ptr< environment >& env_p);
+
+} // namespace lime
+
+#endif // __BITSETS_HPP__
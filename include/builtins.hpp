@@ -13,162 +13,310 @@ namespace lime {
   using lime::lambda;
   using lime::value;
 
+  typedef value (*binary_operation)(const value& arg1, const value& arg2);
+
+  // A builtin applying op to two evaluated arguments. The evaluator calls
+  // call2 when both are supplied; call also handles partial application.
+  class binary_builtin : public lambda {
+  public:
+    binary_builtin(binary_operation f, const char* n) : op(f), name(n) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 2;
+    }
+    value call2(const value& arg1, const value& arg2)
+    {
+      return op(arg1, arg2);
+    }
+  private:
+    binary_operation op;
+    const char* name;
+  };
+
+  // A builtin that modifies the variable its first argument names (see
+  // variable_ref), such as push-back!, taking n_args arguments; given fewer,
+  // it returns a partial application that keeps the caller's environment.
+  class mutating_builtin : public lambda {
+  public:
+    explicit mutating_builtin(int n = 2) : n_args(n) {}
+    bool modifies_arguments() const
+    {
+      return true;
+    }
+    bool keeps_caller_environment(int n) const
+    {
+      return n < n_args;
+    }
+  private:
+    int n_args;
+  };
+
   class quote : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    bool quotes_arguments() const
+    {
+      return true;
+    }
   };
 
   class evaluate : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    bool runs_in_caller_environment() const
+    {
+      return true;
+    }
   };
 
   class make_list : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
   class load : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    bool runs_in_caller_environment() const
+    {
+      return true;
+    }
   };
 
-  class equals : public lambda {
+  class equals : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    equals();
   };
 
-  class less_than : public lambda {
+  class less_than : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    less_than();
   };
 
-  class plus : public lambda {
+  class plus : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    plus();
   };
 
-  class minus : public lambda {
+  class minus : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    minus();
   };
 
-  class times : public lambda {
+  class times : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    times();
   };
 
-  class divide : public lambda {
+  class divide : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    divide();
   };
 
-  class modulo : public lambda {
+  class modulo : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    modulo();
   };
 
   class random_int : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
   class is_atom : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
   };
 
   class len : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
   };
 
-  class cons : public lambda {
+  class cons : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    cons();
   };
 
   class head : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
   };
 
   class tail : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
   };
 
-  class elem : public lambda {
+  class elem : public binary_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    elem();
   };
 
-  class set_elem : public lambda {
+  class set_elem : public mutating_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    set_elem() : mutating_builtin(3) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };  
 
-  class push_front : public lambda {
+  class push_front : public mutating_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
-  class push_back : public lambda {
+  class push_back : public mutating_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
-  class pop_front : public lambda {
+  class pop_front : public mutating_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    pop_front() : mutating_builtin(1) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
-  class pop_back : public lambda {
+  class pop_back : public mutating_builtin {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    pop_back() : mutating_builtin(1) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
   class delay : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    bool keeps_caller_environment(int n_args) const
+    {
+      return true;
+    }
   };
 
   class force : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
   };
   
   class print : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
   class print_string : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
   };
  
   class print_to_string : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
   class read : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    bool runs_in_caller_environment() const
+    {
+      return true;
+    }
   };
 
   class read_string : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
   };
 
   class read_from_string : public lambda {
   public:
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    bool runs_in_caller_environment() const
+    {
+      return true;
+    }
   };
 
-  void add_builtins(shared_ptr< environment > env_p);
+  // structural equality, as implemented by '='
+  bool values_equal(const value& a, const value& b);
+
+  // calls a lambda on arguments that are already evaluated
+  value apply_function(const value& func, const vector< value >& vals);
+
+  // Helpers for defining builtins that support partial application.
+
+  // evaluates one or two arguments and applies op to them, or returns a partial
+  value call_binary(binary_operation op, const char* name, const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p);
+
+  // the variable a mutating builtin operates on, following references
+  value& variable_ref(const value& arg, const shared_ptr< environment >& env_p);
+
+  typedef void (*variable_modifier)(value& var, const value& val);
+
+  // (name &var val): modifies the variable named by the first argument
+  value call_modify_variable(variable_modifier modify, const char* name,
+                             const vector< value >& args,
+                             const shared_ptr< environment >& caller_env_p);
+
+  typedef void (*element_setter)(value& var, const value& i, const value& val);
+
+  // (name &var i val): sets an element of the variable named by the first argument
+  value call_set_element(element_setter setter, const char* name,
+                         const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p);
+
+  void add_builtins(const shared_ptr< environment >& env_p);
 
 } // namespace lime
 
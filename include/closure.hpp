@@ -0,0 +1,76 @@
+#ifndef __CLOSURE_HPP__
+#define __CLOSURE_HPP__
+
+// STL headers
+#include <memory>
+#include <vector>
+
+// lime headers
+#include <core.hpp>
+#include <eval.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::vector;
+
+  // lime
+  using lime::environment;
+  using lime::location;
+  using lime::scope;
+  using lime::scope_chain;
+  using lime::value;
+
+  // Records in s what body, the code run in the frames of s, does to
+  // variables and whether it lets the frames escape (see scope). scopes are
+  // the scopes around body, s included, and globals_p is the global
+  // environment, in which the functions that calls are made to are looked up.
+  void scan_scope(const value& body, scope& s, const scope_chain& scopes,
+                  environment* globals_p);
+
+  // A lambda created in a frame other than the global environment gives its
+  // closures a frame of their own instead of the frame it is created in when
+  // it can: one holding only the variables its body refers to from the frames
+  // around it, whose outer frame is the global environment. The closures then
+  // keep the rest of those frames from being freed no longer, and reach the
+  // variables they use one frame up. A variable is copied into the frame, or
+  // boxed as a reference to the one it is defined in if the code of its
+  // scope may change it or it is not defined yet.
+  //
+  // The copies are made on the assumption that the global functions the
+  // variables are passed to by name do not modify them; if one of those
+  // functions has been assigned since, every variable is boxed instead.
+  //
+  // A lambda keeps its whole defining environment if it assigns to one of
+  // the variables it would capture, since set! and references may assign to
+  // an outer variable of the same name; if a variable it refers to has
+  // slots in two of the scopes around it; or if its own code or that of a
+  // scope around it is open, as eval, load, read and macros may define or look up
+  // variables by name.
+  class closure_layout {
+  public:
+    // the layout of the closures of a lambda with scope params, already
+    // scanned, and body, created in the frames of scopes
+    closure_layout(const value& body, const scope& params, const scope_chain& scopes);
+    // the scopes the lambda's body is compiled in, params_p being its own
+    scope_chain body_scopes(const scope_chain& scopes,
+                            const shared_ptr< scope >& params_p) const;
+    // the environment of a closure created in env_p
+    shared_ptr< environment > capture(const shared_ptr< environment >& env_p) const;
+  private:
+    bool flat;
+    // the depth of the global environment from the frame a closure is created in
+    int depth;
+    // the captured variables, or null if a flat closure needs none
+    shared_ptr< scope > captured_p;
+    // where each captured variable is, and whether it must be boxed
+    vector< location > sources;
+    vector< bool > changing;
+    // the functions the variables not boxed are passed to (see
+    // scope::add_callee)
+    vector< symbol > callees;
+  };
+
+} // namespace lime
+
+#endif // __CLOSURE_HPP__
@@ -1,22 +1,27 @@
 #ifndef __CORE_HPP__
 #define __CORE_HPP__
 
+// C headers
+#include <cstddef>
+#include <cstdint>
+
 // STL headers
 #include <deque>
+#include <iterator>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 // Boost headers
-#include <boost/variant.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 namespace lime {
   // STL
-  using std::basic_string;
   using std::deque;
-  using std::hash;
   using std::ostream;
   using std::shared_ptr;
   using std::string;
@@ -24,23 +29,43 @@ namespace lime {
   using std::vector;
 
   // Boost
-  using boost::static_visitor;
-  using boost::variant;
+  using boost::intrusive_ptr;
+
+  class value;
 
-  class symbol : public basic_string< char > {
+  // A symbol is a handle into the global symbol table: every name is interned
+  // once, so comparing and hashing symbols only involves their integer ids.
+  class symbol {
   public:
-    symbol() {}
-    explicit symbol(const string& str) : basic_string< char >(str) {}
+    symbol() : index(0) {}
+    explicit symbol(const string& str) : index(intern(str)) {}
+    const string& name() const;
+    unsigned id() const
+    {
+      return index;
+    }
+    bool operator==(const symbol& other) const
+    {
+      return index == other.index;
+    }
+    bool operator!=(const symbol& other) const
+    {
+      return index != other.index;
+    }
+    friend class value;
+  private:
+    static unsigned intern(const string& str);
+    unsigned index;
   };
 
   class symbol_hash {
   public:
     size_t operator()(const symbol& sym) const noexcept
     {
-      return hash< basic_string< char > >()(sym);
+      return sym.id();
     }
   };
-  
+
   class nil {};
 
   class list;
@@ -55,81 +80,446 @@ namespace lime {
 
   class environment;
 
-  typedef variant< symbol, 
-                   list, 
-                   int,
-                   string, 
-                   bool,
-                   shared_ptr< reference >,
-                   shared_ptr< lambda >,
-                   shared_ptr< macro >,
-                   shared_ptr< delayed >,
-                   nil > value;
-
-  class list : public deque< value > {
-  public:    
-    list() {}
-    list(deque< value > d) : deque< value >(d) {}
-    list(value h, list t) : deque< value >(t)
-    {
-      push_front(h);
+  enum class type { nil, boolean, integer, bignum, real, symbol, string, list, vector,
+                    hash_table, map, int_array, float_array, bitset, reference, lambda,
+                    macro, delayed, node };
+
+  // Base class of everything a value can point to. Objects are reference
+  // counted intrusively, so that a value fits in a single machine word.
+  class object {
+  public:
+    explicit object(type t) : tag(t), ref_count(0) {}
+    virtual ~object() {}
+    const type tag;
+    long ref_count;
+  };
+
+  inline void intrusive_ptr_add_ref(object* obj_p)
+  {
+    ++obj_p->ref_count;
+  }
+
+  inline void intrusive_ptr_release(object* obj_p)
+  {
+    if (--obj_p->ref_count == 0)
+      delete obj_p;
+  }
+
+  template< typename T, typename... Args >
+  intrusive_ptr< T > make_object(Args&&... args)
+  {
+    return intrusive_ptr< T >(new T(std::forward< Args >(args)...));
+  }
+
+  // A value is a tagged machine word. Integers, booleans, nil and symbols are
+  // stored immediately; everything else is a pointer to a heap object:
+  //
+  //   ...xxx1  integer (63 bits, shifted left by one)
+  //   ...x000  pointer to an object
+  //   ...0010  nil, false, true, or one of the internal markers
+  //   ...0100  symbol id, shifted left by three
+  class value {
+  public:
+    value() : bits(nil_bits) {}
+    value(nil n) : bits(nil_bits) {}
+    value(bool b) : bits(b ? true_bits : false_bits) {}
+    value(int i) : bits((uintptr_t(long(i)) << 1) | 1) {}
+    value(long i) : bits((uintptr_t(i) << 1) | 1) {}
+    value(const symbol& sym) : bits((uintptr_t(sym.index) << 3) | symbol_tag) {}
+    value(const string& str);
+    value(const char* str);
+    value(const list& lst);
+    template< typename T >
+    value(const intrusive_ptr< T >& obj_p)
+      : bits(reinterpret_cast< uintptr_t >(static_cast< object* >(obj_p.get())))
+    {
+      retain();
+    }
+    value(const value& other) : bits(other.bits)
+    {
+      retain();
+    }
+    value(value&& other) noexcept : bits(other.bits)
+    {
+      other.bits = nil_bits;
+    }
+    ~value()
+    {
+      release();
+    }
+    value& operator=(const value& other)
+    {
+      other.retain();
+      release();
+      bits = other.bits;
+      return *this;
+    }
+    value& operator=(value&& other) noexcept
+    {
+      if (this != &other) {
+        release();
+        bits = other.bits;
+        other.bits = nil_bits;
+      }
+      return *this;
+    }
+    type get_type() const
+    {
+      if (bits & 1)
+        return type::integer;
+      switch (bits & 7) {
+      case 0:
+        return get_object()->tag;
+      case symbol_tag:
+        return type::symbol;
+      default:
+        return bits == nil_bits ? type::nil : type::boolean;
+      }
+    }
+    bool is(type t) const
+    {
+      return get_type() == t;
+    }
+    bool is_int() const
+    {
+      return bits & 1;
+    }
+    bool is_bool() const
+    {
+      return bits == true_bits || bits == false_bits;
+    }
+    bool is_nil() const
+    {
+      return bits == nil_bits;
+    }
+    bool is_symbol() const
+    {
+      return (bits & 7) == symbol_tag;
     }
+    bool is_object() const
+    {
+      return (bits & 7) == 0;
+    }
+    // the range of immediate integers; larger integers are bignums
+    static const long max_int = (1L << 62) - 1;
+    static const long min_int = -(1L << 62);
+    static bool fits_int(long n)
+    {
+      return n >= min_int && n <= max_int;
+    }
+    long get_int() const
+    {
+      return intptr_t(bits) >> 1;
+    }
+    bool get_bool() const
+    {
+      return bits == true_bits;
+    }
+    symbol get_symbol() const
+    {
+      symbol sym;
+      sym.index = bits >> 3;
+      return sym;
+    }
+    object* get_object() const
+    {
+      return reinterpret_cast< object* >(bits);
+    }
+    const string& get_string() const;
+    const list& get_list() const;
+    list& get_mutable_list();
+    reference* get_reference() const;
+    lambda* get_lambda() const;
+    macro* get_macro() const;
+    delayed* get_delayed() const;
+    // the contents of a variable slot that has not been defined yet; lime code
+    // never sees it
+    static value unbound()
+    {
+      value val;
+      val.bits = unbound_bits;
+      return val;
+    }
+    bool is_unbound() const
+    {
+      return bits == unbound_bits;
+    }
+    // the result of a node whose tail call is pending (see run)
+    static value tail_call()
+    {
+      value val;
+      val.bits = tail_call_bits;
+      return val;
+    }
+    bool is_tail_call() const
+    {
+      return bits == tail_call_bits;
+    }
+    // true if both values are the same word: the same immediate or object
+    bool identical(const value& other) const
+    {
+      return bits == other.bits;
+    }
+    // The word itself, as machine code works with it. Only immediates can be
+    // made back into values, since the word holds no reference to an object.
+    uintptr_t get_word() const
+    {
+      return bits;
+    }
+    static value from_word(uintptr_t word)
+    {
+      value val;
+      val.bits = word;
+      return val;
+    }
+  private:
+    static const uintptr_t symbol_tag = 4;
+    static const uintptr_t nil_bits = 2;
+    static const uintptr_t false_bits = 10;
+    static const uintptr_t true_bits = 18;
+    static const uintptr_t unbound_bits = 26;
+    static const uintptr_t tail_call_bits = 34;
+    void retain() const
+    {
+      if (is_object())
+        ++get_object()->ref_count;
+    }
+    void release()
+    {
+      if (is_object() && --get_object()->ref_count == 0)
+        delete get_object();
+    }
+    uintptr_t bits;
+  };
+
+  class list_buffer;
+
+  // A list is an immutable view [first, last) over a reference-counted buffer,
+  // so copying a list, taking its tail and consing onto it are all O(1). Many
+  // lists may share a buffer: a list only grows its buffer in place at an end
+  // that no other list can see, and the in-place modifiers used by the
+  // mutating builtins copy the visible elements first if the buffer is shared.
+  class list {
+  public:
+    class const_iterator {
+    public:
+      typedef std::forward_iterator_tag iterator_category;
+      typedef value value_type;
+      typedef long difference_type;
+      typedef const value* pointer;
+      typedef const value& reference;
+      const_iterator(const list* l, long p) : lst(l), pos(p) {}
+      const value& operator*() const;
+      const value* operator->() const;
+      const_iterator& operator++();
+      const_iterator operator+(long n) const;
+      long operator-(const const_iterator& other) const;
+      bool operator==(const const_iterator& other) const;
+      bool operator!=(const const_iterator& other) const;
+    private:
+      const list* lst;
+      long pos;
+    };
+    list() : first(0), last(0) {}
+    list(const value& h, const list& t);
+    int size() const;
+    bool empty() const;
+    const value& operator[](int i) const;
+    const value& front() const;
+    const value& back() const;
+    const_iterator begin() const;
+    const_iterator end() const;
     value head() const;
     list tail() const;
+    value& get_ref(int i);
+    void push_front(const value& val);
+    void push_back(const value& val);
+    void pop_front();
+    void pop_back();
+  private:
+    void make_unique();
+    shared_ptr< list_buffer > buffer_p;
+    long first, last;
   };
 
-  class reference {
+  // The elements of a buffer occupy positions [origin, origin + items.size()),
+  // so pushing at its front does not move the positions seen by other lists.
+  class list_buffer {
   public:
-    explicit reference(const symbol& s, shared_ptr< environment > ep) 
-      : sym(s), env_p(ep) {}
+    list_buffer(long o) : origin(o) {}
+    deque< value > items;
+    long origin;
+  };
+
+  class string_object : public object {
+  public:
+    explicit string_object(const string& s) : object(type::string), str(s) {}
+    const string str;
+  };
+
+  class list_object : public object {
+  public:
+    explicit list_object(const list& l) : object(type::list), lst(l) {}
+    list lst;
+  };
+
+  // A reference to a variable made with the index of its slot in the frame
+  // of env_p finds it there without looking up its name while it is bound.
+  class reference : public object {
+  public:
+    explicit reference(const symbol& s, const shared_ptr< environment >& ep, int i = -1)
+      : object(type::reference), sym(s), env_p(ep), index(i) {}
     value get() const;
     void set(value val);
     value& get_native_ref() const;
-  private: 
+  private:
     symbol sym;
     shared_ptr< environment > env_p;
+    int index;
   };
 
-  class reference_visitor : public static_visitor< shared_ptr< reference > > {
+  // returns a reference to the variable named by arg in the given environment
+  // (or the reference it is already bound to)
+  value make_reference(const value& arg, const shared_ptr< environment >& env_p);
+
+  // An expression compiled by eval's analysis pass, with its special forms
+  // already decided. Compiled expressions are values too, so that they can be
+  // passed to builtins in place of their source code.
+  class node : public object {
   public:
-    reference_visitor(shared_ptr< environment > ep) : env_p(ep) {}
-    shared_ptr< reference > operator()(const symbol& sym) const;
-    template< typename T>
-    shared_ptr< reference > operator()(const T& t) const;
-  private:
-    shared_ptr< environment > env_p;
+    node() : object(type::node) {}
+    virtual value execute(const shared_ptr< environment >& env_p) = 0;
+    // true if the expression is just a variable, which it sets sym to
+    virtual bool is_variable(symbol& sym) const
+    {
+      return false;
+    }
   };
 
-  class lambda {
+  // the variable named by an argument in source or compiled form
+  bool variable_name(const value& arg, symbol& sym);
+
+  class scope;
+
+  class native_code;
+
+  // The first parameters of a lambda's scope are its parameters; a partial
+  // application keeps the arguments supplied so far in bound_args.
+  class lambda : public object {
   public:
-    lambda() {}
-    lambda(vector< symbol > pars, vector< bool > ref_arg, vector< bool > del_arg,
-           value x, shared_ptr< environment > e) 
-      : params(pars), reference_arg(ref_arg), delayed_arg(del_arg), expr(x), 
-        creation_env_p(e) {}
-    lambda(vector< symbol > pars, value x, shared_ptr< environment > e);
-    virtual value call(vector< value > args, shared_ptr< environment > caller_env_p);
-    shared_ptr< lambda > partial(int n_supplied_args, shared_ptr< environment > env_p);
+    lambda() : object(type::lambda), n_params(0), value_arity(-1), n_calls(0) {}
+    lambda(int n, const vector< bool >& ref_arg, const vector< bool >& del_arg,
+           const shared_ptr< scope >& s, intrusive_ptr< node > b, const value& src,
+           const shared_ptr< environment >& e,
+           vector< value > bound = vector< value >())
+      : object(type::lambda), n_params(n), reference_arg(ref_arg),
+        delayed_arg(del_arg), scope_p(s), body(b), source(src), creation_env_p(e),
+        bound_args(bound), value_arity(n - bound_args.size()), n_calls(0)
+    {
+      for (int i = bound_args.size(); i < n_params; ++i)
+        if (reference_arg[i] || delayed_arg[i])
+          value_arity = -1;
+    }
+    virtual value call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p);
+    // a call in tail position: lambdas defined in lime leave their body to the
+    // run that is executing the caller; builtins are called as usual
+    value tail_call(const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p);
+    // Builtins taking a fixed number of evaluated arguments return it here and
+    // implement the matching callN, which the evaluator calls with the
+    // arguments already evaluated when a call supplies that many; other calls,
+    // such as partial applications, still go through call. Lambdas defined in
+    // lime have an arity when their remaining parameters are neither & nor $.
+    virtual int arity() const
+    {
+      return value_arity;
+    }
+    virtual value call1(const value& arg1);
+    virtual value call2(const value& arg1, const value& arg2);
+    virtual value call3(const value& arg1, const value& arg2, const value& arg3);
+    // callN in tail position, with the n evaluated arguments in args
+    value tail_call_values(const value* args, int n);
+    // true for builtins that use their arguments as source code rather than
+    // evaluating them, and so must receive them uncompiled
+    virtual bool quotes_arguments() const
+    {
+      return false;
+    }
+    // true for builtins that modify the variable an argument names, such as
+    // push-back!, and for lambdas with & parameters left to bind
+    virtual bool modifies_arguments() const;
+    // true for builtins such as eval that run code in the caller's environment
+    virtual bool runs_in_caller_environment() const
+    {
+      return false;
+    }
+    // true if a call with n_args arguments may keep the caller's environment
+    // after it returns, as delay, partial applications of mutating builtins and
+    // lambdas with & or $ parameters do
+    virtual bool keeps_caller_environment(int n_args) const;
+    // the parameters and body source of a lambda defined in lime at the top
+    // level, taking evaluated arguments and with none bound yet, which the
+    // optimizer may inline; false for other lambdas and builtins
+    bool inline_source(vector< symbol >& params, value& src) const;
   private:
-    vector< symbol > params;
+    shared_ptr< environment >
+    bind_arguments(const vector< value >& args,
+                   const shared_ptr< environment >& caller_env_p, value& partial,
+                   bool nested);
+    shared_ptr< environment > bind_values(const value* args, int n, bool nested);
+    // a frame for a call, on the frame stack if the call is nested and its
+    // frames cannot outlive it
+    shared_ptr< environment > new_frame(bool nested) const;
+    // Lambdas called often enough are compiled to machine code if they can be
+    // (see jit.hpp); call_native returns false if the call is left to the body.
+    bool call_native(const value* args, int n, value& result);
+    void compile_native();
+    int n_params;
     vector< bool > reference_arg, delayed_arg;
-    value expr;
+    shared_ptr< scope > scope_p;
+    intrusive_ptr< node > body;
+    // the source code of the body
+    value source;
     shared_ptr< environment> creation_env_p;
+    vector< value > bound_args;
+    int value_arity;
+    // calls so far, or -1 once the lambda is known not to be compiled
+    int n_calls;
+    shared_ptr< native_code > native_p;
   };
 
-  class macro {
+  class macro : public object {
   public:
-    macro(vector< symbol > pars, value x) : params(pars), expr(x) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p);
+    macro(const vector< symbol >& pars, value x)
+      : object(type::macro), params(pars), expr(x) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    value expand(const vector< value >& args) const;
+    // the expansion of a call in env_p, compiled in tail position (see run)
+    intrusive_ptr< node > compiled_expansion(const vector< value >& args,
+                                             const shared_ptr< environment >& env_p);
   private:
+    // A call expands to the same code every time it is made with the same
+    // argument expressions in frames of the same scope. That includes the
+    // recursive call in the expansion of a macro like while, whose arguments
+    // are the very expressions the outer call was given.
+    class expansion {
+    public:
+      shared_ptr< scope > scope_p;
+      vector< value > args;
+      intrusive_ptr< node > code;
+    };
+    static const int max_expansions = 64;
     vector< symbol > params;
     value expr;
+    vector< expansion > expansions;
   };
 
-  class delayed {
+  class delayed : public object {
   public:
-    delayed(value x, shared_ptr< environment > ep) : expr(x), env_p(ep),
-                                                     already_run(false) {}
+    delayed(value x, const shared_ptr< environment >& ep)
+      : object(type::delayed), expr(x), env_p(ep), already_run(false) {}
     value force();
   private:
     value expr;
@@ -138,11 +528,97 @@ namespace lime {
     value cache;
   };
 
+  inline const string& value::get_string() const
+  {
+    return static_cast< string_object* >(get_object())->str;
+  }
+
+  inline const list& value::get_list() const
+  {
+    return static_cast< list_object* >(get_object())->lst;
+  }
+
+  inline reference* value::get_reference() const
+  {
+    return static_cast< reference* >(get_object());
+  }
+
+  inline lambda* value::get_lambda() const
+  {
+    return static_cast< lambda* >(get_object());
+  }
+
+  inline macro* value::get_macro() const
+  {
+    return static_cast< macro* >(get_object());
+  }
+
+  inline delayed* value::get_delayed() const
+  {
+    return static_cast< delayed* >(get_object());
+  }
+
   ostream& operator<<(ostream& out_stream, const value& val);
   ostream& output(ostream& out_stream, const value& val);
 
+  // The variables of the frames of one lambda or local body, in slot order.
+  // The analysis pass gives a slot to each parameter and each definition in
+  // the body; definitions compiled later, by eval or a macro, add slots.
+  // For the closures created in its frames (see closure.hpp), a scope also
+  // records the variables its code may assign to or modify, and whether the
+  // code is open, defining or looking up variables by name at run time
+  // through eval, load or a macro. The scope of a lambda records too whether
+  // its frames may escape, outliving the call they are made for because its
+  // body creates closures, delays or references with them (see frame_stack).
+  class scope {
+  public:
+    scope() : open(false), escaping(false) {}
+    int size() const;
+    // the slot of a variable, or -1
+    int find(symbol sym) const;
+    int add(symbol sym);
+    symbol name(int index) const;
+    void mark_changing(symbol sym);
+    bool is_changing(symbol sym) const;
+    // The global functions that variables are passed to by name without
+    // being marked changing, because the functions did not modify their
+    // arguments; the marks hold only while none of them is assigned.
+    void add_callee(symbol sym);
+    const vector< symbol >& get_callees() const
+    {
+      return callees;
+    }
+    void mark_open()
+    {
+      open = true;
+    }
+    bool is_open() const
+    {
+      return open;
+    }
+    void mark_escaping()
+    {
+      escaping = true;
+    }
+    bool is_escaping() const
+    {
+      return escaping;
+    }
+  private:
+    vector< symbol > names, changing, callees;
+    bool open, escaping;
+  };
+
+  // An environment is either a frame, which keeps the variables of a lambda
+  // call or local body in the slots given by its scope, or the global
+  // environment, which has no scope and keeps each variable in the slot given
+  // by its symbol id. Compiled code addresses variables by depth and slot; the
+  // methods taking symbols look them up by name.
   class environment {
   public:
+    environment() : n_slots(0), slots(small_slots) {}
+    environment(const environment&) = delete;
+    environment& operator=(const environment&) = delete;
     bool find(symbol sym);
     bool find(string str);
     value get(symbol sym);
@@ -152,14 +628,157 @@ namespace lime {
     bool find_local(symbol sym);
     void set_outermost(symbol sym, value val);
     value& get_ref(symbol sym);
-    friend shared_ptr< environment > nested_environment(shared_ptr< environment > 
-                                                        outer_env_p);
+    // the variable in a slot, or null if it is not bound
+    value* variable(int i)
+    {
+      if (i < 0 || i >= n_slots || slots[i].is_unbound())
+        return nullptr;
+      return &slots[i];
+    }
+    // the storage of a slot, which may be unbound
+    value& slot(int i)
+    {
+      if (i >= n_slots)
+        resize(i + 1);
+      return slots[i];
+    }
+    environment* outer() const
+    {
+      return outer_env_p.get();
+    }
+    const shared_ptr< environment >& shared_outer() const
+    {
+      return outer_env_p;
+    }
+    shared_ptr< scope > get_scope() const
+    {
+      return scope_p;
+    }
+    friend shared_ptr< environment >
+    nested_environment(const shared_ptr< environment >& outer_env_p,
+                       const shared_ptr< scope >& scope_p, bool on_stack);
   protected:
+    // frames of up to this many variables keep them inline
+    static const int n_small_slots = 4;
+    int index(symbol sym) const;
+    void resize(int n);
     shared_ptr< environment > outer_env_p;
-    unordered_map< symbol, value, symbol_hash > values;
+    shared_ptr< scope > scope_p;
+    int n_slots;
+    value* slots;
+    value small_slots[n_small_slots];
+    vector< value > large_slots;
+  };
+
+  // Frames are created and destroyed at every call, so the memory of those
+  // that are not captured goes on a free list for the next call instead of
+  // back to the heap. Each type the allocator is rebound to (shared_ptr's
+  // control block with the environment in it) has a free list of its own.
+  template< typename T >
+  class frame_allocator {
+  public:
+    typedef T value_type;
+    frame_allocator() {}
+    template< typename U >
+    frame_allocator(const frame_allocator< U >&) {}
+    T* allocate(size_t n)
+    {
+      if (n != 1)
+        return static_cast< T* >(::operator new(n * sizeof(T)));
+      if (!free_list)
+        return reinterpret_cast< T* >(new block);
+      block* block_p = free_list;
+      free_list = block_p->next;
+      return reinterpret_cast< T* >(block_p);
+    }
+    void deallocate(T* p, size_t n)
+    {
+      if (n != 1) {
+        ::operator delete(p);
+        return;
+      }
+      block* block_p = reinterpret_cast< block* >(p);
+      block_p->next = free_list;
+      free_list = block_p;
+    }
+  private:
+    union block {
+      block* next;
+      typename std::aligned_storage< sizeof(T), alignof(T) >::type storage;
+    };
+    static block* free_list;
+  };
+
+  template< typename T >
+  typename frame_allocator< T >::block* frame_allocator< T >::free_list = nullptr;
+
+  template< typename T, typename U >
+  bool operator==(const frame_allocator< T >&, const frame_allocator< U >&)
+  {
+    return true;
+  }
+
+  template< typename T, typename U >
+  bool operator!=(const frame_allocator< T >&, const frame_allocator< U >&)
+  {
+    return false;
+  }
+
+  // The frames of nested calls to lambdas whose frames do not escape are
+  // allocated from the frame stack instead: a region of blocks in which a call
+  // bumps a pointer and its return moves it back, so they come and go in
+  // order without touching a free list. A frame that outlives its call all
+  // the same, through a function the analysis could not see, stays where it
+  // is until it is freed; its block is reused once all its frames are gone.
+  // Calls in tail position replace the caller's frame rather than nest in it,
+  // and keep using pooled frames.
+  class frame_stack {
+  public:
+    static void* allocate(size_t size);
+    static void deallocate(void* p, size_t size);
+  };
+
+  template< typename T >
+  class frame_stack_allocator {
+  public:
+    typedef T value_type;
+    frame_stack_allocator() {}
+    template< typename U >
+    frame_stack_allocator(const frame_stack_allocator< U >&) {}
+    T* allocate(size_t n)
+    {
+      return static_cast< T* >(frame_stack::allocate(size(n)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+      frame_stack::deallocate(p, size(n));
+    }
+  private:
+    // sizes are kept multiples of the alignment the allocator guarantees
+    static size_t size(size_t n)
+    {
+      const size_t align = alignof(std::max_align_t);
+      return (n * sizeof(T) + align - 1) / align * align;
+    }
   };
 
-  shared_ptr< environment > nested_environment(shared_ptr< environment > outer_env_p);
+  template< typename T, typename U >
+  bool operator==(const frame_stack_allocator< T >&, const frame_stack_allocator< U >&)
+  {
+    return true;
+  }
+
+  template< typename T, typename U >
+  bool operator!=(const frame_stack_allocator< T >&, const frame_stack_allocator< U >&)
+  {
+    return false;
+  }
+
+  // a frame of scope_p inside outer_env_p, from the frame stack if on_stack
+  shared_ptr< environment > nested_environment(const shared_ptr< environment >&
+                                               outer_env_p,
+                                               const shared_ptr< scope >& scope_p,
+                                               bool on_stack = false);
 
 } // namespace lime
 
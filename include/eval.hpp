@@ -3,6 +3,7 @@
 
 // STL headers
 #include <memory>
+#include <vector>
 
 // lime headers
 #include <core.hpp>
@@ -10,12 +11,165 @@
 namespace lime {
   // STL
   using std::shared_ptr;
+  using std::vector;
 
   // lime
   using lime::environment;
+  using lime::node;
+  using lime::scope;
+  using lime::symbol;
   using lime::value;
 
-  value eval(value expr, shared_ptr< environment > env_p); 
+  // The scopes enclosing an expression, outermost first. The global
+  // environment is not included: it is the frame one level beyond the first
+  // scope.
+  typedef vector< shared_ptr< scope > > scope_chain;
+
+  // where a variable can be: a slot in the frame depth levels up, or, if
+  // index is -1, a variable that code run in that frame may define at run
+  // time, which is looked up by name
+  class location {
+  public:
+    location(int d, int i) : depth(d), index(i) {}
+    int depth, index;
+  };
+
+  inline environment* frame(environment* env_p, int depth)
+  {
+    for (; depth > 0; --depth)
+      env_p = env_p->outer();
+    return env_p;
+  }
+
+  // the variable at a location, or null if it is not bound
+  inline value* bound(const location& loc, environment* env_p)
+  {
+    return frame(env_p, loc.depth)->variable(loc.index);
+  }
+
+  // the variable sym at a location, looking it up by name if the location
+  // has no slot
+  inline value* bound(symbol sym, const location& loc, environment* env_p)
+  {
+    if (loc.index >= 0)
+      return bound(loc, env_p);
+    environment* frame_p = frame(env_p, loc.depth);
+    return frame_p->find_local(sym) ? &frame_p->get_ref(sym) : nullptr;
+  }
+
+  // every place in which sym can be bound, innermost first: its slot in each
+  // enclosing scope that has one, or a place to look it up by name in those
+  // that are open (see scope), then the global environment
+  vector< location > resolve(symbol sym, const scope_chain& scopes);
+
+  // a variable's slot in the innermost frame, which it is defined in
+  int definition_slot(symbol sym, scope_chain& scopes);
+
+  // the value of the variable sym resolved to locations, as a reference to it
+  // evaluates
+  value load_variable(symbol sym, const vector< location >& locations,
+                      const shared_ptr< environment >& env_p);
+
+  // what set! does to the variable sym resolved to locations
+  void assign_variable(symbol sym, const vector< location >& locations,
+                       const value& new_val, const shared_ptr< environment >& env_p);
+
+  // As define cannot rebind a variable, a global function stays bound to
+  // its name unless set! or a reference assigns to it. set! marks the name
+  // when it is compiled and a reference when it is set; a newly marked name
+  // bumps assignment_epoch.
+  extern long assignment_epoch;
+  void mark_assigned(symbol sym);
+  bool is_assigned(symbol sym);
+
+  // The value of a variable that resolves only to the global environment,
+  // kept once it is a function whose name has not been marked, so that calls
+  // of builtins and library functions do not look them up every time.
+  class global_binding {
+  public:
+    global_binding() : epoch(-1) {}
+    value get(symbol sym, const vector< location >& locations,
+              const shared_ptr< environment >& env_p)
+    {
+      if (epoch == assignment_epoch)
+        return val;
+      return lookup(sym, locations, env_p);
+    }
+  private:
+    value lookup(symbol sym, const vector< location >& locations,
+                 const shared_ptr< environment >& env_p);
+    value val;
+    long epoch;
+  };
+
+  // Runs code, which relies on the global functions in dependencies, until
+  // one of them is marked, and fallback from then on.
+  class guarded_node : public node {
+  public:
+    guarded_node(const vector< symbol >& deps, intrusive_ptr< node > c,
+                 intrusive_ptr< node > f)
+      : dependencies(deps), code(c), fallback(f), epoch(-1) {}
+    value execute(const shared_ptr< environment >& env_p)
+    {
+      if (epoch != assignment_epoch)
+        check_dependencies();
+      return code->execute(env_p);
+    }
+  private:
+    void check_dependencies();
+    vector< symbol > dependencies;
+    intrusive_ptr< node > code, fallback;
+    long epoch;
+  };
+
+  // not stays a function in the library, so that it can be passed around,
+  // but a call (not e) in scopes is made inline, depending on not, while not
+  // resolves only to the global environment and has not been marked
+  bool inlines_not(const list& expr, const scope_chain& scopes);
+
+  // analyses an expression once, deciding its special forms and where its
+  // variables are, so that it can be executed many times in env_p or in
+  // another environment with the same scopes; lambda bodies are compiled along
+  // with it. An expression compiled in tail position must be executed by run.
+  intrusive_ptr< node > compile(const value& expr, const shared_ptr< environment >& env_p,
+                                bool tail = false);
+  intrusive_ptr< node > compile(const value& expr, scope_chain& scopes, bool tail);
+
+  // compiles an expression to a tree of nodes even when the bytecode compiler
+  // is in use, which leaves the forms it does not handle to this
+  intrusive_ptr< node > compile_tree(const value& expr, scope_chain& scopes, bool tail);
+
+  // whether sym names a special form, which it does even where a variable
+  // of that name is in scope
+  bool is_special_form(symbol sym);
+
+  // Pushes s onto scopes as the scope of the frames that the forms of expr
+  // from first on run in, as a local body or a for-each iteration does, adding
+  // the variables they define and recording what they do to them (see
+  // scan_scope).
+  void push_scope(const shared_ptr< scope >& s, const list& expr, int first,
+                  scope_chain& scopes);
+
+  // what (for i a b body) is compiled as, a local block with a while loop
+  value for_loop(const list& expr);
+
+  // a compiled expression that evaluates to val
+  intrusive_ptr< node > make_constant(const value& val);
+
+  // Executes code compiled in tail position. The calls it ends with return
+  // value::tail_call() after leaving the body to run and its frame with
+  // tail_call, so that run makes them in a loop rather than on the C++ stack.
+  value run(intrusive_ptr< node > code, shared_ptr< environment > env_p);
+  value tail_call(intrusive_ptr< node > code, shared_ptr< environment > env_p);
+
+  // Recursion is only limited by memory, as run moves to stack segments on
+  // the heap when the process stack runs low. set_max_depth caps the number
+  // of nested runs, past which run reports an error, to stop runaway
+  // recursion early; there is no cap unless it is called.
+  void set_max_depth(long n);
+
+  // executes compiled expressions; other expressions are compiled first
+  value eval(const value& expr, const shared_ptr< environment >& env_p);
 
 } // namespace lime
 
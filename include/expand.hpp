@@ -9,7 +9,8 @@ namespace lime {
   using lime::symbol;
   using lime::value;
 
-  value expand(value expr, vector< symbol > params, vector< value > args); 
+  value expand(const value& expr, const vector< symbol >& params,
+               const vector< value >& args); 
 
 } // namespace lime
 
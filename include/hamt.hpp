@@ -0,0 +1,139 @@
+#ifndef __HAMT_HPP__
+#define __HAMT_HPP__
+
+// C headers
+#include <cstddef>
+
+// STL headers
+#include <functional>
+#include <vector>
+
+// lime headers
+#include <builtins.hpp>
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::function;
+  using std::shared_ptr;
+  using std::vector;
+
+  // Boost
+  using boost::intrusive_ptr;
+
+  // lime
+  using lime::environment;
+  using lime::lambda;
+  using lime::object;
+  using lime::value;
+
+  class hamt_node;
+
+  void intrusive_ptr_add_ref(hamt_node* node_p);
+
+  void intrusive_ptr_release(hamt_node* node_p);
+
+  // An immutable map, stored as a hash array mapped trie. Updating a map
+  // copies only the path from the root to the updated entry, and shares the
+  // rest of the trie with the original. Nodes that are not shared are updated
+  // in place, so building a map by successive updates of a variable is cheap.
+  class persistent_map : public object {
+  public:
+    persistent_map();
+    persistent_map(const persistent_map& other);
+    long size() const;
+    // the value bound to key, or nullptr
+    const value* find(const value& key) const;
+    void set(const value& key, const value& val);
+    // returns false if the key was not present
+    bool remove(const value& key);
+    // calls f(key, value) for each entry, in an unspecified order
+    void for_each(const function< void(const value&, const value&) >& f) const;
+  private:
+    intrusive_ptr< hamt_node > root;
+    long count;
+  };
+
+  bool maps_equal(const persistent_map& a, const persistent_map& b);
+
+  const persistent_map& get_map(const value& val);
+
+  class make_map : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class map_assoc : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 3;
+    }
+    value call3(const value& arg1, const value& arg2, const value& arg3);
+  };
+
+  class map_dissoc : public binary_builtin {
+  public:
+    map_dissoc();
+  };
+
+  class map_assoc_in_place : public mutating_builtin {
+  public:
+    map_assoc_in_place() : mutating_builtin(3) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class map_dissoc_in_place : public mutating_builtin {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class map_get : public binary_builtin {
+  public:
+    map_get();
+  };
+
+  class map_contains : public binary_builtin {
+  public:
+    map_contains();
+  };
+
+  class map_merge : public binary_builtin {
+  public:
+    map_merge();
+  };
+
+  class map_fold : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class map_keys : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class map_values : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class map_to_list : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  void add_map_builtins(const shared_ptr< environment >& env_p);
+
+} // namespace lime
+
+#endif // __HAMT_HPP__
@@ -0,0 +1,129 @@
+#ifndef __HASH_TABLE_HPP__
+#define __HASH_TABLE_HPP__
+
+// C headers
+#include <cstddef>
+
+// STL headers
+#include <vector>
+
+// lime headers
+#include <builtins.hpp>
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::vector;
+
+  // lime
+  using lime::environment;
+  using lime::lambda;
+  using lime::object;
+  using lime::value;
+
+  // structural hash, consistent with keys_equal
+  size_t hash_value(const value& val);
+
+  // the key equality of hash tables and maps: '=', except that symbols and nil
+  // are also equal to themselves, and that a float equals an integer only if
+  // it is exactly that whole number, so that the equality stays transitive
+  // beyond the integers that doubles represent exactly
+  bool keys_equal(const value& a, const value& b);
+
+  // A mutable hash table with open addressing and linear probing. Like lists
+  // and vectors, tables are values: the mutating builtins copy a table first if
+  // it is shared.
+  class hash_table : public object {
+  public:
+    hash_table();
+    hash_table(const hash_table& other);
+    long size() const;
+    // the value bound to key, or nullptr
+    const value* find(const value& key) const;
+    void set(const value& key, const value& val);
+    // returns false if the key was not present
+    bool remove(const value& key);
+    // calls f(key, value) for each entry, in an unspecified order
+    template< typename F >
+    void for_each(F f) const
+    {
+      for (const slot& s: slots)
+        if (s.state == slot::full)
+          f(s.key, s.val);
+    }
+  private:
+    struct slot {
+      enum slot_state { empty, full, deleted };
+      slot() : state(empty), hash(0) {}
+      slot_state state;
+      size_t hash;
+      value key;
+      value val;
+    };
+    long find_slot(const value& key, size_t hash) const;
+    void rehash(size_t capacity);
+    vector< slot > slots;
+    long count;   // full slots
+    long used;    // full and deleted slots
+  };
+
+  bool hash_tables_equal(const hash_table& a, const hash_table& b);
+
+  const hash_table& get_hash_table(const value& val);
+
+  // the table in a variable, unshared so it can be modified in place
+  hash_table& get_mutable_hash_table(value& var);
+
+  class make_hash_table : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class hash_ref : public binary_builtin {
+  public:
+    hash_ref();
+  };
+
+  class hash_contains : public binary_builtin {
+  public:
+    hash_contains();
+  };
+
+  class hash_set : public mutating_builtin {
+  public:
+    hash_set() : mutating_builtin(3) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class hash_remove : public mutating_builtin {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class hash_keys : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class hash_values : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class hash_to_list : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  void add_hash_table_builtins(const shared_ptr< environment >& env_p);
+
+} // namespace lime
+
+#endif // __HASH_TABLE_HPP__
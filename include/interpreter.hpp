@@ -29,11 +29,26 @@ namespace lime {
 
   void check(bool test, const string& error_msg);
 
-  void load_file(const string& path, shared_ptr< environment > env_p);
-
-  void load_stdlib(shared_ptr< environment > env_p);
-
-  void repl(shared_ptr< environment > env_p);
+  // Checks are made on every call of most builtins, so these only build the
+  // message when the test fails. The second one puts a name between prefix
+  // and suffix.
+  inline void check(bool test, const char* error_msg)
+  {
+    if (!test)
+      check(false, string(error_msg));
+  }
+
+  inline void check(bool test, const char* prefix, const string& name, const char* suffix)
+  {
+    if (!test)
+      check(false, prefix + name + suffix);
+  }
+
+  void load_file(const string& path, const shared_ptr< environment >& env_p);
+
+  void load_stdlib(const shared_ptr< environment >& env_p);
+
+  void repl(const shared_ptr< environment >& env_p);
 
 } // namespace lime
 
@@ -0,0 +1,24 @@
+#ifndef __JIT_HPP__
+#define __JIT_HPP__
+
+// lime headers
+#include <core.hpp>
+
+namespace lime {
+  // A lambda taking one to three evaluated arguments is compiled to x86-64
+  // machine code after jit_threshold calls, if its body only uses integer
+  // arithmetic, comparisons, conditionals, its parameters, global constants
+  // and calls to itself. The machine code gives up on anything it does not
+  // handle at run time, such as an argument that is not an integer or a
+  // result that needs a bignum; since it has no side effects, the call is
+  // then simply made again by the interpreter.
+  const int jit_threshold = 1000;
+
+  // The compiler is on by default where it is supported, which is x86-64
+  // Linux; --no-jit turns it off.
+  void use_jit(bool on);
+  bool jit_enabled();
+
+} // namespace lime
+
+#endif // __JIT_HPP__
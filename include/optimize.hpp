@@ -0,0 +1,55 @@
+#ifndef __OPTIMIZE_HPP__
+#define __OPTIMIZE_HPP__
+
+// STL headers
+#include <memory>
+#include <vector>
+
+// lime headers
+#include <core.hpp>
+#include <eval.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::vector;
+
+  // lime
+  using lime::environment;
+  using lime::node;
+  using lime::scope_chain;
+  using lime::symbol;
+  using lime::value;
+
+  // Before a top-level expression is compiled, the optimizer folds arithmetic
+  // and comparisons on constants, inlines calls of small global functions
+  // whose bodies have no side effects, and drops the begin and local wrappers
+  // this leaves with nothing to do. It is on unless lime is started with
+  // --no-optimize; --dump-optimized prints every expression it rewrites.
+  void use_optimizer(bool on);
+  void dump_optimized(bool on);
+
+  // expr rewritten for compiling in scopes, globals_p being the global
+  // environment
+  value optimize(const value& expr, const scope_chain& scopes, environment* globals_p);
+
+  // An expression the optimizer rewrote, as it appears in the rewritten
+  // expression around it. The rewritten form relies on the global variables
+  // in dependencies, functions and the constants true and false, which stay
+  // bound to their names until set! or a reference assigns to one of them
+  // (see mark_assigned); the code compiled from it then evaluates the
+  // expression as it was written instead.
+  class optimized_form : public node {
+  public:
+    optimized_form(const value& orig, const value& rw, const vector< symbol >& deps)
+      : original(orig), rewritten(rw), dependencies(deps) {}
+    // evaluates the expression as written
+    value execute(const shared_ptr< environment >& env_p);
+    intrusive_ptr< node > compile(scope_chain& scopes, bool tail) const;
+    const value original, rewritten;
+    const vector< symbol > dependencies;
+  };
+
+} // namespace lime
+
+#endif // __OPTIMIZE_HPP__
@@ -0,0 +1,84 @@
+#ifndef __REAL_HPP__
+#define __REAL_HPP__
+
+// STL headers
+#include <string>
+
+// lime headers
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::string;
+
+  // lime
+  using lime::environment;
+  using lime::lambda;
+  using lime::object;
+  using lime::value;
+
+  // A double-precision floating-point number. Floats are boxed, since a value
+  // is a single word and every immediate bit pattern is taken.
+  class real_object : public object {
+  public:
+    explicit real_object(double d) : object(type::real), number(d) {}
+    const double number;
+  };
+
+  value make_real(double d);
+
+  double get_real(const value& val);
+
+  // true for integers, bignums and floats
+  bool is_number(const value& val);
+
+  // the value of a number as a double
+  double to_double(const value& val);
+
+  // the shortest representation that reads back as the same double; it always
+  // contains a decimal point or an exponent, so that it does not read as an
+  // integer
+  string real_to_string(double d);
+
+  // true if token is a decimal number with a fractional part or an exponent
+  bool float_literal(const string& token);
+
+  class to_float : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  class truncate : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  class square_root : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  void add_real_builtins(const shared_ptr< environment >& env_p);
+
+} // namespace lime
+
+#endif // __REAL_HPP__
@@ -0,0 +1,96 @@
+#ifndef __STRINGS_HPP__
+#define __STRINGS_HPP__
+
+// C headers
+#include <cstddef>
+
+// STL headers
+#include <string>
+
+// lime headers
+#include <builtins.hpp>
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::string;
+
+  // lime
+  using lime::environment;
+  using lime::lambda;
+  using lime::value;
+
+  // the position of the first occurrence of needle in haystack at or after
+  // from, or string::npos
+  size_t find_substring(const string& haystack, const string& needle, size_t from = 0);
+
+  class string_length : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  class string_concat : public binary_builtin {
+  public:
+    string_concat();
+  };
+
+  class substring : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 3;
+    }
+    value call3(const value& arg1, const value& arg2, const value& arg3);
+  };
+
+  class index_of : public binary_builtin {
+  public:
+    index_of();
+  };
+
+  class split_string : public binary_builtin {
+  public:
+    split_string();
+  };
+
+  class join_strings : public binary_builtin {
+  public:
+    join_strings();
+  };
+
+  class string_to_int : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  class int_to_string : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  void add_string_builtins(const shared_ptr< environment >& env_p);
+
+} // namespace lime
+
+#endif // __STRINGS_HPP__
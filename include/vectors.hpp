@@ -0,0 +1,104 @@
+#ifndef __VECTORS_HPP__
+#define __VECTORS_HPP__
+
+// STL headers
+#include <vector>
+
+// lime headers
+#include <builtins.hpp>
+#include <core.hpp>
+
+namespace lime {
+  // STL
+  using std::shared_ptr;
+  using std::vector;
+
+  // lime
+  using lime::environment;
+  using lime::lambda;
+  using lime::object;
+  using lime::value;
+
+  // A vector keeps its elements in one contiguous buffer. Like lists, vectors
+  // are values: the mutating builtins copy the buffer first if it is shared.
+  class vector_object : public object {
+  public:
+    vector_object() : object(type::vector) {}
+    explicit vector_object(const vector< value >& v) : object(type::vector), items(v) {}
+    vector< value > items;
+  };
+
+  const vector< value >& get_vector(const value& val);
+
+  // the elements of a vector variable, unshared so they can be modified in place
+  vector< value >& get_mutable_vector(value& var);
+
+  class make_vector : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class make_filled_vector : public binary_builtin {
+  public:
+    make_filled_vector();
+  };
+
+  class vector_ref : public binary_builtin {
+  public:
+    vector_ref();
+  };
+
+  class vector_set : public mutating_builtin {
+  public:
+    vector_set() : mutating_builtin(3) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class vector_push : public mutating_builtin {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class vector_pop : public mutating_builtin {
+  public:
+    vector_pop() : mutating_builtin(1) {}
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class vector_slice : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+  };
+
+  class list_to_vector : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  class vector_to_list : public lambda {
+  public:
+    value call(const vector< value >& args,
+               const shared_ptr< environment >& caller_env_p);
+    int arity() const
+    {
+      return 1;
+    }
+    value call1(const value& arg1);
+  };
+
+  void add_vector_builtins(const shared_ptr< environment >& env_p);
+
+} // namespace lime
+
+#endif // __VECTORS_HPP__
@@ -0,0 +1,27 @@
+#ifndef __VM_HPP__
+#define __VM_HPP__
+
+// lime headers
+#include <core.hpp>
+#include <eval.hpp>
+
+namespace lime {
+  // lime
+  using lime::list;
+  using lime::node;
+  using lime::scope_chain;
+
+  // The bytecode engine is off unless lime is started with --vm; compile then
+  // hands it every list, and it returns null for the forms it leaves to the
+  // tree of nodes.
+  void use_vm(bool on);
+  bool vm_enabled();
+
+  // compiles expr to a node that runs it on the virtual machine, or returns
+  // null if the whole form is better executed as a tree
+  intrusive_ptr< node > compile_bytecode(const list& expr, scope_chain& scopes,
+                                         bool tail);
+
+} // namespace lime
+
+#endif // __VM_HPP__
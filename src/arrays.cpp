@@ -0,0 +1,807 @@
+// C headers
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// lime headers
+#include <arrays.hpp>
+#include <bignum.hpp>
+#include <builtins.hpp>
+#include <eval.hpp>
+#include <interpreter.hpp>
+#include <real.hpp>
+
+namespace lime {
+  // lime
+  using lime::call_binary;
+  using lime::call_modify_variable;
+  using lime::call_set_element;
+  using lime::check;
+  using lime::eval;
+  using lime::integer_add;
+  using lime::integer_multiply;
+  using lime::integer_subtract;
+  using lime::is_number;
+  using lime::make_integer;
+  using lime::make_object;
+  using lime::make_real;
+  using lime::to_double;
+
+  // The kernels below have an AVX2 version, selected at run time when the
+  // processor supports it, an SSE2 version for other x86-64 processors, and a
+  // scalar version, which also handles the elements left over by the others.
+
+  bool has_avx2()
+  {
+#ifdef __x86_64__
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+  }
+
+  class add_doubles {
+  public:
+    static double scalar(double x, double y)
+    {
+      return x + y;
+    }
+#ifdef __x86_64__
+    static __m128d sse2(__m128d x, __m128d y)
+    {
+      return _mm_add_pd(x, y);
+    }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d x, __m256d y)
+    {
+      return _mm256_add_pd(x, y);
+    }
+#endif
+  };
+
+  class multiply_doubles {
+  public:
+    static double scalar(double x, double y)
+    {
+      return x * y;
+    }
+#ifdef __x86_64__
+    static __m128d sse2(__m128d x, __m128d y)
+    {
+      return _mm_mul_pd(x, y);
+    }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d x, __m256d y)
+    {
+      return _mm256_mul_pd(x, y);
+    }
+#endif
+  };
+
+  class min_doubles {
+  public:
+    static double scalar(double x, double y)
+    {
+      return y < x ? y : x;
+    }
+#ifdef __x86_64__
+    static __m128d sse2(__m128d x, __m128d y)
+    {
+      return _mm_min_pd(x, y);
+    }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d x, __m256d y)
+    {
+      return _mm256_min_pd(x, y);
+    }
+#endif
+  };
+
+  class max_doubles {
+  public:
+    static double scalar(double x, double y)
+    {
+      return y > x ? y : x;
+    }
+#ifdef __x86_64__
+    static __m128d sse2(__m128d x, __m128d y)
+    {
+      return _mm_max_pd(x, y);
+    }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d x, __m256d y)
+    {
+      return _mm256_max_pd(x, y);
+    }
+#endif
+  };
+
+  // out[i] = op(a[i], b[i]) for i in [from, n)
+  template< typename Op >
+  void map_doubles_scalar(const double* a, const double* b, double* out, size_t from,
+                          size_t n)
+  {
+    for (size_t i = from; i < n; ++i)
+      out[i] = Op::scalar(a[i], b[i]);
+  }
+
+#ifdef __x86_64__
+  template< typename Op >
+  __attribute__((target("avx2")))
+  void map_doubles_avx2(const double* a, const double* b, double* out, size_t n)
+  {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(out + i, Op::avx2(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    map_doubles_scalar< Op >(a, b, out, i, n);
+  }
+
+  template< typename Op >
+  void map_doubles_sse2(const double* a, const double* b, double* out, size_t n)
+  {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_pd(out + i, Op::sse2(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    map_doubles_scalar< Op >(a, b, out, i, n);
+  }
+#endif
+
+  template< typename Op >
+  void map_doubles(const double* a, const double* b, double* out, size_t n)
+  {
+#ifdef __x86_64__
+    if (has_avx2())
+      map_doubles_avx2< Op >(a, b, out, n);
+    else
+      map_doubles_sse2< Op >(a, b, out, n);
+#else
+    map_doubles_scalar< Op >(a, b, out, 0, n);
+#endif
+  }
+
+  // folds op over a[from, n), starting from acc
+  template< typename Op >
+  double reduce_doubles_scalar(const double* a, size_t from, size_t n, double acc)
+  {
+    for (size_t i = from; i < n; ++i)
+      acc = Op::scalar(acc, a[i]);
+    return acc;
+  }
+
+#ifdef __x86_64__
+  // two accumulators hide the latency of the operation
+  template< typename Op >
+  __attribute__((target("avx2")))
+  double reduce_doubles_avx2(const double* a, size_t n, double init)
+  {
+    __m256d acc0 = _mm256_set1_pd(init), acc1 = acc0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      acc0 = Op::avx2(acc0, _mm256_loadu_pd(a + i));
+      acc1 = Op::avx2(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, Op::avx2(acc0, acc1));
+    double acc = Op::scalar(Op::scalar(lanes[0], lanes[1]), Op::scalar(lanes[2], lanes[3]));
+    return reduce_doubles_scalar< Op >(a, i, n, acc);
+  }
+
+  template< typename Op >
+  double reduce_doubles_sse2(const double* a, size_t n, double init)
+  {
+    __m128d acc0 = _mm_set1_pd(init), acc1 = acc0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      acc0 = Op::sse2(acc0, _mm_loadu_pd(a + i));
+      acc1 = Op::sse2(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, Op::sse2(acc0, acc1));
+    return reduce_doubles_scalar< Op >(a, i, n, Op::scalar(lanes[0], lanes[1]));
+  }
+#endif
+
+  // init must be an identity of op, or an element of a if op is idempotent
+  template< typename Op >
+  double reduce_doubles(const double* a, size_t n, double init)
+  {
+#ifdef __x86_64__
+    if (has_avx2())
+      return reduce_doubles_avx2< Op >(a, n, init);
+    return reduce_doubles_sse2< Op >(a, n, init);
+#else
+    return reduce_doubles_scalar< Op >(a, 0, n, init);
+#endif
+  }
+
+#ifdef __x86_64__
+  __attribute__((target("avx2")))
+  void scale_doubles_avx2(const double* a, double k, double* out, size_t n, size_t& i)
+  {
+    __m256d factor = _mm256_set1_pd(k);
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+  }
+
+  __attribute__((target("avx2")))
+  double dot_doubles_avx2(const double* a, const double* b, size_t n, size_t& i)
+  {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = acc0;
+    for (; i + 8 <= n; i += 8) {
+      acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                               _mm256_loadu_pd(b + i)));
+      acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                               _mm256_loadu_pd(b + i + 4)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+#endif
+
+  void scale_doubles(const double* a, double k, double* out, size_t n)
+  {
+    size_t i = 0;
+#ifdef __x86_64__
+    if (has_avx2())
+      scale_doubles_avx2(a, k, out, n, i);
+    else {
+      __m128d factor = _mm_set1_pd(k);
+      for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    }
+#endif
+    for (; i < n; ++i)
+      out[i] = a[i] * k;
+  }
+
+  double dot_doubles(const double* a, const double* b, size_t n)
+  {
+    size_t i = 0;
+    double acc = 0;
+#ifdef __x86_64__
+    if (has_avx2())
+      acc = dot_doubles_avx2(a, b, n, i);
+    else {
+      __m128d acc0 = _mm_setzero_pd();
+      for (; i + 2 <= n; i += 2)
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+      double lanes[2];
+      _mm_storeu_pd(lanes, acc0);
+      acc = lanes[0] + lanes[1];
+    }
+#endif
+    for (; i < n; ++i)
+      acc += a[i] * b[i];
+    return acc;
+  }
+
+  // each pair is summed in a register ([x0, x1] + [0, x0]) and offset by the
+  // running total
+  void prefix_sum_doubles(const double* a, double* out, size_t n)
+  {
+    size_t i = 0;
+    double acc = 0;
+#ifdef __x86_64__
+    __m128d carry = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2) {
+      __m128d x = _mm_loadu_pd(a + i);
+      x = _mm_add_pd(_mm_add_pd(x, _mm_unpacklo_pd(_mm_setzero_pd(), x)), carry);
+      _mm_storeu_pd(out + i, x);
+      carry = _mm_unpackhi_pd(x, x);
+    }
+    if (i > 0)
+      acc = out[i - 1];
+#endif
+    for (; i < n; ++i)
+      out[i] = acc += a[i];
+  }
+
+#ifdef __x86_64__
+  // the sign bit of the result is set if any sum overflowed
+  __attribute__((target("avx2")))
+  int64_t add_int64_avx2(const int64_t* a, const int64_t* b, int64_t* out, size_t n,
+                         size_t& i)
+  {
+    __m256i flags = _mm256_setzero_si256();
+    for (; i + 4 <= n; i += 4) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i));
+      __m256i y = _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i));
+      __m256i r = _mm256_add_epi64(x, y);
+      flags = _mm256_or_si256(flags, _mm256_and_si256(_mm256_xor_si256(x, r),
+                                                      _mm256_xor_si256(y, r)));
+      _mm256_storeu_si256(reinterpret_cast< __m256i* >(out + i), r);
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast< __m256i* >(lanes), flags);
+    return lanes[0] | lanes[1] | lanes[2] | lanes[3];
+  }
+
+  __attribute__((target("avx2")))
+  void min_max_int64_avx2(const int64_t* a, size_t n, size_t& i, int64_t& min,
+                          int64_t& max)
+  {
+    __m256i min_v = _mm256_set1_epi64x(min), max_v = min_v;
+    for (; i + 4 <= n; i += 4) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i));
+      min_v = _mm256_blendv_epi8(min_v, x, _mm256_cmpgt_epi64(min_v, x));
+      max_v = _mm256_blendv_epi8(max_v, x, _mm256_cmpgt_epi64(x, max_v));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast< __m256i* >(lanes), min_v);
+    for (int64_t lane: lanes)
+      min = lane < min ? lane : min;
+    _mm256_storeu_si256(reinterpret_cast< __m256i* >(lanes), max_v);
+    for (int64_t lane: lanes)
+      max = lane > max ? lane : max;
+  }
+#endif
+
+  // returns false if any sum overflows
+  bool add_int64(const int64_t* a, const int64_t* b, int64_t* out, size_t n)
+  {
+    size_t i = 0;
+    int64_t flags = 0;
+#ifdef __x86_64__
+    if (has_avx2())
+      flags = add_int64_avx2(a, b, out, n, i);
+    else {
+      __m128i flags_v = _mm_setzero_si128();
+      for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast< const __m128i* >(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast< const __m128i* >(b + i));
+        __m128i r = _mm_add_epi64(x, y);
+        flags_v = _mm_or_si128(flags_v, _mm_and_si128(_mm_xor_si128(x, r),
+                                                      _mm_xor_si128(y, r)));
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(out + i), r);
+      }
+      int64_t lanes[2];
+      _mm_storeu_si128(reinterpret_cast< __m128i* >(lanes), flags_v);
+      flags = lanes[0] | lanes[1];
+    }
+#endif
+    bool overflow = flags < 0;
+    for (; i < n; ++i)
+      overflow |= __builtin_add_overflow(a[i], b[i], &out[i]);
+    return !overflow;
+  }
+
+  void min_max_int64(const int64_t* a, size_t n, int64_t& min, int64_t& max)
+  {
+    size_t i = 0;
+    min = max = a[0];
+#ifdef __x86_64__
+    if (has_avx2())
+      min_max_int64_avx2(a, n, i, min, max);
+#endif
+    for (; i < n; ++i) {
+      min = a[i] < min ? a[i] : min;
+      max = a[i] > max ? a[i] : max;
+    }
+  }
+
+  value int128_to_value(__int128 x)
+  {
+    if (x >= INT64_MIN && x <= INT64_MAX)
+      return make_integer(long(x));
+    unsigned __int128 u = x < 0 ? -(unsigned __int128)x : x;
+    value two_32 = make_integer(1L << 32);
+    value result = make_integer(long(u >> 96));
+    for (int shift = 64; shift >= 0; shift -= 32)
+      result = integer_add(integer_multiply(result, two_32),
+                           make_integer(long((u >> shift) & 0xFFFFFFFF)));
+    return x < 0 ? integer_subtract(0L, result) : result;
+  }
+
+  // the sum of the elements, exact even if it overflows 64 bits
+  value sum_int64(const int64_t* a, size_t n)
+  {
+    int64_t total = 0;
+    bool overflow = false;
+    for (size_t i = 0; i < n && !overflow; ++i)
+      overflow = __builtin_add_overflow(total, a[i], &total);
+    if (!overflow)
+      return make_integer(long(total));
+    __int128 wide = 0;
+    for (size_t i = 0; i < n; ++i)
+      wide += a[i];
+    return int128_to_value(wide);
+  }
+
+  // the dot product, exact even if it overflows 64 bits
+  value dot_int64(const int64_t* a, const int64_t* b, size_t n)
+  {
+    __int128 acc = 0;
+    value big_acc = 0L;
+    for (size_t i = 0; i < n; ++i) {
+      __int128 product = __int128(a[i]) * b[i];
+      if (__builtin_add_overflow(acc, product, &acc)) {
+        // flush the accumulator, which is about to overflow 128 bits
+        big_acc = integer_add(big_acc, int128_to_value(acc - product));
+        acc = product;
+      }
+    }
+    return integer_add(big_acc, int128_to_value(acc));
+  }
+
+  const vector< int64_t >& get_int_array(const value& val)
+  {
+    return static_cast< int_array* >(val.get_object())->items;
+  }
+
+  const vector< double >& get_float_array(const value& val)
+  {
+    return static_cast< float_array* >(val.get_object())->items;
+  }
+
+  vector< int64_t >& get_mutable_int_array(value& var)
+  {
+    if (var.get_object()->ref_count > 1)
+      var = make_object< int_array >(type::int_array, get_int_array(var));
+    return static_cast< int_array* >(var.get_object())->items;
+  }
+
+  vector< double >& get_mutable_float_array(value& var)
+  {
+    if (var.get_object()->ref_count > 1)
+      var = make_object< float_array >(type::float_array, get_float_array(var));
+    return static_cast< float_array* >(var.get_object())->items;
+  }
+
+  bool is_array(const value& val)
+  {
+    return val.is(type::int_array) || val.is(type::float_array);
+  }
+
+  long array_size(const value& val)
+  {
+    if (val.is(type::int_array))
+      return get_int_array(val).size();
+    return get_float_array(val).size();
+  }
+
+  bool arrays_equal(const value& a, const value& b)
+  {
+    if (a.is(type::int_array))
+      return get_int_array(a) == get_int_array(b);
+    return get_float_array(a) == get_float_array(b);
+  }
+
+  // converts an integer value to an element of an integer array
+  int64_t to_int64(const value& val, const string& error_msg)
+  {
+    if (val.is_int())
+      return val.get_int();
+    check(is_integer(val) && integer_compare(val, make_integer(INT64_MIN)) >= 0 &&
+          integer_compare(val, make_integer(INT64_MAX)) <= 0, error_msg);
+    int64_t n = 0;
+    // the value has at most two limbs
+    const bignum* big = static_cast< const bignum* >(val.get_object());
+    uint64_t mag = big->digits[0] | (big->digits.size() > 1 ?
+                                     uint64_t(big->digits[1]) << 32 : 0);
+    n = big->negative ? int64_t(0 - mag) : int64_t(mag);
+    return n;
+  }
+
+  value int_array_value(const vector< int64_t >& items)
+  {
+    return make_object< int_array >(type::int_array, items);
+  }
+
+  value float_array_value(const vector< double >& items)
+  {
+    return make_object< float_array >(type::float_array, items);
+  }
+
+  value filled_int_array(const value& n, const value& fill)
+  {
+    check(n.is_int() && n.get_int() >= 0,
+          "first argument to 'make-int-array' must be a non-negative integer.");
+    return int_array_value(vector< int64_t >(
+      n.get_int(), to_int64(fill, "second argument to 'make-int-array' must be a "
+                                  "64-bit integer.")));
+  }
+
+  make_int_array::make_int_array() : binary_builtin(filled_int_array, "make-int-array") {}
+
+  value filled_float_array(const value& n, const value& fill)
+  {
+    check(n.is_int() && n.get_int() >= 0 && is_number(fill),
+          "arguments to 'make-float-array' must be a non-negative integer and a number.");
+    return float_array_value(vector< double >(n.get_int(), to_double(fill)));
+  }
+
+  make_float_array::make_float_array()
+    : binary_builtin(filled_float_array, "make-float-array") {}
+
+  value list_to_int_array::call(const vector< value >& args,
+                                const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'list->int-array' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value list_to_int_array::call1(const value& arg)
+  {
+    const string error_msg("argument to 'list->int-array' must be a list of 64-bit "
+                           "integers.");
+    check(arg.is(type::list), error_msg);
+    vector< int64_t > items;
+    items.reserve(arg.get_list().size());
+    for (const value& item: arg.get_list())
+      items.push_back(to_int64(item, error_msg));
+    return int_array_value(items);
+  }
+
+  value list_to_float_array::call(const vector< value >& args,
+                                  const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1,
+          "wrong number of arguments to 'list->float-array' (must be 1).");
+    value arg = eval(args.front(), caller_env_p);
+    const string error_msg("argument to 'list->float-array' must be a list of numbers.");
+    check(arg.is(type::list), error_msg);
+    vector< double > items;
+    items.reserve(arg.get_list().size());
+    for (const value& item: arg.get_list()) {
+      check(is_number(item), error_msg);
+      items.push_back(to_double(item));
+    }
+    return float_array_value(items);
+  }
+
+  value range_array(const value& from, const value& to)
+  {
+    check(from.is_int() && to.is_int(), "arguments to 'array-range' must be integers.");
+    vector< int64_t > items;
+    if (from.get_int() <= to.get_int()) {
+      items.reserve(to.get_int() - from.get_int() + 1);
+      for (long i = from.get_int(); i <= to.get_int(); ++i)
+        items.push_back(i);
+    }
+    return int_array_value(items);
+  }
+
+  array_range::array_range() : binary_builtin(range_array, "array-range") {}
+
+  value array_to_list::call(const vector< value >& args,
+                            const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'array->list' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value array_to_list::call1(const value& arg)
+  {
+    check(is_array(arg), "argument to 'array->list' must be an array.");
+    list lst;
+    if (arg.is(type::int_array))
+      for (int64_t item: get_int_array(arg))
+        lst.push_back(make_integer(long(item)));
+    else
+      for (double item: get_float_array(arg))
+        lst.push_back(make_real(item));
+    return lst;
+  }
+
+  value array_element(const value& arr, const value& i)
+  {
+    check(is_array(arr) && i.is_int(),
+          "arguments to 'array-ref' must be an array and an integer index.");
+    check(i.get_int() >= 1 && i.get_int() <= array_size(arr), "array index out of range.");
+    if (arr.is(type::int_array))
+      return make_integer(long(get_int_array(arr)[i.get_int() - 1]));
+    return make_real(get_float_array(arr)[i.get_int() - 1]);
+  }
+
+  array_ref::array_ref() : binary_builtin(array_element, "array-ref") {}
+
+  void array_set_element(value& var, const value& i, const value& val)
+  {
+    check(is_array(var) && i.is_int() && is_number(val),
+          "arguments to 'array-set!' must be a reference to an array, an integer "
+          "index, and a number.");
+    check(i.get_int() >= 1 && i.get_int() <= array_size(var), "array index out of range.");
+    if (var.is(type::int_array))
+      get_mutable_int_array(var)[i.get_int() - 1] =
+        to_int64(val, "elements of an integer array must be 64-bit integers.");
+    else
+      get_mutable_float_array(var)[i.get_int() - 1] = to_double(val);
+  }
+
+  value array_set::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    return call_set_element(array_set_element, "array-set!", args, caller_env_p);
+  }
+
+  void array_push_back(value& var, const value& val)
+  {
+    check(is_array(var) && is_number(val),
+          "arguments to 'array-push!' must be a reference to an array and a number.");
+    if (var.is(type::int_array))
+      get_mutable_int_array(var).push_back(
+        to_int64(val, "elements of an integer array must be 64-bit integers."));
+    else
+      get_mutable_float_array(var).push_back(to_double(val));
+  }
+
+  value array_push::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(array_push_back, "array-push!", args, caller_env_p);
+  }
+
+  void check_same_shape(const value& a, const value& b, const char* name)
+  {
+    check(is_array(a) && a.get_type() == b.get_type() && array_size(a) == array_size(b),
+          "arguments to '", name, "' must be arrays of the same type and length.");
+  }
+
+  value add_arrays(const value& a, const value& b)
+  {
+    check_same_shape(a, b, "array-add");
+    if (a.is(type::float_array)) {
+      const vector< double >& x = get_float_array(a);
+      vector< double > sum(x.size());
+      map_doubles< add_doubles >(x.data(), get_float_array(b).data(), sum.data(), x.size());
+      return float_array_value(sum);
+    }
+    const vector< int64_t >& x = get_int_array(a);
+    vector< int64_t > sum(x.size());
+    check(add_int64(x.data(), get_int_array(b).data(), sum.data(), x.size()),
+          "integer overflow in 'array-add'.");
+    return int_array_value(sum);
+  }
+
+  array_add::array_add() : binary_builtin(add_arrays, "array-add") {}
+
+  value multiply_arrays(const value& a, const value& b)
+  {
+    check_same_shape(a, b, "array-mul");
+    if (a.is(type::float_array)) {
+      const vector< double >& x = get_float_array(a);
+      vector< double > product(x.size());
+      map_doubles< multiply_doubles >(x.data(), get_float_array(b).data(), product.data(),
+                                      x.size());
+      return float_array_value(product);
+    }
+    // there is no vector instruction for 64-bit multiplication before AVX-512
+    const vector< int64_t >& x = get_int_array(a);
+    const vector< int64_t >& y = get_int_array(b);
+    vector< int64_t > product(x.size());
+    bool overflow = false;
+    for (size_t i = 0; i < x.size(); ++i)
+      overflow |= __builtin_mul_overflow(x[i], y[i], &product[i]);
+    check(!overflow, "integer overflow in 'array-mul'.");
+    return int_array_value(product);
+  }
+
+  array_multiply::array_multiply() : binary_builtin(multiply_arrays, "array-mul") {}
+
+  value scale_array(const value& a, const value& k)
+  {
+    check(is_array(a) && is_number(k),
+          "arguments to 'array-scale' must be an array and a number.");
+    if (a.is(type::int_array) && is_integer(k)) {
+      const vector< int64_t >& x = get_int_array(a);
+      int64_t factor = to_int64(k, "integer overflow in 'array-scale'.");
+      vector< int64_t > scaled(x.size());
+      bool overflow = false;
+      for (size_t i = 0; i < x.size(); ++i)
+        overflow |= __builtin_mul_overflow(x[i], factor, &scaled[i]);
+      check(!overflow, "integer overflow in 'array-scale'.");
+      return int_array_value(scaled);
+    }
+    vector< double > x;
+    if (a.is(type::int_array))
+      x.assign(get_int_array(a).begin(), get_int_array(a).end());
+    else
+      x = get_float_array(a);
+    scale_doubles(x.data(), to_double(k), x.data(), x.size());
+    return float_array_value(x);
+  }
+
+  array_scale::array_scale() : binary_builtin(scale_array, "array-scale") {}
+
+  value dot_arrays(const value& a, const value& b)
+  {
+    check_same_shape(a, b, "dot");
+    if (a.is(type::float_array))
+      return make_real(dot_doubles(get_float_array(a).data(), get_float_array(b).data(),
+                                   array_size(a)));
+    return dot_int64(get_int_array(a).data(), get_int_array(b).data(), array_size(a));
+  }
+
+  array_dot::array_dot() : binary_builtin(dot_arrays, "dot") {}
+
+  value array_argument(const vector< value >& args, const char* name,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to '", name, "' (must be 1).");
+    value arg = eval(args.front(), caller_env_p);
+    check(is_array(arg), "argument to '", name, "' must be an array.");
+    return arg;
+  }
+
+  value array_sum::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    value arg = array_argument(args, "array-sum", caller_env_p);
+    if (arg.is(type::float_array)) {
+      const vector< double >& x = get_float_array(arg);
+      return make_real(reduce_doubles< add_doubles >(x.data(), x.size(), 0));
+    }
+    return sum_int64(get_int_array(arg).data(), get_int_array(arg).size());
+  }
+
+  value array_min::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    value arg = array_argument(args, "array-min", caller_env_p);
+    check(array_size(arg) > 0, "argument to 'array-min' must be a non-empty array.");
+    if (arg.is(type::float_array)) {
+      const vector< double >& x = get_float_array(arg);
+      return make_real(reduce_doubles< min_doubles >(x.data(), x.size(), x[0]));
+    }
+    int64_t min, max;
+    min_max_int64(get_int_array(arg).data(), array_size(arg), min, max);
+    return make_integer(long(min));
+  }
+
+  value array_max::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    value arg = array_argument(args, "array-max", caller_env_p);
+    check(array_size(arg) > 0, "argument to 'array-max' must be a non-empty array.");
+    if (arg.is(type::float_array)) {
+      const vector< double >& x = get_float_array(arg);
+      return make_real(reduce_doubles< max_doubles >(x.data(), x.size(), x[0]));
+    }
+    int64_t min, max;
+    min_max_int64(get_int_array(arg).data(), array_size(arg), min, max);
+    return make_integer(long(max));
+  }
+
+  value prefix_sum::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    value arg = array_argument(args, "prefix-sum", caller_env_p);
+    if (arg.is(type::float_array)) {
+      const vector< double >& x = get_float_array(arg);
+      vector< double > sums(x.size());
+      prefix_sum_doubles(x.data(), sums.data(), x.size());
+      return float_array_value(sums);
+    }
+    const vector< int64_t >& x = get_int_array(arg);
+    vector< int64_t > sums(x.size());
+    int64_t acc = 0;
+    bool overflow = false;
+    for (size_t i = 0; i < x.size(); ++i) {
+      overflow |= __builtin_add_overflow(acc, x[i], &acc);
+      sums[i] = acc;
+    }
+    check(!overflow, "integer overflow in 'prefix-sum'.");
+    return int_array_value(sums);
+  }
+
+  void add_array_builtins(const shared_ptr< environment >& env_p)
+  {
+    env_p->set("make-int-array", make_object< make_int_array >());
+    env_p->set("make-float-array", make_object< make_float_array >());
+    env_p->set("list->int-array", make_object< list_to_int_array >());
+    env_p->set("list->float-array", make_object< list_to_float_array >());
+    env_p->set("array-range", make_object< array_range >());
+    env_p->set("array->list", make_object< array_to_list >());
+    env_p->set("array-ref", make_object< array_ref >());
+    env_p->set("array-set!", make_object< array_set >());
+    env_p->set("array-push!", make_object< array_push >());
+    env_p->set("array-add", make_object< array_add >());
+    env_p->set("array-mul", make_object< array_multiply >());
+    env_p->set("array-scale", make_object< array_scale >());
+    env_p->set("dot", make_object< array_dot >());
+    env_p->set("array-sum", make_object< array_sum >());
+    env_p->set("array-min", make_object< array_min >());
+    env_p->set("array-max", make_object< array_max >());
+    env_p->set("prefix-sum", make_object< prefix_sum >());
+  }
+
+} // namespace lime
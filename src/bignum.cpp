@@ -0,0 +1,435 @@
+// C headers
+#include <cmath>
+
+// STL headers
+#include <algorithm>
+#include <string>
+
+// lime headers
+#include <bignum.hpp>
+
+namespace lime {
+  // STL
+  using std::max;
+  using std::min;
+  using std::reverse;
+  using std::to_string;
+
+  // lime
+  using lime::make_object;
+
+  // operands with fewer limbs than this are multiplied by the schoolbook method
+  const size_t karatsuba_threshold = 32;
+
+  void trim(magnitude& mag)
+  {
+    while (!mag.empty() && mag.back() == 0)
+      mag.pop_back();
+  }
+
+  magnitude to_magnitude(unsigned long n)
+  {
+    magnitude mag;
+    while (n != 0) {
+      mag.push_back(uint32_t(n));
+      n >>= 32;
+    }
+    return mag;
+  }
+
+  const bignum* get_bignum(const value& val)
+  {
+    return static_cast< const bignum* >(val.get_object());
+  }
+
+  void decompose(const value& val, bool& negative, magnitude& mag)
+  {
+    if (val.is_int()) {
+      long n = val.get_int();
+      negative = n < 0;
+      mag = to_magnitude(negative ? 0UL - (unsigned long)n : (unsigned long)n);
+    }
+    else {
+      negative = get_bignum(val)->negative;
+      mag = get_bignum(val)->digits;
+    }
+  }
+
+  value make_integer(bool negative, magnitude mag)
+  {
+    trim(mag);
+    if (mag.size() <= 2) {
+      unsigned long n = 0;
+      for (int i = mag.size() - 1; i >= 0; --i)
+        n = (n << 32) | mag[i];
+      if (!negative && n <= (unsigned long)value::max_int)
+        return long(n);
+      if (negative && n <= 0UL - (unsigned long)value::min_int)
+        return long(0UL - n);
+    }
+    return make_object< bignum >(negative && !mag.empty(), mag);
+  }
+
+  value make_integer(long n)
+  {
+    if (value::fits_int(n))
+      return n;
+    return make_integer(n < 0, to_magnitude(n < 0 ? 0UL - (unsigned long)n
+                                            : (unsigned long)n));
+  }
+
+  bool is_integer(const value& val)
+  {
+    return val.is_int() || val.is(type::bignum);
+  }
+
+  int compare_magnitudes(const magnitude& a, const magnitude& b)
+  {
+    if (a.size() != b.size())
+      return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;)
+      if (a[i] != b[i])
+        return a[i] < b[i] ? -1 : 1;
+    return 0;
+  }
+
+  magnitude add_magnitudes(const magnitude& a, const magnitude& b)
+  {
+    const magnitude& longer = a.size() >= b.size() ? a : b;
+    const magnitude& shorter = a.size() >= b.size() ? b : a;
+    magnitude sum(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); ++i) {
+      carry += uint64_t(longer[i]) + (i < shorter.size() ? shorter[i] : 0);
+      sum[i] = uint32_t(carry);
+      carry >>= 32;
+    }
+    sum.back() = uint32_t(carry);
+    trim(sum);
+    return sum;
+  }
+
+  // requires a >= b
+  magnitude subtract_magnitudes(const magnitude& a, const magnitude& b)
+  {
+    magnitude diff(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+      int64_t d = int64_t(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+      borrow = d < 0;
+      diff[i] = uint32_t(d + (borrow << 32));
+    }
+    trim(diff);
+    return diff;
+  }
+
+  // adds x * 2^(32 * offset) to acc
+  void add_shifted(magnitude& acc, const magnitude& x, size_t offset)
+  {
+    if (acc.size() < offset + x.size() + 1)
+      acc.resize(offset + x.size() + 1);
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < x.size(); ++i) {
+      carry += uint64_t(acc[offset + i]) + x[i];
+      acc[offset + i] = uint32_t(carry);
+      carry >>= 32;
+    }
+    for (; carry != 0; ++i) {
+      if (offset + i == acc.size())
+        acc.push_back(0);
+      carry += acc[offset + i];
+      acc[offset + i] = uint32_t(carry);
+      carry >>= 32;
+    }
+    trim(acc);
+  }
+
+  magnitude multiply_schoolbook(const magnitude& a, const magnitude& b)
+  {
+    magnitude product(a.size() + b.size());
+    for (size_t i = 0; i < a.size(); ++i) {
+      uint64_t carry = 0;
+      for (size_t j = 0; j < b.size(); ++j) {
+        carry += uint64_t(a[i]) * b[j] + product[i + j];
+        product[i + j] = uint32_t(carry);
+        carry >>= 32;
+      }
+      product[i + b.size()] = uint32_t(carry);
+    }
+    trim(product);
+    return product;
+  }
+
+  magnitude low_limbs(const magnitude& mag, size_t n)
+  {
+    magnitude low(mag.begin(), mag.begin() + min(n, mag.size()));
+    trim(low);
+    return low;
+  }
+
+  magnitude high_limbs(const magnitude& mag, size_t n)
+  {
+    if (mag.size() <= n)
+      return magnitude();
+    return magnitude(mag.begin() + n, mag.end());
+  }
+
+  // Karatsuba: with a = a1 B + a0 and b = b1 B + b0, the product is
+  // a1 b1 B^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B + a0 b0
+  magnitude multiply_magnitudes(const magnitude& a, const magnitude& b)
+  {
+    if (a.empty() || b.empty())
+      return magnitude();
+    if (a.size() < karatsuba_threshold || b.size() < karatsuba_threshold)
+      return multiply_schoolbook(a, b);
+    size_t half = (max(a.size(), b.size()) + 1) / 2;
+    magnitude a0 = low_limbs(a, half), a1 = high_limbs(a, half);
+    magnitude b0 = low_limbs(b, half), b1 = high_limbs(b, half);
+    magnitude z0 = multiply_magnitudes(a0, b0);
+    magnitude z2 = multiply_magnitudes(a1, b1);
+    magnitude z1 = multiply_magnitudes(add_magnitudes(a0, a1), add_magnitudes(b0, b1));
+    z1 = subtract_magnitudes(subtract_magnitudes(z1, z0), z2);
+    magnitude product(z0);
+    add_shifted(product, z1, half);
+    add_shifted(product, z2, 2 * half);
+    return product;
+  }
+
+  uint32_t divide_by_limb(const magnitude& u, uint32_t d, magnitude& q)
+  {
+    q.assign(u.size(), 0);
+    uint64_t rem = 0;
+    for (size_t i = u.size(); i-- > 0;) {
+      uint64_t cur = (rem << 32) | u[i];
+      q[i] = uint32_t(cur / d);
+      rem = cur % d;
+    }
+    trim(q);
+    return uint32_t(rem);
+  }
+
+  // long division (Knuth, TAOCP vol. 2, algorithm D); v must be non-zero
+  void divide_magnitudes(const magnitude& u, const magnitude& v, magnitude& q,
+                         magnitude& r)
+  {
+    if (compare_magnitudes(u, v) < 0) {
+      q.clear();
+      r = u;
+      return;
+    }
+    if (v.size() == 1) {
+      r = to_magnitude(divide_by_limb(u, v[0], q));
+      return;
+    }
+    const uint64_t base = uint64_t(1) << 32;
+    size_t n = v.size(), m = u.size();
+    int s = __builtin_clz(v.back());
+    magnitude vn(n), un(m + 1);
+    for (size_t i = n - 1; i > 0; --i)
+      vn[i] = uint32_t((uint64_t(v[i]) << s) | (uint64_t(v[i - 1]) >> (32 - s)));
+    vn[0] = v[0] << s;
+    un[m] = uint32_t(uint64_t(u[m - 1]) >> (32 - s));
+    for (size_t i = m - 1; i > 0; --i)
+      un[i] = uint32_t((uint64_t(u[i]) << s) | (uint64_t(u[i - 1]) >> (32 - s)));
+    un[0] = u[0] << s;
+    q.assign(m - n + 1, 0);
+    for (size_t j = m - n + 1; j-- > 0;) {
+      uint64_t numerator = (uint64_t(un[j + n]) << 32) | un[j + n - 1];
+      uint64_t qhat = numerator / vn[n - 1];
+      uint64_t rhat = numerator % vn[n - 1];
+      while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+        --qhat;
+        rhat += vn[n - 1];
+        if (rhat >= base)
+          break;
+      }
+      int64_t borrow = 0, t;
+      for (size_t i = 0; i < n; ++i) {
+        uint64_t p = qhat * vn[i];
+        t = int64_t(un[i + j]) - borrow - int64_t(p & 0xFFFFFFFF);
+        un[i + j] = uint32_t(t);
+        borrow = int64_t(p >> 32) - (t >> 32);
+      }
+      t = int64_t(un[j + n]) - borrow;
+      un[j + n] = uint32_t(t);
+      q[j] = uint32_t(qhat);
+      if (t < 0) {
+        --q[j];
+        uint64_t carry = 0;
+        for (size_t i = 0; i < n; ++i) {
+          carry += uint64_t(un[i + j]) + vn[i];
+          un[i + j] = uint32_t(carry);
+          carry >>= 32;
+        }
+        un[j + n] += uint32_t(carry);
+      }
+    }
+    r.assign(n, 0);
+    for (size_t i = 0; i < n; ++i)
+      r[i] = uint32_t((uint64_t(un[i]) >> s) | (uint64_t(un[i + 1]) << (32 - s)));
+    trim(q);
+    trim(r);
+  }
+
+  value signed_add(bool a_neg, const magnitude& a, bool b_neg, const magnitude& b)
+  {
+    if (a_neg == b_neg)
+      return make_integer(a_neg, add_magnitudes(a, b));
+    if (compare_magnitudes(a, b) >= 0)
+      return make_integer(a_neg, subtract_magnitudes(a, b));
+    return make_integer(b_neg, subtract_magnitudes(b, a));
+  }
+
+  value integer_add(const value& a, const value& b)
+  {
+    long sum;
+    if (a.is_int() && b.is_int() &&
+        !__builtin_add_overflow(a.get_int(), b.get_int(), &sum))
+      return make_integer(sum);
+    bool a_neg, b_neg;
+    magnitude a_mag, b_mag;
+    decompose(a, a_neg, a_mag);
+    decompose(b, b_neg, b_mag);
+    return signed_add(a_neg, a_mag, b_neg, b_mag);
+  }
+
+  value integer_subtract(const value& a, const value& b)
+  {
+    long diff;
+    if (a.is_int() && b.is_int() &&
+        !__builtin_sub_overflow(a.get_int(), b.get_int(), &diff))
+      return make_integer(diff);
+    bool a_neg, b_neg;
+    magnitude a_mag, b_mag;
+    decompose(a, a_neg, a_mag);
+    decompose(b, b_neg, b_mag);
+    return signed_add(a_neg, a_mag, !b_neg, b_mag);
+  }
+
+  value integer_multiply(const value& a, const value& b)
+  {
+    long product;
+    if (a.is_int() && b.is_int() &&
+        !__builtin_mul_overflow(a.get_int(), b.get_int(), &product))
+      return make_integer(product);
+    bool a_neg, b_neg;
+    magnitude a_mag, b_mag;
+    decompose(a, a_neg, a_mag);
+    decompose(b, b_neg, b_mag);
+    return make_integer(a_neg != b_neg, multiply_magnitudes(a_mag, b_mag));
+  }
+
+  value integer_quotient(const value& a, const value& b)
+  {
+    if (a.is_int() && b.is_int())
+      return make_integer(a.get_int() / b.get_int());
+    bool a_neg, b_neg;
+    magnitude a_mag, b_mag, q, r;
+    decompose(a, a_neg, a_mag);
+    decompose(b, b_neg, b_mag);
+    divide_magnitudes(a_mag, b_mag, q, r);
+    return make_integer(a_neg != b_neg, q);
+  }
+
+  value integer_remainder(const value& a, const value& b)
+  {
+    if (a.is_int() && b.is_int())
+      return make_integer(a.get_int() % b.get_int());
+    bool a_neg, b_neg;
+    magnitude a_mag, b_mag, q, r;
+    decompose(a, a_neg, a_mag);
+    decompose(b, b_neg, b_mag);
+    divide_magnitudes(a_mag, b_mag, q, r);
+    return make_integer(a_neg, r);
+  }
+
+  int integer_compare(const value& a, const value& b)
+  {
+    if (a.is_int() && b.is_int())
+      return a.get_int() < b.get_int() ? -1 : (a.get_int() > b.get_int() ? 1 : 0);
+    bool a_neg, b_neg;
+    magnitude a_mag, b_mag;
+    decompose(a, a_neg, a_mag);
+    decompose(b, b_neg, b_mag);
+    if (a_neg != b_neg)
+      return a_neg ? -1 : 1;
+    int cmp = compare_magnitudes(a_mag, b_mag);
+    return a_neg ? -cmp : cmp;
+  }
+
+  string integer_to_string(const value& val)
+  {
+    if (val.is_int())
+      return to_string(val.get_int());
+    const bignum* big = get_bignum(val);
+    magnitude mag(big->digits), q;
+    string str;
+    while (!mag.empty()) {
+      uint32_t chunk = divide_by_limb(mag, 1000000000, q);
+      mag.swap(q);
+      for (int i = 0; i < 9 && (chunk != 0 || !mag.empty()); ++i) {
+        str.push_back('0' + chunk % 10);
+        chunk /= 10;
+      }
+    }
+    if (big->negative)
+      str.push_back('-');
+    reverse(str.begin(), str.end());
+    return str;
+  }
+
+  double integer_to_double(const value& val)
+  {
+    if (val.is_int())
+      return val.get_int();
+    const bignum* big = get_bignum(val);
+    double d = 0;
+    for (size_t i = big->digits.size(); i-- > 0;)
+      d = d * 4294967296.0 + big->digits[i];
+    return big->negative ? -d : d;
+  }
+
+  value integer_from_double(double d)
+  {
+    d = trunc(d);
+    if (fabs(d) < 4611686018427387904.0)
+      return long(d);
+    // |d| = mantissa * 2^shift, with a 53-bit mantissa and shift >= 10
+    int exponent;
+    double fraction = frexp(fabs(d), &exponent);
+    uint64_t mantissa = uint64_t(ldexp(fraction, 53));
+    int shift = exponent - 53;
+    magnitude mag(shift / 32 + 3);
+    int limb = shift / 32, bit = shift % 32;
+    unsigned __int128 shifted = (unsigned __int128)mantissa << bit;
+    for (int i = 0; i < 3; ++i)
+      mag[limb + i] = uint32_t(shifted >> (32 * i));
+    return make_integer(d < 0, mag);
+  }
+
+  value parse_integer(const string& str)
+  {
+    bool negative = !str.empty() && str[0] == '-';
+    size_t pos = (negative || (!str.empty() && str[0] == '+')) ? 1 : 0;
+    magnitude mag;
+    while (pos < str.length()) {
+      size_t chunk_length = min(size_t(9), str.length() - pos);
+      uint32_t chunk = 0, scale = 1;
+      for (size_t i = 0; i < chunk_length; ++i, ++pos) {
+        chunk = chunk * 10 + (str[pos] - '0');
+        scale *= 10;
+      }
+      uint64_t carry = chunk;
+      for (size_t i = 0; i < mag.size(); ++i) {
+        carry += uint64_t(mag[i]) * scale;
+        mag[i] = uint32_t(carry);
+        carry >>= 32;
+      }
+      if (carry != 0)
+        mag.push_back(uint32_t(carry));
+    }
+    return make_integer(negative, mag);
+  }
+
+} // namespace lime
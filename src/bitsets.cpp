@@ -0,0 +1,351 @@
+// C headers
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// lime headers
+#include <arrays.hpp>
+#include <bitsets.hpp>
+#include <builtins.hpp>
+#include <eval.hpp>
+#include <interpreter.hpp>
+
+namespace lime {
+  // lime
+  using lime::call_binary;
+  using lime::call_modify_variable;
+  using lime::call_set_element;
+  using lime::check;
+  using lime::eval;
+  using lime::has_avx2;
+  using lime::make_object;
+
+  class and_words {
+  public:
+    static uint64_t scalar(uint64_t x, uint64_t y)
+    {
+      return x & y;
+    }
+#ifdef __x86_64__
+    static __m128i sse2(__m128i x, __m128i y)
+    {
+      return _mm_and_si128(x, y);
+    }
+    __attribute__((target("avx2"))) static __m256i avx2(__m256i x, __m256i y)
+    {
+      return _mm256_and_si256(x, y);
+    }
+#endif
+  };
+
+  class or_words {
+  public:
+    static uint64_t scalar(uint64_t x, uint64_t y)
+    {
+      return x | y;
+    }
+#ifdef __x86_64__
+    static __m128i sse2(__m128i x, __m128i y)
+    {
+      return _mm_or_si128(x, y);
+    }
+    __attribute__((target("avx2"))) static __m256i avx2(__m256i x, __m256i y)
+    {
+      return _mm256_or_si256(x, y);
+    }
+#endif
+  };
+
+  class xor_words {
+  public:
+    static uint64_t scalar(uint64_t x, uint64_t y)
+    {
+      return x ^ y;
+    }
+#ifdef __x86_64__
+    static __m128i sse2(__m128i x, __m128i y)
+    {
+      return _mm_xor_si128(x, y);
+    }
+    __attribute__((target("avx2"))) static __m256i avx2(__m256i x, __m256i y)
+    {
+      return _mm256_xor_si256(x, y);
+    }
+#endif
+  };
+
+#ifdef __x86_64__
+  template< typename Op >
+  __attribute__((target("avx2")))
+  void combine_words_avx2(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n,
+                          size_t& i)
+  {
+    for (; i + 4 <= n; i += 4) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i));
+      __m256i y = _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i));
+      _mm256_storeu_si256(reinterpret_cast< __m256i* >(out + i), Op::avx2(x, y));
+    }
+  }
+#endif
+
+  // out[i] = op(a[i], b[i]) for the n words
+  template< typename Op >
+  void combine_words(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n)
+  {
+    size_t i = 0;
+#ifdef __x86_64__
+    if (has_avx2())
+      combine_words_avx2< Op >(a, b, out, n, i);
+    for (; i + 2 <= n; i += 2) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast< const __m128i* >(a + i));
+      __m128i y = _mm_loadu_si128(reinterpret_cast< const __m128i* >(b + i));
+      _mm_storeu_si128(reinterpret_cast< __m128i* >(out + i), Op::sse2(x, y));
+    }
+#endif
+    for (; i < n; ++i)
+      out[i] = Op::scalar(a[i], b[i]);
+  }
+
+#ifdef __x86_64__
+  __attribute__((target("popcnt")))
+  long count_bits_popcnt(const uint64_t* words, size_t n)
+  {
+    long count = 0;
+    for (size_t i = 0; i < n; ++i)
+      count += __builtin_popcountll(words[i]);
+    return count;
+  }
+#endif
+
+  // the number of set bits; uses the popcnt instruction if the processor has it
+  long count_bits(const uint64_t* words, size_t n)
+  {
+#ifdef __x86_64__
+    static const bool has_popcnt = __builtin_cpu_supports("popcnt");
+    if (has_popcnt)
+      return count_bits_popcnt(words, n);
+#endif
+    long count = 0;
+    for (size_t i = 0; i < n; ++i)
+      count += __builtin_popcountll(words[i]);
+    return count;
+  }
+
+  const bitset_object& get_bitset(const value& val)
+  {
+    return *static_cast< bitset_object* >(val.get_object());
+  }
+
+  // the bitset in a variable, unshared so it can be modified in place
+  bitset_object& get_mutable_bitset(value& var)
+  {
+    if (var.get_object()->ref_count > 1)
+      var = make_object< bitset_object >(get_bitset(var));
+    return *static_cast< bitset_object* >(var.get_object());
+  }
+
+  bool bitsets_equal(const bitset_object& a, const bitset_object& b)
+  {
+    return a.size == b.size && a.words == b.words;
+  }
+
+  bool test_bit(const bitset_object& bits, long i)
+  {
+    return (bits.words[i / 64] >> (i % 64)) & 1;
+  }
+
+  void check_bit_index(const value& bits, const value& i, const char* name)
+  {
+    check(bits.is(type::bitset) && i.is_int(),
+          "arguments to '", name, "' must be a bitset and an integer.");
+    check(i.get_int() >= 0 && i.get_int() < get_bitset(bits).size,
+          "bitset index out of range.");
+  }
+
+  value make_bitset::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'make-bitset' (must be 1).");
+    value n = eval(args.front(), caller_env_p);
+    check(n.is_int() && n.get_int() >= 0,
+          "argument to 'make-bitset' must be a non-negative integer.");
+    return make_object< bitset_object >(n.get_int());
+  }
+
+  void set_bit(value& var, const value& i)
+  {
+    check_bit_index(var, i, "bitset-set!");
+    get_mutable_bitset(var).words[i.get_int() / 64] |= uint64_t(1) << (i.get_int() % 64);
+  }
+
+  value bitset_set::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(set_bit, "bitset-set!", args, caller_env_p);
+  }
+
+  void clear_bit(value& var, const value& i)
+  {
+    check_bit_index(var, i, "bitset-clear!");
+    get_mutable_bitset(var).words[i.get_int() / 64] &= ~(uint64_t(1) << (i.get_int() % 64));
+  }
+
+  value bitset_clear::call(const vector< value >& args,
+                           const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(clear_bit, "bitset-clear!", args, caller_env_p);
+  }
+
+  value bit_value(const value& bits, const value& i)
+  {
+    check_bit_index(bits, i, "bitset-test");
+    return test_bit(get_bitset(bits), i.get_int());
+  }
+
+  bitset_test::bitset_test() : binary_builtin(bit_value, "bitset-test") {}
+
+  template< typename Op >
+  value combine_bitsets(const value& a, const value& b, const char* name)
+  {
+    check(a.is(type::bitset) && b.is(type::bitset) &&
+          get_bitset(a).size == get_bitset(b).size,
+          "arguments to '", name, "' must be bitsets of the same size.");
+    const bitset_object& x = get_bitset(a);
+    value result = make_object< bitset_object >(x.size);
+    bitset_object& out = *static_cast< bitset_object* >(result.get_object());
+    combine_words< Op >(x.words.data(), get_bitset(b).words.data(), out.words.data(),
+                        x.words.size());
+    return result;
+  }
+
+  value intersection(const value& a, const value& b)
+  {
+    return combine_bitsets< and_words >(a, b, "bitset-and");
+  }
+
+  bitset_and::bitset_and() : binary_builtin(intersection, "bitset-and") {}
+
+  value set_union(const value& a, const value& b)
+  {
+    return combine_bitsets< or_words >(a, b, "bitset-or");
+  }
+
+  bitset_or::bitset_or() : binary_builtin(set_union, "bitset-or") {}
+
+  value symmetric_difference(const value& a, const value& b)
+  {
+    return combine_bitsets< xor_words >(a, b, "bitset-xor");
+  }
+
+  bitset_xor::bitset_xor() : binary_builtin(symmetric_difference, "bitset-xor") {}
+
+  value bitset_argument(const vector< value >& args, const char* name,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to '", name, "' (must be 1).");
+    value arg = eval(args.front(), caller_env_p);
+    check(arg.is(type::bitset), "argument to '", name, "' must be a bitset.");
+    return arg;
+  }
+
+  value bitset_not::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    value arg = bitset_argument(args, "bitset-not", caller_env_p);
+    const bitset_object& bits = get_bitset(arg);
+    value result = make_object< bitset_object >(bits);
+    vector< uint64_t >& words = static_cast< bitset_object* >(result.get_object())->words;
+    for (uint64_t& word: words)
+      word = ~word;
+    if (bits.size % 64 != 0)
+      words.back() &= (uint64_t(1) << (bits.size % 64)) - 1;
+    return result;
+  }
+
+  value bitset_count::call(const vector< value >& args,
+                           const shared_ptr< environment >& caller_env_p)
+  {
+    value arg = bitset_argument(args, "bitset-count", caller_env_p);
+    const bitset_object& bits = get_bitset(arg);
+    return count_bits(bits.words.data(), bits.words.size());
+  }
+
+  // the first set bit at or after i, or -1 if there is none
+  value next_set_bit(const value& bits_v, const value& i)
+  {
+    check(bits_v.is(type::bitset) && i.is_int() && i.get_int() >= 0,
+          "arguments to 'bitset-next' must be a bitset and a non-negative integer.");
+    const bitset_object& bits = get_bitset(bits_v);
+    if (i.get_int() >= bits.size)
+      return -1L;
+    size_t w = i.get_int() / 64;
+    uint64_t word = bits.words[w] & (~uint64_t(0) << (i.get_int() % 64));
+    while (word == 0) {
+      if (++w == bits.words.size())
+        return -1L;
+      word = bits.words[w];
+    }
+    return long(w * 64 + __builtin_ctzll(word));
+  }
+
+  bitset_next::bitset_next() : binary_builtin(next_set_bit, "bitset-next") {}
+
+  // clears the bits start, start + step, start + 2 * step... For small steps
+  // the bits falling in each word are gathered in a mask and cleared together.
+  void clear_stride(value& var, const value& start, const value& step)
+  {
+    check(var.is(type::bitset) && start.is_int() && step.is_int() && start.get_int() >= 0 &&
+          step.get_int() > 0,
+          "arguments to 'bitset-clear-stride!' must be a reference to a bitset, a "
+          "non-negative integer and a positive integer.");
+    bitset_object& bits = get_mutable_bitset(var);
+    long i = start.get_int(), n = step.get_int();
+    if (n < 64)
+      // bits past the size may be set in the mask; they are already clear
+      while (i < bits.size) {
+        uint64_t mask = 0;
+        long w = i / 64;
+        for (long bit = i % 64; bit < 64; bit += n, i += n)
+          mask |= uint64_t(1) << bit;
+        bits.words[w] &= ~mask;
+      }
+    else
+      for (; i < bits.size; i += n)
+        bits.words[i / 64] &= ~(uint64_t(1) << (i % 64));
+  }
+
+  value bitset_clear_stride::call(const vector< value >& args,
+                                  const shared_ptr< environment >& caller_env_p)
+  {
+    return call_set_element(clear_stride, "bitset-clear-stride!", args, caller_env_p);
+  }
+
+  value bitset_to_list::call(const vector< value >& args,
+                             const shared_ptr< environment >& caller_env_p)
+  {
+    value arg = bitset_argument(args, "bitset->list", caller_env_p);
+    const bitset_object& bits = get_bitset(arg);
+    list lst;
+    for (size_t w = 0; w < bits.words.size(); ++w)
+      for (uint64_t word = bits.words[w]; word != 0; word &= word - 1)
+        lst.push_back(long(w * 64 + __builtin_ctzll(word)));
+    return lst;
+  }
+
+  void add_bitset_builtins(const shared_ptr< environment >& env_p)
+  {
+    env_p->set("make-bitset", make_object< make_bitset >());
+    env_p->set("bitset-set!", make_object< bitset_set >());
+    env_p->set("bitset-clear!", make_object< bitset_clear >());
+    env_p->set("bitset-test", make_object< bitset_test >());
+    env_p->set("bitset-and", make_object< bitset_and >());
+    env_p->set("bitset-or", make_object< bitset_or >());
+    env_p->set("bitset-xor", make_object< bitset_xor >());
+    env_p->set("bitset-not", make_object< bitset_not >());
+    env_p->set("bitset-count", make_object< bitset_count >());
+    env_p->set("bitset-next", make_object< bitset_next >());
+    env_p->set("bitset-clear-stride!", make_object< bitset_clear_stride >());
+    env_p->set("bitset->list", make_object< bitset_to_list >());
+  }
+
+} // namespace lime
@@ -1,4 +1,5 @@
 // C headers
+#include <cmath>
 #include <cstdlib>
 #include <ctime>
 
@@ -7,941 +8,630 @@
 #include <sstream>
 
 // lime headers
+#include <arrays.hpp>
+#include <bignum.hpp>
+#include <bitsets.hpp>
 #include <builtins.hpp>
 #include <eval.hpp>
+#include <hamt.hpp>
+#include <hash_table.hpp>
 #include <interpreter.hpp>
 #include <parse.hpp>
+#include <real.hpp>
+#include <strings.hpp>
+#include <vectors.hpp>
 
 namespace lime {
   // STL
   using std::cin;
   using std::cout;
   using std::getline;
-  using std::stringstream;
   using std::make_shared;
-
-  // Boost
-  using boost::apply_visitor;
-  using boost::static_visitor;
+  using std::stringstream;
 
   // lime
   using lime::check;
-  using lime::escape;
   using lime::eval;
+  using lime::make_constant;
+  using lime::make_object;
   using lime::nil;
   using lime::output;
   using lime::parse;
-  using lime::reference_visitor;
-  using lime::unescape;
 
-  value quote::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  // the result of applying a binary builtin to its first argument only
+  class binary_partial : public lambda {
+  public:
+    binary_partial(binary_operation f, const string& n, value a1)
+      : op(f), name(n), arg1(a1) {}
+    value call(const vector< value >& args, const shared_ptr< environment >& caller_env_p)
+    {
+      check(args.size() == 1,
+            "wrong number of arguments to '", name, " <expr>' (must be 1).");
+      value arg2 = eval(args.front(), caller_env_p);
+      return op(arg1, arg2);
+    }
+  private:
+    binary_operation op;
+    string name;
+    value arg1;
+  };
+
+  value call_binary(binary_operation op, const char* name, const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1 || args.size() == 2,
+          "wrong number of arguments to '", name, "' (must be 1 or 2).");
+    value arg1 = eval(args[0], caller_env_p);
+    if (args.size() == 1)
+      return make_object< binary_partial >(op, name, arg1);
+    value arg2 = eval(args[1], caller_env_p);
+    return op(arg1, arg2);
+  }
+
+  value binary_builtin::call(const vector< value >& args,
+                             const shared_ptr< environment >& caller_env_p)
+  {
+    return call_binary(op, name, args, caller_env_p);
+  }
+
+  // The values are passed as compiled constants, which evaluate to themselves
+  // in any environment.
+  value apply_function(const value& func, const vector< value >& vals)
+  {
+    static auto env_p = make_shared< environment >();
+    check(func.is(type::lambda), "attempting to apply a value that is not a lambda.");
+    lambda* lambda_p = func.get_lambda();
+    if (lambda_p->arity() == int(vals.size()))
+      switch (vals.size()) {
+      case 1:
+        return lambda_p->call1(vals[0]);
+      case 2:
+        return lambda_p->call2(vals[0], vals[1]);
+      case 3:
+        return lambda_p->call3(vals[0], vals[1], vals[2]);
+      }
+    vector< value > args;
+    for (const value& val: vals)
+      args.push_back(make_constant(val));
+    return func.get_lambda()->call(args, env_p);
+  }
+
+  // the variable a mutating builtin operates on, following references
+  value& variable_ref(const value& arg, const shared_ptr< environment >& env_p)
+  {
+    symbol sym;
+    check(variable_name(arg, sym), "attempting to get reference to non-symbol.");
+    check(env_p->find(sym), "symbol '", sym.name(), "' not found.");
+    value* var_p = &env_p->get_ref(sym);
+    while (var_p->is(type::reference))
+      var_p = &var_p->get_reference()->get_native_ref();
+    return *var_p;
+  }
+
+  value quote::call(const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'quote' (must be 1).");
     return args.front();
   }
 
-  value evaluate::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value evaluate::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'eval' (must be 1).");
     return eval(eval(args.front(), caller_env_p), caller_env_p);
   }
 
-  value make_list::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value make_list::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
   {
     list lst;
-    for (value arg: args)
+    for (const value& arg: args)
       lst.push_back(eval(arg, caller_env_p));
     return lst;
-  }  
-
-  class load_visitor : public static_visitor<> {
-  public:
-    load_visitor(shared_ptr< environment > ep) : env_p(ep) {}
-    void operator()(const string& path) const
-    {
-      load_file(path, env_p);
-    }
-    template< typename T >
-    void operator()(const T& t) const
-    {
-      check(false, "argument to 'load' must be a string.");
-    }
-  private:
-    shared_ptr< environment > env_p;
-  };
+  }
 
-  value load::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value load::call(const vector< value >& args,
+                   const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'load' (must be 1).");
-    apply_visitor(load_visitor(caller_env_p), args.front());
+    check(args.front().is(type::string), "argument to 'load' must be a string.");
+    load_file(args.front().get_string(), caller_env_p);
     return nil();
   }
 
-  class equals_visitor : public static_visitor< bool > {
-  public:
-    bool operator()(int a, int b) const
-    {
-      return a == b;
-    }
-    bool operator()(const string& a, const string& b) const
-    {
-      return a == b;
-    }
-    bool operator()(bool a, bool b) const
-    {
-      return a == b;
+  bool values_equal(const value& a, const value& b)
+  {
+    type t = a.get_type();
+    if ((t == type::real || b.is(type::real)) && is_number(a) && is_number(b))
+      return to_double(a) == to_double(b);
+    if (t != b.get_type())
+      return false;
+    switch (t) {
+    case type::integer:
+    case type::boolean:
+      return a.identical(b);
+    case type::bignum:
+      return integer_compare(a, b) == 0;
+    case type::string:
+      return a.get_string() == b.get_string();
+    case type::list: {
+      const list& a_lst = a.get_list();
+      const list& b_lst = b.get_list();
+      if (a_lst.size() != b_lst.size())
+        return false;
+      for (int i = 0; i < a_lst.size(); ++i)
+        if (!values_equal(a_lst[i], b_lst[i]))
+          return false;
+      return true;
     }
-    bool operator()(const list& a, const list& b) const
-    {
-      if (a.empty())
-        return b.empty();
-      else if (b.empty())
+    case type::hash_table:
+      return hash_tables_equal(get_hash_table(a), get_hash_table(b));
+    case type::map:
+      return maps_equal(get_map(a), get_map(b));
+    case type::int_array:
+    case type::float_array:
+      return arrays_equal(a, b);
+    case type::bitset:
+      return bitsets_equal(get_bitset(a), get_bitset(b));
+    case type::vector: {
+      const vector< value >& a_items = get_vector(a);
+      const vector< value >& b_items = get_vector(b);
+      if (a_items.size() != b_items.size())
         return false;
-      else {
-        equals_visitor eq;
-        value ah(a.head()), bh(b.head());
-        value at(a.tail()), bt(b.tail());
-        return (apply_visitor(eq, ah, bh) && apply_visitor(eq, at, bt));
-      }
+      for (int i = 0; i < a_items.size(); ++i)
+        if (!values_equal(a_items[i], b_items[i]))
+          return false;
+      return true;
     }
-    template< typename T, typename U >
-    bool operator()(const T& a, const U& b) const
-    {
+    default:
       return false;
     }
-  };
-
-  class equals_partial : public lambda {
-  public:
-    equals_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to '= <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(equals_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
+  }
 
-  value equals::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value equal_values(const value& a, const value& b)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to '=' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< equals_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(equals_visitor(), arg1, arg2);
+    return values_equal(a, b);
   }
 
-  class less_than_visitor : public static_visitor< bool > {
-  public:
-    bool operator()(int a, int b) const
-    {
-      return a < b;
-    }
-    template< typename T, typename U >
-    bool operator()(const T& a, const U& b) const
-    {
-      check(false, "arguments to '<' must be integer.");
-    }
-  };
+  equals::equals() : binary_builtin(equal_values, "=") {}
 
-  class less_than_partial : public lambda {
-  public:
-    less_than_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to '< <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(less_than_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
-
-  value less_than::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value less_than_values(const value& a, const value& b)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to '<' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< less_than_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(less_than_visitor(), arg1, arg2);
+    if (a.is_int() && b.is_int())
+      return a.get_int() < b.get_int();
+    if (is_integer(a) && is_integer(b))
+      return integer_compare(a, b) < 0;
+    check(is_number(a) && is_number(b), "arguments to '<' must be numbers.");
+    return to_double(a) < to_double(b);
   }
 
-  class plus_visitor : public static_visitor< int > {
-  public:
-    int operator()(int a, int b) const
-    {
-      return a + b;
-    }
-    template< typename T, typename U >
-    int operator()(const T& a, const U& b) const
-    {
-      check(false, "arguments to '+' must be integer.");
-    }
-  };
+  less_than::less_than() : binary_builtin(less_than_values, "<") {}
 
-  class plus_partial : public lambda {
-  public:
-    plus_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to '+ <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(plus_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
-
-  value plus::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value add(const value& a, const value& b)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to '+' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< plus_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(plus_visitor(), arg1, arg2);   
+    if (is_integer(a) && is_integer(b))
+      return integer_add(a, b);
+    check(is_number(a) && is_number(b), "arguments to '+' must be numbers.");
+    return make_real(to_double(a) + to_double(b));
   }
 
-  class minus_visitor : public static_visitor< int > {
-  public:
-    int operator()(int a, int b) const
-    {
-      return a - b;
-    }
-    template< typename T, typename U >
-    int operator()(const T& a, const U& b) const
-    {
-      check(false, "arguments to '-' must be integer.");
-    }
-  };
+  plus::plus() : binary_builtin(add, "+") {}
 
-  class minus_partial : public lambda {
-  public:
-    minus_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to '- <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(minus_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
-
-  value minus::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value subtract(const value& a, const value& b)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to '-' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< minus_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(minus_visitor(), arg1, arg2);   
+    if (is_integer(a) && is_integer(b))
+      return integer_subtract(a, b);
+    check(is_number(a) && is_number(b), "arguments to '-' must be numbers.");
+    return make_real(to_double(a) - to_double(b));
   }
 
-  class times_visitor : public static_visitor< int > {
-  public:
-    int operator()(int a, int b) const
-    {
-      return a * b;
-    }
-    template< typename T, typename U >
-    int operator()(const T& a, const U& b) const
-    {
-      check(false, "arguments to '*' must be integer.");
-    }
-  };
-
-  class times_partial : public lambda {
-  public:
-    times_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to '* <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(times_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
+  minus::minus() : binary_builtin(subtract, "-") {}
 
-  value times::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value multiply(const value& a, const value& b)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to '*' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< times_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(times_visitor(), arg1, arg2);   
+    if (is_integer(a) && is_integer(b))
+      return integer_multiply(a, b);
+    check(is_number(a) && is_number(b), "arguments to '*' must be numbers.");
+    return make_real(to_double(a) * to_double(b));
   }
 
-  class divide_visitor : public static_visitor< int > {
-  public:
-    int operator()(int a, int b) const
-    {
-      check(b != 0, "second argument to '/' must be non-zero.");
-      return a / b;
-    }
-    template< typename T, typename U >
-    int operator()(const T& a, const U& b) const
-    {
-      check(false, "arguments to '/' must be integer.");
-    }
-  };
-
-  class divide_partial : public lambda {
-  public:
-    divide_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to '/ <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(divide_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
+  times::times() : binary_builtin(multiply, "*") {}
 
-  value divide::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value quotient(const value& a, const value& b)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to '/' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< divide_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(divide_visitor(), arg1, arg2);   
+    if (is_integer(a) && is_integer(b)) {
+      check(!b.identical(0), "second argument to '/' must be non-zero.");
+      return integer_quotient(a, b);
+    }
+    check(is_number(a) && is_number(b), "arguments to '/' must be numbers.");
+    return make_real(to_double(a) / to_double(b));
   }
 
-  class modulo_visitor : public static_visitor< int > {
-  public:
-    int operator()(int a, int b) const
-    {
-      check(b != 0, "second argument to '%' must be non-zero.");
-      return a % b;
-    }
-    template< typename T, typename U >
-    int operator()(const T& a, const U& b) const
-    {
-      check(false, "arguments to '%' must be integer.");
-    }
-  };
+  divide::divide() : binary_builtin(quotient, "/") {}
 
-  class modulo_partial : public lambda {
-  public:
-    modulo_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to '% <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(modulo_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
-
-  value modulo::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value remainder(const value& a, const value& b)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to '%' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< modulo_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(modulo_visitor(), arg1, arg2);   
+    if (is_integer(a) && is_integer(b)) {
+      check(!b.identical(0), "second argument to '%' must be non-zero.");
+      return integer_remainder(a, b);
+    }
+    check(is_number(a) && is_number(b), "arguments to '%' must be numbers.");
+    return make_real(fmod(to_double(a), to_double(b)));
   }
 
-  value random_int::call(vector< value > args, shared_ptr< environment > caller_env_p)  
+  modulo::modulo() : binary_builtin(remainder, "%") {}
+
+  value random_int::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
   {
     return rand();
   }
 
-  class bool_visitor : public static_visitor< bool > {
-  public:
-    bool operator()(bool a) const
-    {
-      return a;
-    }
-    template< typename T >
-    bool operator()(const T& a) const
-    {
-      check(false, "boolean value expected.");
-    }
-  };
-
-  class is_atom_visitor : public static_visitor< bool > {
-  public:
-    bool operator()(const list& lst) const
-    {
-      return false;
-    }
-    template< typename T >
-    bool operator()(const T& t) const
-    {
-      return true;
-    }
-  };
-
-  value is_atom::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value is_atom::call(const vector< value >& args,
+                      const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'atom?' (must be 1).");
-    value arg = eval(args.front(), caller_env_p);
-    return apply_visitor(is_atom_visitor(), arg);
+    return call1(eval(args.front(), caller_env_p));
   }
 
-  class len_visitor : public static_visitor< int > {
-  public:
-    int operator()(const list& lst) const
-    {
-      return lst.size();
-    }
-    template< typename T >
-    int operator()(const T& t) const
-    {
-      check(false, "argument to 'len' must be a list.");
-    }
-  };
+  value is_atom::call1(const value& arg)
+  {
+    return !arg.is(type::list);
+  }
 
-  value len::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value len::call(const vector< value >& args,
+                  const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'len' (must be 1).");
-    value arg = eval(args.front(), caller_env_p);
-    return apply_visitor(len_visitor(), arg);
+    return call1(eval(args.front(), caller_env_p));
   }
 
-  class cons_visitor : public static_visitor< list > {
-  public:
-    template< typename T >
-    list operator()(const T& h, const list& t) const
-    {
-      return list(h, t);
-    }
-    template< typename T, typename U >
-    list operator()(const T& t, const U& u) const
-    {
-      check(false, "arguments to 'cons' must be a value and a list.");
-    }
-  };
-
-  class cons_partial : public lambda {
-  public:
-    cons_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to 'cons <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(cons_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
+  value len::call1(const value& arg)
+  {
+    if (arg.is(type::vector))
+      return long(get_vector(arg).size());
+    if (arg.is(type::hash_table))
+      return get_hash_table(arg).size();
+    if (arg.is(type::map))
+      return get_map(arg).size();
+    if (is_array(arg))
+      return array_size(arg);
+    if (arg.is(type::bitset))
+      return get_bitset(arg).size;
+    check(arg.is(type::list),
+          "argument to 'len' must be a list, vector, hash table, map, array or bitset.");
+    return arg.get_list().size();
+  }
 
-  value cons::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value cons_values(const value& h, const value& t)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to 'cons' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< cons_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(cons_visitor(), arg1, arg2);   
+    check(t.is(type::list), "arguments to 'cons' must be a value and a list.");
+    return list(h, t.get_list());
   }
 
-  class head_visitor : public static_visitor< value > {
-  public:
-    value operator()(const list& lst) const
-    {
-      check(!lst.empty(), "argument to 'head' must be a non-empty list.");
-      return lst.head();
-    }
-    template< typename T >
-    value operator()(const T& t) const
-    {
-      check(false, "argument to 'head' must be a non-empty list.");
-    }
-  };
+  cons::cons() : binary_builtin(cons_values, "cons") {}
 
-  value head::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value head::call(const vector< value >& args,
+                   const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'head' (must be 1).");
-    value arg = eval(args.front(), caller_env_p);
-    return apply_visitor(head_visitor(), arg);
+    return call1(eval(args.front(), caller_env_p));
   }
 
-  class tail_visitor : public static_visitor< list > {
-  public:
-    list operator()(const list& lst) const
-    {
-      check(!lst.empty(), "argument to 'tail' must be a non-empty list.");
-      return lst.tail();
-    }
-    template< typename T >
-    list operator()(const T& t) const
-    {
-      check(false, "argument to 'tail' must be a non-empty list.");
-    }
-  };
-  
-  value tail::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value head::call1(const value& arg)
   {
-    check(args.size() == 1, "wrong number of arguments to 'tail' (must be 1).");
-    value arg = eval(args.front(), caller_env_p);
-    return apply_visitor(tail_visitor(), arg);
+    check(arg.is(type::list) && !arg.get_list().empty(),
+          "argument to 'head' must be a non-empty list.");
+    return arg.get_list().head();
   }
 
-  class elem_visitor : public static_visitor< value > {
-  public:
-    value operator()(int i, const list& lst) const
-    {
-      check(i >= 1 && i <= lst.size(), "list index out of range.");
-      return lst[i - 1];
-    }
-    value operator()(const int i, const symbol& sym) const
-    {
-      check(false, "SYMBOL!");
-    }
-    value operator()(const int i, const shared_ptr<reference>& sym) const
-    {
-      check(false, "REF!");
-    }
-    template< typename T, typename U >
-    value operator()(const T& t, const U& u) const
-    {
-      check(false, "arguments to 'elem' must be an integer index and a non-empty list.");
-    }
-  };
+  value tail::call(const vector< value >& args,
+                   const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'tail' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
 
-  class elem_partial : public lambda {
-  public:
-    elem_partial(value a1) : arg1(a1) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, "wrong number of arguments to 'elem <expr>' (must be 1).");
-      value arg2 = eval(args.front(), caller_env_p);
-      return apply_visitor(elem_visitor(), arg1, arg2);
-    }
-  private:
-    value arg1;
-  };
+  value tail::call1(const value& arg)
+  {
+    check(arg.is(type::list) && !arg.get_list().empty(),
+          "argument to 'tail' must be a non-empty list.");
+    return arg.get_list().tail();
+  }
 
-  value elem::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value element(const value& i, const value& lst)
   {
-    check(args.size() == 1 || args.size() == 2, 
-          "wrong number of arguments to 'elem' (must be 1 or 2).");
-    value arg1 = eval(args[0], caller_env_p);
-    if (args.size() == 1)
-      return make_shared< elem_partial >(arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    return apply_visitor(elem_visitor(), arg1, arg2);   
+    check(i.is_int() && lst.is(type::list),
+          "arguments to 'elem' must be an integer index and a non-empty list.");
+    check(i.get_int() >= 1 && i.get_int() <= lst.get_list().size(),
+          "list index out of range.");
+    return lst.get_list()[i.get_int() - 1];
   }
 
-  class native_ref_visitor : public static_visitor< value& > {
-  public:
-    native_ref_visitor(shared_ptr< environment > ep) : env_p(ep) {}
-    value& operator()(const symbol& sym) const
-    {
-      check(env_p->find(sym), "symbol '" + sym + "' not found.");
-      return env_p->get_ref(sym);
-    }
-    template< typename T>
-    value& operator()(const T& t) const
-    {
-      check(false, "attempting to get reference to non-symbol.");
-    }
-  private:
-    shared_ptr< environment > env_p;
-  };
+  elem::elem() : binary_builtin(element, "elem") {}
 
-  class elem_ref_visitor : public static_visitor< value& > {
-  public:
-    value& operator()(list& lst, int i) const
-    {
-      check(i >= 1 && i <= lst.size(), "list index out of range.");
-      return lst[i - 1];
-    }
-    value& operator()(shared_ptr< reference >& lst_ref, int i) const
-    {
-      value& lst = lst_ref->get_native_ref();
-      value i_v(i);
-      return apply_visitor(elem_ref_visitor(), lst, i_v);
-    }
-    template< typename T, typename U >
-    value& operator()(T& t, U u) const
-    {
-      check(false, "arguments to 'set-elem!' must be a reference to a non-empty list, "
-            "an integer index, and a value.");
-    }
-  };
+  void list_set_element(value& var, const value& i, const value& val)
+  {
+    check(var.is(type::list) && i.is_int(),
+          "arguments to 'set-elem!' must be a reference to a non-empty list, "
+          "an integer index, and a value.");
+    list& lst = var.get_mutable_list();
+    check(i.get_int() >= 1 && i.get_int() <= lst.size(), "list index out of range.");
+    lst.get_ref(i.get_int() - 1) = val;
+  }
 
-  class set_elem_partial2 : public lambda {
+  class set_element_partial2 : public lambda {
   public:
-    set_elem_partial2(value a1, value a2, shared_ptr< environment > ep) 
-      : arg1(a1), arg2(a2), env_p(ep) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
+    set_element_partial2(element_setter f, const string& n, value a1, value a2,
+                         const shared_ptr< environment >& ep)
+      : setter(f), name(n), arg1(a1), arg2(a2), env_p(ep) {}
+    value call(const vector< value >& args, const shared_ptr< environment >& caller_env_p)
     {
-      check(args.size() == 1, 
-            "wrong number of arguments to 'set-elem! <expr> <expr>' (must be 1).");
-      value& list_ref = apply_visitor(native_ref_visitor(env_p), arg1);
+      check(args.size() == 1,
+            "wrong number of arguments to '", name, " <expr> <expr>' (must be 1).");
       value arg3 = eval(args.front(), caller_env_p);
-      value& ref = apply_visitor(elem_ref_visitor(), list_ref, arg2);
-      ref = arg3;
+      setter(variable_ref(arg1, env_p), arg2, arg3);
       return nil();
     }
   private:
+    element_setter setter;
+    string name;
     value arg1, arg2;
     shared_ptr< environment > env_p;
   };
 
-  class set_elem_partial : public lambda {
+  class set_element_partial : public lambda {
   public:
-    set_elem_partial(value a1, shared_ptr< environment > ep) : arg1(a1), env_p(ep) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
+    set_element_partial(element_setter f, const string& n, value a1,
+                        const shared_ptr< environment >& ep)
+      : setter(f), name(n), arg1(a1), env_p(ep) {}
+    value call(const vector< value >& args, const shared_ptr< environment >& caller_env_p)
     {
-      check(args.size() == 1 || args.size() == 2, 
-            "wrong number of arguments to 'set-elem! <expr>' (must be 1 or 2).");
+      check(args.size() == 1 || args.size() == 2,
+            "wrong number of arguments to '", name, " <expr>' (must be 1 or 2).");
       value arg2 = eval(args.front(), caller_env_p);
       if (args.size() == 1)
-        return make_shared< set_elem_partial2 >(arg1, arg2, env_p);
-      value& list_ref = apply_visitor(native_ref_visitor(env_p), arg1);
+        return make_object< set_element_partial2 >(setter, name, arg1, arg2, env_p);
       value arg3 = eval(args.back(), caller_env_p);
-      value& ref = apply_visitor(elem_ref_visitor(), list_ref, arg2);
-      ref = arg3;
+      setter(variable_ref(arg1, env_p), arg2, arg3);
       return nil();
     }
   private:
+    element_setter setter;
+    string name;
     value arg1;
     shared_ptr< environment > env_p;
   };
 
-  value set_elem::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value call_set_element(element_setter setter, const char* name,
+                         const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
   {
-    check(args.size() >= 1 && args.size() <= 3, 
-          "wrong number of arguments to 'set-elem!' (must be 1, 2 or 3).");
+    check(args.size() >= 1 && args.size() <= 3,
+          "wrong number of arguments to '", name, "' (must be 1, 2 or 3).");
     value arg1 = args[0];
     if (args.size() == 1)
-      return make_shared< set_elem_partial >(arg1, caller_env_p);
+      return make_object< set_element_partial >(setter, name, arg1, caller_env_p);
     value arg2 = eval(args[1], caller_env_p);
     if (args.size() == 2)
-      return make_shared< set_elem_partial2 >(arg1, arg2, caller_env_p);
-    value& list_ref = apply_visitor(native_ref_visitor(caller_env_p), arg1);
+      return make_object< set_element_partial2 >(setter, name, arg1, arg2, caller_env_p);
     value arg3 = eval(args[2], caller_env_p);
-    value& ref = apply_visitor(elem_ref_visitor(), list_ref, arg2);
-    ref = arg3;
+    setter(variable_ref(arg1, caller_env_p), arg2, arg3);
     return nil();
   }
 
-  class push_front_visitor : public static_visitor<> {
-  public:
-    template< typename T>
-    void operator()(list& lst, const T& val) const
-    {
-      lst.push_front(val);
-    }
-    template< typename T>
-    void operator()(shared_ptr< reference >& lst_ref, const T& val) const
-    {
-      value& lst = lst_ref->get_native_ref();
-      value v(val);
-      apply_visitor(push_front_visitor(), lst, v);
-    }
-    template< typename T, typename U>
-    void operator()(T& t, const U& u) const
-    {
-      check(false, 
-            "arguments to 'push-front!' must be a reference to a list and a value.");
-    }
-  };
-
-  class push_front_partial : public lambda {
-  public:
-    push_front_partial(value a1, shared_ptr< environment > ep) : arg1(a1), env_p(ep) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
-    {
-      check(args.size() == 1, 
-            "wrong number of arguments to 'push-front! <expr>' (must be 1).");
-      value& list_ref = apply_visitor(native_ref_visitor(env_p), arg1);
-      value arg2 = eval(args.front(), caller_env_p);
-      apply_visitor(push_front_visitor(), list_ref, arg2);
-      return nil();
-    }
-  private:
-    value arg1;
-    shared_ptr< environment > env_p;
-  };
+  value set_elem::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    return call_set_element(list_set_element, "set-elem!", args, caller_env_p);
+  }
 
-  value push_front::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  void list_push_front(value& var, const value& val)
   {
-    check(args.size() == 1 || args.size() == 2,
-          "wrong number of arguments to 'push-front!' (must be 1 or 2).");
-    value arg1 = args[0];
-    if (args.size() == 1)
-      return make_shared< push_front_partial >(arg1, caller_env_p);
-    value& list_ref = apply_visitor(native_ref_visitor(caller_env_p), arg1);
-    value arg2 = eval(args[1], caller_env_p);
-    apply_visitor(push_front_visitor(), list_ref, arg2);
-    return nil();
+    check(var.is(type::list),
+          "arguments to 'push-front!' must be a reference to a list and a value.");
+    var.get_mutable_list().push_front(val);
   }
 
-  class push_back_visitor : public static_visitor<> {
-  public:
-    template< typename T>
-    void operator()(list& lst, const T& val) const
-    {
-      lst.push_back(val);
-    }
-    template< typename T>
-    void operator()(shared_ptr< reference >& lst_ref, const T& val) const
-    {
-      value& lst = lst_ref->get_native_ref();
-      value v(val);
-      apply_visitor(push_back_visitor(), lst, v);
-    }
-    template< typename T, typename U>
-    void operator()(T& t, const U& u) const
-    {
-      check(false, 
-            "arguments to 'push-back!' must be a reference to a list and a value.");
-    }
-  };
+  void list_push_back(value& var, const value& val)
+  {
+    check(var.is(type::list),
+          "arguments to 'push-back!' must be a reference to a list and a value.");
+    var.get_mutable_list().push_back(val);
+  }
 
-  class push_back_partial : public lambda {
+  class modify_variable_partial : public lambda {
   public:
-    push_back_partial(value a1, shared_ptr< environment > ep) : arg1(a1), env_p(ep) {}
-    value call(vector< value > args, shared_ptr< environment > caller_env_p)
+    modify_variable_partial(variable_modifier f, const string& n, value a1,
+                            const shared_ptr< environment >& ep)
+      : modify(f), name(n), arg1(a1), env_p(ep) {}
+    value call(const vector< value >& args, const shared_ptr< environment >& caller_env_p)
     {
-      check(args.size() == 1, 
-            "wrong number of arguments to 'push-back! <expr>' (must be 1).");
-      value& list_ref = apply_visitor(native_ref_visitor(env_p), arg1);
+      check(args.size() == 1,
+            "wrong number of arguments to '", name, " <expr>' (must be 1).");
       value arg2 = eval(args.front(), caller_env_p);
-      apply_visitor(push_back_visitor(), list_ref, arg2);
+      modify(variable_ref(arg1, env_p), arg2);
       return nil();
     }
   private:
+    variable_modifier modify;
+    string name;
     value arg1;
     shared_ptr< environment > env_p;
   };
 
-  value push_back::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value call_modify_variable(variable_modifier modify, const char* name,
+                             const vector< value >& args,
+                             const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1 || args.size() == 2,
-          "wrong number of arguments to 'push-back!' (must be 1 or 2).");
-    value arg1 = args[0];
+          "wrong number of arguments to '", name, "' (must be 1 or 2).");
     if (args.size() == 1)
-      return make_shared< push_back_partial >(arg1, caller_env_p);
-    value& list_ref = apply_visitor(native_ref_visitor(caller_env_p), arg1);
+      return make_object< modify_variable_partial >(modify, name, args[0], caller_env_p);
     value arg2 = eval(args[1], caller_env_p);
-    apply_visitor(push_back_visitor(), list_ref, arg2);
+    modify(variable_ref(args[0], caller_env_p), arg2);
     return nil();
   }
 
-  class pop_front_visitor : public static_visitor<> {
-  public:
-    void operator()(list& lst) const
-    {
-      lst.pop_front();
-    }
-    void operator()(shared_ptr< reference >& lst_ref) const
-    {
-      value& lst = lst_ref->get_native_ref();
-      apply_visitor(pop_front_visitor(), lst);
-    }
-    template< typename T >
-    void operator()(T& t) const
-    {
-      check(false, 
-            "argument to 'pop-front!' must be a reference to a list.");
-    }
-  };
+  value push_front::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(list_push_front, "push-front!", args, caller_env_p);
+  }
+
+  value push_back::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(list_push_back, "push-back!", args, caller_env_p);
+  }
 
-  value pop_front::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value pop_front::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
   {
-    check(args.size() == 1, 
+    check(args.size() == 1,
           "wrong number of arguments to 'pop-front!' (must be 1).");
-    value arg1 = args[0];
-    value& list_ref = apply_visitor(native_ref_visitor(caller_env_p), arg1);
-    apply_visitor(pop_front_visitor(), list_ref);
+    value& var = variable_ref(args[0], caller_env_p);
+    check(var.is(type::list), "argument to 'pop-front!' must be a reference to a list.");
+    var.get_mutable_list().pop_front();
     return nil();
   }
 
-  class pop_back_visitor : public static_visitor<> {
-  public:
-    void operator()(list& lst) const
-    {
-      lst.pop_back();
-    }
-    void operator()(shared_ptr< reference >& lst_ref) const
-    {
-      value& lst = lst_ref->get_native_ref();
-      apply_visitor(pop_back_visitor(), lst);
-    }
-    template< typename T >
-    void operator()(T& t) const
-    {
-      check(false, 
-            "argument to 'pop-back!' must be a reference to a list.");
-    }
-  };
-
-  value pop_back::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value pop_back::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
   {
-    check(args.size() == 1, 
+    check(args.size() == 1,
           "wrong number of arguments to 'pop-back!' (must be 1).");
-    value arg1 = args[0];
-    value& list_ref = apply_visitor(native_ref_visitor(caller_env_p), arg1);
-    apply_visitor(pop_back_visitor(), list_ref);
+    value& var = variable_ref(args[0], caller_env_p);
+    check(var.is(type::list), "argument to 'pop-back!' must be a reference to a list.");
+    var.get_mutable_list().pop_back();
     return nil();
   }
-  
-  value delay::call(vector< value > args, shared_ptr< environment > caller_env_p)
+
+  value delay::call(const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'delay' (must be 1).");
-    return make_shared< delayed >(args.front(), caller_env_p);
+    return make_object< delayed >(args.front(), caller_env_p);
   }
 
-  class force_delayed_visitor : public static_visitor< value > {
-  public:
-    value operator()(const shared_ptr< delayed >& del) const
-    {
-      return del->force();
-    }
-    template< typename T>
-    value operator()(const T& t) const
-    {
-      check(false, "argument to 'force' must be a delayed computation.");
-    }
-  };
-
-  value force::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value force::call(const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'force' (must be 1).");
-    value arg1(eval(args.front(), caller_env_p));
-    return apply_visitor(force_delayed_visitor(), arg1);
+    return call1(eval(args.front(), caller_env_p));
   }
 
-  value print::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value force::call1(const value& arg1)
+  {
+    check(arg1.is(type::delayed), "argument to 'force' must be a delayed computation.");
+    return arg1.get_delayed()->force();
+  }
+
+  value print::call(const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'print' (must be 1).");
     output(cout, eval(args[0], caller_env_p));
     return nil();
   }
 
-  class print_string_visitor : public static_visitor<> {
-  public:
-    void operator()(const string& str) const
-    {
-      cout << unescape(str);
-    }
-    template< typename T>
-    void operator()(const T& t) const
-    {
-      check(false, "argument to 'print-string' must be a string.");
-    }
-  };
-
-  value print_string::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  value print_string::call(const vector< value >& args,
+                           const shared_ptr< environment >& caller_env_p)
   {
     check(args.size() == 1, "wrong number of arguments to 'print-string' (must be 1).");
-    value arg1 = eval(args.front(), caller_env_p);
-    apply_visitor(print_string_visitor(), arg1);
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value print_string::call1(const value& arg1)
+  {
+    check(arg1.is(type::string), "argument to 'print-string' must be a string.");
+    cout << arg1.get_string();
     return nil();
   }
 
-  value print_to_string::call(vector< value > args, 
-                              shared_ptr< environment > caller_env_p)
+  value print_to_string::call(const vector< value >& args,
+                              const shared_ptr< environment >& caller_env_p)
   {
-    check(args.size() == 1, 
+    check(args.size() == 1,
           "wrong number of arguments to 'print-to-string' (must be 1).");
     stringstream iss;
     output(iss, eval(args[0], caller_env_p));
     return iss.str();
   }
-  
-  value read::call(vector< value > args, shared_ptr< environment > caller_env_p)
+
+  value read::call(const vector< value >& args,
+                   const shared_ptr< environment >& caller_env_p)
   {
     check(args.empty(), "'read' takes no arguments.");
     string input;
     getline(cin, input);
     return eval(parse(input), caller_env_p);
-  } 
-  
-  value read_string::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  }
+
+  value read_string::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
   {
     check(args.empty(), "'read-string' takes no arguments.");
     string input;
     getline(cin, input);
-    return escape(input);
+    return input;
   }
 
-  class read_from_string_visitor : public static_visitor< value > {
-  public:
-    read_from_string_visitor(shared_ptr< environment > ep) : env_p(ep) {}
-    value operator()(const string& str) const
-    {
-      return eval(parse(str), env_p);
-    }
-    template< typename T>
-    value operator()(const T& t) const
-    {
-      check(false, "argument to 'read-from-string' must be a string.");
-    }
-  private:
-    shared_ptr< environment > env_p;
-  };
-
-  value read_from_string::call(vector< value > args, 
-                               shared_ptr< environment > caller_env_p)
+  value read_from_string::call(const vector< value >& args,
+                               const shared_ptr< environment >& caller_env_p)
   {
-    check(args.size() == 1, 
+    check(args.size() == 1,
           "wrong number of arguments to 'read-from-string' (must be 1).");
     value arg1 = eval(args.front(), caller_env_p);
-    return apply_visitor(read_from_string_visitor(caller_env_p), arg1);
+    check(arg1.is(type::string), "argument to 'read-from-string' must be a string.");
+    return eval(parse(arg1.get_string()), caller_env_p);
   }
 
-  void add_builtins(shared_ptr< environment > env_p)
+  void add_builtins(const shared_ptr< environment >& env_p)
   {
     env_p->set("nil", nil());
     env_p->set("true", true);
     env_p->set("false", false);
-    env_p->set("quote", make_shared< quote >());
-    env_p->set("eval", make_shared< evaluate >());
-    env_p->set("list", make_shared< make_list >());
-    env_p->set("load", make_shared< load >());
-    env_p->set("=", make_shared< equals >());
-    env_p->set("<", make_shared< less_than >());
-    env_p->set("+", make_shared< plus >());
-    env_p->set("-", make_shared< minus >());
-    env_p->set("*", make_shared< times >());
-    env_p->set("/", make_shared< divide >());
-    env_p->set("%", make_shared< modulo >());
-    env_p->set("random", make_shared< random_int >());
+    env_p->set("quote", make_object< quote >());
+    env_p->set("eval", make_object< evaluate >());
+    env_p->set("list", make_object< make_list >());
+    env_p->set("load", make_object< load >());
+    env_p->set("=", make_object< equals >());
+    env_p->set("<", make_object< less_than >());
+    env_p->set("+", make_object< plus >());
+    env_p->set("-", make_object< minus >());
+    env_p->set("*", make_object< times >());
+    env_p->set("/", make_object< divide >());
+    env_p->set("%", make_object< modulo >());
+    env_p->set("random", make_object< random_int >());
     env_p->set("rand-max", RAND_MAX);
-    env_p->set("atom?", make_shared< is_atom >());
-    env_p->set("len", make_shared< len >());
-    env_p->set("cons", make_shared< cons >());
-    env_p->set("head", make_shared< head >());
-    env_p->set("tail", make_shared< tail >());
-    env_p->set("elem", make_shared< elem >());
-    env_p->set("set-elem!", make_shared< set_elem >());
-    env_p->set("push-front!", make_shared< push_front >());
-    env_p->set("push-back!", make_shared< push_back >());
-    env_p->set("pop-front!", make_shared< pop_front >());
-    env_p->set("pop-back!", make_shared< pop_back >());
-    env_p->set("delay", make_shared< delay >());
-    env_p->set("force", make_shared< force >());
-    env_p->set("print", make_shared< print >());
-    env_p->set("print-string", make_shared< print_string >());
-    env_p->set("print-to-string", make_shared< print_to_string >());
-    env_p->set("read", make_shared< read >());
-    env_p->set("read-string", make_shared< read_string >());
-    env_p->set("read-from-string", make_shared< read_from_string >());
+    env_p->set("atom?", make_object< is_atom >());
+    env_p->set("len", make_object< len >());
+    env_p->set("cons", make_object< cons >());
+    env_p->set("head", make_object< head >());
+    env_p->set("tail", make_object< tail >());
+    env_p->set("elem", make_object< elem >());
+    env_p->set("set-elem!", make_object< set_elem >());
+    env_p->set("push-front!", make_object< push_front >());
+    env_p->set("push-back!", make_object< push_back >());
+    env_p->set("pop-front!", make_object< pop_front >());
+    env_p->set("pop-back!", make_object< pop_back >());
+    env_p->set("delay", make_object< delay >());
+    env_p->set("force", make_object< force >());
+    env_p->set("print", make_object< print >());
+    env_p->set("print-string", make_object< print_string >());
+    env_p->set("print-to-string", make_object< print_to_string >());
+    env_p->set("read", make_object< read >());
+    env_p->set("read-string", make_object< read_string >());
+    env_p->set("read-from-string", make_object< read_from_string >());
+    add_vector_builtins(env_p);
+    add_hash_table_builtins(env_p);
+    add_map_builtins(env_p);
+    add_string_builtins(env_p);
+    add_real_builtins(env_p);
+    add_array_builtins(env_p);
+    add_bitset_builtins(env_p);
     srand(time(nullptr));
   }
 
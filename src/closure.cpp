@@ -0,0 +1,284 @@
+// STL headers
+#include <string>
+#include <vector>
+
+// lime headers
+#include <closure.hpp>
+#include <optimize.hpp>
+
+namespace lime {
+  // STL
+  using std::make_shared;
+  using std::string;
+  using std::vector;
+
+  // lime
+  using lime::bound;
+  using lime::frame;
+  using lime::is_assigned;
+  using lime::is_special_form;
+  using lime::list;
+  using lime::make_object;
+  using lime::optimized_form;
+  using lime::reference;
+  using lime::resolve;
+
+  const symbol define_sym("define");
+  const symbol set_sym("set!");
+  const symbol lambda_sym("lambda");
+  const symbol defmacro_sym("defmacro");
+  const symbol for_sym("for");
+  const symbol for_each_sym("for-each");
+
+  void add_symbol(symbol sym, vector< symbol >& syms)
+  {
+    for (symbol other: syms)
+      if (other == sym)
+        return;
+    syms.push_back(sym);
+  }
+
+  // the variable a parameter binds, without & or $
+  symbol parameter(symbol param)
+  {
+    const string& name = param.name();
+    if (name.size() > 1 && (name.front() == '&' || name.front() == '$'))
+      return symbol(name.substr(1));
+    return param;
+  }
+
+  void add_parameters(const value& params, vector< symbol >& syms)
+  {
+    if (params.is(type::list))
+      for (const value& param: params.get_list())
+        if (param.is_symbol())
+          add_symbol(parameter(param.get_symbol()), syms);
+  }
+
+  // every symbol in expr, including those in expressions the optimizer rewrote
+  void find_symbols(const value& expr, vector< symbol >& syms)
+  {
+    if (expr.is_symbol())
+      add_symbol(expr.get_symbol(), syms);
+    else if (expr.is(type::list))
+      for (const value& item: expr.get_list())
+        find_symbols(item, syms);
+    else if (expr.is(type::node))
+      if (auto form_p = dynamic_cast< optimized_form* >(expr.get_object())) {
+        find_symbols(form_p->original, syms);
+        find_symbols(form_p->rewritten, syms);
+      }
+  }
+
+  // every variable that the lambdas, definitions and loops in expr bind
+  void find_bindings(const value& expr, vector< symbol >& syms)
+  {
+    if (expr.is(type::node))
+      if (auto form_p = dynamic_cast< optimized_form* >(expr.get_object())) {
+        find_bindings(form_p->original, syms);
+        find_bindings(form_p->rewritten, syms);
+      }
+    if (!expr.is(type::list) || expr.get_list().empty())
+      return;
+    const list& lst = expr.get_list();
+    if (lst.front().is_symbol() && lst.size() >= 2) {
+      symbol sym = lst.front().get_symbol();
+      const value& target = lst[1];
+      if (sym == lambda_sym)
+        add_parameters(target, syms);
+      else if ((sym == define_sym || sym == defmacro_sym || sym == for_sym ||
+                sym == for_each_sym) && target.is_symbol())
+        add_symbol(target.get_symbol(), syms);
+      else if ((sym == define_sym || sym == defmacro_sym) && target.is(type::list))
+        add_parameters(target, syms);
+    }
+    for (const value& item: lst)
+      find_bindings(item, syms);
+  }
+
+  class scope_scanner {
+  public:
+    scope_scanner(const value& body, scope& s, const scope_chain& sc, environment* g)
+      : target(s), scopes(sc), globals_p(g)
+    {
+      find_bindings(body, bound_names);
+    }
+    void scan(const value& expr)
+    {
+      if (expr.is(type::node))
+        if (auto form_p = dynamic_cast< optimized_form* >(expr.get_object())) {
+          scan(form_p->original);
+          scan(form_p->rewritten);
+        }
+      if (!expr.is(type::list) || expr.get_list().empty())
+        return;
+      const list& lst = expr.get_list();
+      if (!lst.front().is_symbol() || !is_special_form(lst.front().get_symbol())) {
+        scan_call(lst);
+        return;
+      }
+      symbol sym = lst.front().get_symbol();
+      if (sym == defmacro_sym) {
+        target.mark_open();
+        target.mark_escaping();
+        return;
+      }
+      // closures keep the frame they are created in
+      if (sym == lambda_sym || (sym == define_sym && lst.size() >= 2 &&
+                                lst[1].is(type::list)))
+        target.mark_escaping();
+      if ((sym == set_sym || sym == for_sym) && lst.size() >= 2 && lst[1].is_symbol())
+        target.mark_changing(lst[1].get_symbol());
+      // the target of a definition, a lambda's parameters and a loop's
+      // variable are not evaluated
+      bool binds = sym == define_sym || sym == set_sym || sym == lambda_sym ||
+                   sym == for_sym || sym == for_each_sym;
+      for (int i = binds ? 2 : 1; i < lst.size(); ++i)
+        scan(lst[i]);
+    }
+  private:
+    // A call may assign to a variable passed to it by name unless it is made
+    // to a global function without & parameters that is not a mutating
+    // builtin; macros and builtins such as eval open the scope. Those and
+    // the global functions that keep the caller's environment let the frame
+    // escape; calls of other functions, local or not yet defined, are assumed
+    // not to.
+    void scan_call(const list& lst)
+    {
+      const value& func = lst.front();
+      bool evaluates = false;
+      if (func.is_symbol() && is_global(func.get_symbol())) {
+        value* var_p = globals_p->variable(func.get_symbol().id());
+        if (var_p && var_p->is(type::macro)) {
+          target.mark_open();
+          target.mark_escaping();
+          return;
+        }
+        if (var_p && var_p->is(type::lambda)) {
+          lambda* lambda_p = var_p->get_lambda();
+          if (lambda_p->runs_in_caller_environment()) {
+            target.mark_open();
+            target.mark_escaping();
+            return;
+          }
+          if (lambda_p->keeps_caller_environment(lst.size() - 1))
+            target.mark_escaping();
+          if (lambda_p->quotes_arguments())
+            return;
+          evaluates = !lambda_p->modifies_arguments();
+          if (evaluates)
+            target.add_callee(func.get_symbol());
+        }
+      }
+      else
+        scan(func);
+      for (int i = 1; i < lst.size(); ++i) {
+        if (!evaluates && lst[i].is_symbol())
+          target.mark_changing(lst[i].get_symbol());
+        scan(lst[i]);
+      }
+    }
+    bool is_global(symbol sym) const
+    {
+      for (symbol bound_sym: bound_names)
+        if (bound_sym == sym)
+          return false;
+      for (const shared_ptr< scope >& scope_p: scopes)
+        if (scope_p->find(sym) >= 0)
+          return false;
+      return true;
+    }
+    scope& target;
+    const scope_chain& scopes;
+    environment* globals_p;
+    vector< symbol > bound_names;
+  };
+
+  void scan_scope(const value& body, scope& s, const scope_chain& scopes,
+                  environment* globals_p)
+  {
+    scope_scanner(body, s, scopes, globals_p).scan(body);
+  }
+
+  closure_layout::closure_layout(const value& body, const scope& params,
+                                 const scope_chain& scopes)
+    : flat(false), depth(scopes.size())
+  {
+    if (scopes.empty() || params.is_open())
+      return;
+    for (const shared_ptr< scope >& scope_p: scopes)
+      if (scope_p->is_open())
+        return;
+    vector< symbol > syms;
+    find_symbols(body, syms);
+    auto captured = make_shared< scope >();
+    for (symbol sym: syms) {
+      if (params.find(sym) >= 0)
+        continue;
+      vector< location > locations = resolve(sym, scopes);
+      if (locations.size() == 1)
+        continue;
+      if (locations.size() > 2 || params.is_changing(sym))
+        return;
+      const location& loc = locations.front();
+      captured->add(sym);
+      sources.push_back(loc);
+      changing.push_back(scopes[scopes.size() - 1 - loc.depth]->is_changing(sym));
+    }
+    for (symbol callee: params.get_callees())
+      add_symbol(callee, callees);
+    for (const shared_ptr< scope >& scope_p: scopes)
+      for (symbol callee: scope_p->get_callees())
+        add_symbol(callee, callees);
+    // a closure that would copy every variable of the frame it is created in,
+    // with only the global environment beyond, would save nothing
+    if (scopes.size() == 1 && captured->size() == scopes.front()->size())
+      return;
+    flat = true;
+    if (captured->size() > 0)
+      captured_p = captured;
+  }
+
+  scope_chain closure_layout::body_scopes(const scope_chain& scopes,
+                                          const shared_ptr< scope >& params_p) const
+  {
+    scope_chain chain;
+    if (!flat)
+      chain = scopes;
+    else if (captured_p)
+      chain.push_back(captured_p);
+    chain.push_back(params_p);
+    return chain;
+  }
+
+  shared_ptr< environment > closure_layout::capture(const shared_ptr< environment >&
+                                                    env_p) const
+  {
+    if (!flat)
+      return env_p;
+    const shared_ptr< environment >& globals_p = frame(env_p.get(), depth - 1)->
+                                                   shared_outer();
+    if (!captured_p)
+      return globals_p;
+    // once a function that the copies were judged safe from is assigned,
+    // it may modify any of them, and all are boxed
+    bool stale = false;
+    for (symbol callee: callees)
+      stale = stale || is_assigned(callee);
+    auto closure_env_p = nested_environment(globals_p, captured_p);
+    for (int i = 0; i < sources.size(); ++i) {
+      const location& loc = sources[i];
+      value* var_p = bound(loc, env_p.get());
+      if (var_p && ((!changing[i] && !stale) || var_p->is(type::reference)))
+        closure_env_p->slot(i) = *var_p;
+      else {
+        const shared_ptr< environment >& frame_p =
+          loc.depth == 0 ? env_p : frame(env_p.get(), loc.depth - 1)->shared_outer();
+        closure_env_p->slot(i) = make_object< reference >(captured_p->name(i), frame_p,
+                                                           loc.index);
+      }
+    }
+    return closure_env_p;
+  }
+
+} // namespace lime
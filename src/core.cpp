@@ -2,27 +2,168 @@
 #include <iostream>
 
 // lime headers
+#include <arrays.hpp>
+#include <bignum.hpp>
+#include <bitsets.hpp>
 #include <core.hpp>
 #include <eval.hpp>
 #include <expand.hpp>
+#include <hamt.hpp>
+#include <hash_table.hpp>
 #include <interpreter.hpp>
 #include <parse.hpp>
+#include <real.hpp>
+#include <vectors.hpp>
 
 namespace lime {
   // STL
   using std::cout;
+  using std::allocate_shared;
+  using std::make_move_iterator;
   using std::make_shared;
 
-  // Boost
-  using boost::apply_visitor;
-  using boost::static_visitor;
-
   // lime
   using lime::check;
   using lime::escape;
   using lime::eval;
   using lime::expand;
 
+  class symbol_table {
+  public:
+    unsigned intern(const string& str)
+    {
+      auto it = ids.find(str);
+      if (it != end(ids))
+        return it->second;
+      unsigned id = names.size();
+      names.push_back(str);
+      ids.emplace(str, id);
+      return id;
+    }
+    const string& name(unsigned id) const
+    {
+      return names[id];
+    }
+  private:
+    deque< string > names;
+    unordered_map< string, unsigned > ids;
+  };
+
+  symbol_table& global_symbol_table()
+  {
+    static symbol_table table;
+    return table;
+  }
+
+  unsigned symbol::intern(const string& str)
+  {
+    return global_symbol_table().intern(str);
+  }
+
+  const string& symbol::name() const
+  {
+    return global_symbol_table().name(index);
+  }
+
+  value::value(const string& str) : value(make_object< string_object >(str)) {}
+
+  value::value(const char* str) : value(make_object< string_object >(str)) {}
+
+  value::value(const list& lst) : value(make_object< list_object >(lst)) {}
+
+  list& value::get_mutable_list()
+  {
+    if (get_object()->ref_count > 1)
+      *this = value(get_list());
+    return static_cast< list_object* >(get_object())->lst;
+  }
+
+  const value& list::const_iterator::operator*() const
+  {
+    return (*lst)[pos];
+  }
+
+  const value* list::const_iterator::operator->() const
+  {
+    return &(*lst)[pos];
+  }
+
+  list::const_iterator& list::const_iterator::operator++()
+  {
+    ++pos;
+    return *this;
+  }
+
+  list::const_iterator list::const_iterator::operator+(long n) const
+  {
+    return const_iterator(lst, pos + n);
+  }
+
+  long list::const_iterator::operator-(const const_iterator& other) const
+  {
+    return pos - other.pos;
+  }
+
+  bool list::const_iterator::operator==(const const_iterator& other) const
+  {
+    return lst == other.lst && pos == other.pos;
+  }
+
+  bool list::const_iterator::operator!=(const const_iterator& other) const
+  {
+    return !(*this == other);
+  }
+
+  list::list(const value& h, const list& t)
+  {
+    if (t.buffer_p && t.first == t.buffer_p->origin) {
+      buffer_p = t.buffer_p;
+      last = t.last;
+    }
+    else {
+      buffer_p = make_shared< list_buffer >(0);
+      buffer_p->items.assign(t.begin(), t.end());
+      last = t.size();
+    }
+    buffer_p->items.push_front(h);
+    first = --buffer_p->origin;
+  }
+
+  int list::size() const
+  {
+    return last - first;
+  }
+
+  bool list::empty() const
+  {
+    return first == last;
+  }
+
+  const value& list::operator[](int i) const
+  {
+    return buffer_p->items[first + i - buffer_p->origin];
+  }
+
+  const value& list::front() const
+  {
+    return (*this)[0];
+  }
+
+  const value& list::back() const
+  {
+    return (*this)[size() - 1];
+  }
+
+  list::const_iterator list::begin() const
+  {
+    return const_iterator(this, 0);
+  }
+
+  list::const_iterator list::end() const
+  {
+    return const_iterator(this, size());
+  }
+
   value list::head() const
   {
     return front();
@@ -30,18 +171,101 @@ namespace lime {
 
   list list::tail() const
   {
-    return deque< value >(begin() + 1, end());
+    list t(*this);
+    if (!t.empty())
+      ++t.first;
+    return t;
+  }
+
+  value& list::get_ref(int i)
+  {
+    if (buffer_p.use_count() > 1)
+      make_unique();
+    return buffer_p->items[first + i - buffer_p->origin];
+  }
+
+  void list::push_front(const value& val)
+  {
+    value v(val);
+    if (!buffer_p) {
+      buffer_p = make_shared< list_buffer >(0);
+      first = last = 0;
+    }
+    else if (first != buffer_p->origin) {
+      if (buffer_p.use_count() > 1)
+        make_unique();
+      else {
+        auto& items = buffer_p->items;
+        items.erase(items.begin(), items.begin() + (first - buffer_p->origin));
+        buffer_p->origin = first;
+      }
+    }
+    buffer_p->items.push_front(v);
+    first = --buffer_p->origin;
+  }
+
+  void list::push_back(const value& val)
+  {
+    value v(val);
+    if (!buffer_p) {
+      buffer_p = make_shared< list_buffer >(0);
+      first = last = 0;
+    }
+    else if (last != buffer_p->origin + long(buffer_p->items.size())) {
+      if (buffer_p.use_count() > 1)
+        make_unique();
+      else
+        buffer_p->items.resize(last - buffer_p->origin);
+    }
+    buffer_p->items.push_back(v);
+    ++last;
+  }
+
+  void list::pop_front()
+  {
+    if (empty())
+      return;
+    if (buffer_p.use_count() == 1 && first == buffer_p->origin) {
+      buffer_p->items.pop_front();
+      ++buffer_p->origin;
+    }
+    ++first;
+  }
+
+  void list::pop_back()
+  {
+    if (empty())
+      return;
+    if (buffer_p.use_count() == 1 && 
+        last == buffer_p->origin + long(buffer_p->items.size()))
+      buffer_p->items.pop_back();
+    --last;
+  }
+
+  void list::make_unique()
+  {
+    auto unique_p = make_shared< list_buffer >(first);
+    unique_p->items.assign(begin(), end());
+    buffer_p = unique_p;
   }
 
   value reference::get() const
   {
-    check(env_p->find(sym), "reference to '" + sym + "' undefined.");
+    if (value* var_p = env_p->variable(index))
+      return *var_p;
+    check(env_p->find(sym), "reference to '", sym.name(), "' undefined.");
     return env_p->get(sym);
   }
 
   void reference::set(value val)
   {
-    check(env_p->find(sym), "reference to '" + sym + "' undefined.");
+    if (value* var_p = env_p->variable(index)) {
+      mark_assigned(sym);
+      *var_p = val;
+      return;
+    }
+    check(env_p->find(sym), "reference to '", sym.name(), "' undefined.");
+    mark_assigned(sym);
     if (env_p->find_local(sym))
       env_p->set(sym, val);
     else
@@ -50,95 +274,211 @@ namespace lime {
 
   value& reference::get_native_ref() const
   {
-    check(env_p->find(sym), "reference to '" + sym + "' undefined.");
+    if (value* var_p = env_p->variable(index))
+      return *var_p;
+    check(env_p->find(sym), "reference to '", sym.name(), "' undefined.");
     return env_p->get_ref(sym);
   }
 
-  lambda::lambda(vector< symbol > pars, value x, shared_ptr< environment > e) : 
-    expr(x), creation_env_p(e)
+  bool variable_name(const value& arg, symbol& sym)
   {
-    for (symbol p: pars) {
-      if (p.front() == '&') {
-        reference_arg.push_back(true);
-        delayed_arg.push_back(false);
-        p = symbol(p.substr(1));
-        check(p.size() > 0, "unnamed reference argument.");
-      }
-      else if (p.front() == '$') {
-        reference_arg.push_back(false);
-        delayed_arg.push_back(true);
-        p = symbol(p.substr(1));
-        check(p.size() > 0, "unnamed delayed argument.");
-      }
-      else {
-        reference_arg.push_back(false);
-        delayed_arg.push_back(false);
-      }
-      params.push_back(p);
+    if (arg.is_symbol()) {
+      sym = arg.get_symbol();
+      return true;
     }
+    return arg.is(type::node) && static_cast< node* >(arg.get_object())->is_variable(sym);
   }
-  
-  class make_reference_visitor : public static_visitor< shared_ptr< reference > > {
-  public:
-    make_reference_visitor(symbol s, shared_ptr< environment > ep) : sym(s), env_p(ep) {}
-    shared_ptr< reference > operator()(const shared_ptr< reference >& ref) const
-    {
-      return ref;
+
+  value make_reference(const value& arg, const shared_ptr< environment >& env_p)
+  {
+    symbol sym;
+    check(variable_name(arg, sym), "attempting to get reference to non-symbol.");
+    check(env_p->find(sym), "symbol '", sym.name(), "' not found.");
+    value val(env_p->get(sym));
+    if (val.is(type::reference))
+      return val;
+    return make_object< reference >(sym, env_p);
+  }
+
+  // The frame of a call with its arguments bound, or null if some are
+  // missing, in which case partial is set to the partial application.
+  shared_ptr< environment >
+  lambda::bind_arguments(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p, value& partial,
+                         bool nested)
+  {
+    int n_bound = bound_args.size();
+    check(n_bound + args.size() <= n_params, "too many arguments to lambda.");
+    check(args.size() > 0 || n_bound == n_params, "lambda called without arguments.");
+    auto local_env_p = new_frame(nested);
+    for (int i = 0; i < n_bound; ++i)
+      local_env_p->slot(i) = bound_args[i];
+    for (int i = n_bound; i < n_bound + args.size(); ++i) {
+      const value& arg = args[i - n_bound];
+      if (reference_arg[i])
+        local_env_p->slot(i) = make_reference(arg, caller_env_p);
+      else if (delayed_arg[i])
+        local_env_p->slot(i) = make_object< delayed >(arg, caller_env_p);
+      else
+        local_env_p->slot(i) = eval(arg, caller_env_p);
     }
-    template< typename T>
-    shared_ptr< reference > operator()(const T& val) const
-    {
-      return make_shared< reference >(sym, env_p);
+    if (n_bound + args.size() < n_params) {
+      vector< value > bound;
+      for (int i = 0; i < n_bound + args.size(); ++i)
+        bound.push_back(local_env_p->slot(i));
+      partial = make_object< lambda >(n_params, reference_arg, delayed_arg, scope_p, body,
+                                      source, creation_env_p, bound);
+      return nullptr;
     }
-  private:
-    symbol sym;
-    shared_ptr< environment > env_p;
-  };
+    return local_env_p;
+  }
 
-  shared_ptr< reference > reference_visitor::operator()(const symbol& sym) const
+  value lambda::call(const vector< value >& args,
+                     const shared_ptr< environment >& caller_env_p)
   {
-    check(env_p->find(sym), "symbol '" + sym + "' not found.");
-    value val(env_p->get(sym));
-    return apply_visitor(make_reference_visitor(sym, env_p), val);
+    value partial;
+    auto local_env_p = bind_arguments(args, caller_env_p, partial, true);
+    if (!local_env_p)
+      return partial;
+    return run(body, local_env_p);
   }
-  
-  template< typename T>
-  shared_ptr< reference > reference_visitor::operator()(const T& t) const
+
+  bool lambda::inline_source(vector< symbol >& params, value& src) const
   {
-    check(false, "attempting to get reference to non-symbol.");
+    if (!scope_p || creation_env_p->outer() || !bound_args.empty() ||
+        value_arity != n_params)
+      return false;
+    params.clear();
+    for (int i = 0; i < n_params; ++i)
+      params.push_back(scope_p->name(i));
+    src = source;
+    return true;
   }
 
-  value lambda::call(vector< value > args, shared_ptr< environment > caller_env_p)
+  bool lambda::modifies_arguments() const
   {
-    check(args.size() <= params.size(), "too many arguments to lambda.");
-    check(args.size() > 0 || params.size() == 0, "lambda called without arguments.");
-    auto local_env_p = nested_environment(creation_env_p);
-    for (int i = 0; i < args.size(); ++i)
+    for (int i = bound_args.size(); i < n_params; ++i)
       if (reference_arg[i])
-        local_env_p->set(params[i],
-                         apply_visitor(reference_visitor(caller_env_p), args[i]));
-      else if (delayed_arg[i])
-        local_env_p->set(params[i], make_shared< delayed >(args[i], caller_env_p));
-      else
-        local_env_p->set(params[i], eval(args[i], caller_env_p));
-    if (args.size() < params.size())
-      return partial(args.size(), local_env_p);
-    return eval(expr, local_env_p);
+        return true;
+    return false;
   }
 
-  shared_ptr< lambda > lambda::partial(int n_supplied_args, shared_ptr< environment > env_p)
+  bool lambda::keeps_caller_environment(int n_args) const
   {
-    vector< symbol > pars(begin(params) + n_supplied_args, end(params));
-    vector< bool > ref_arg(begin(reference_arg) + n_supplied_args, end(reference_arg));
-    vector< bool > del_arg(begin(delayed_arg) + n_supplied_args, end(delayed_arg));
-    return make_shared< lambda >(pars, ref_arg, del_arg, expr, env_p);
+    int n_bound = bound_args.size();
+    for (int i = n_bound; i < n_params && i < n_bound + n_args; ++i)
+      if (reference_arg[i] || delayed_arg[i])
+        return true;
+    return false;
   }
-  
-  value macro::call(vector< value > args, shared_ptr< environment > caller_env_p)
+
+  value lambda::tail_call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    if (!body)
+      return call(args, caller_env_p);
+    value partial;
+    auto local_env_p = bind_arguments(args, caller_env_p, partial, false);
+    if (!local_env_p)
+      return partial;
+    return lime::tail_call(body, local_env_p);
+  }
+
+  // the frame of a call with all the remaining arguments, already evaluated
+  shared_ptr< environment > lambda::bind_values(const value* args, int n, bool nested)
+  {
+    check(body && n == value_arity, "lambda does not take evaluated arguments.");
+    auto local_env_p = new_frame(nested);
+    int n_bound = bound_args.size();
+    for (int i = 0; i < n_bound; ++i)
+      local_env_p->slot(i) = bound_args[i];
+    for (int i = 0; i < n; ++i)
+      local_env_p->slot(n_bound + i) = args[i];
+    return local_env_p;
+  }
+
+  shared_ptr< environment > lambda::new_frame(bool nested) const
+  {
+    return nested_environment(creation_env_p, scope_p, nested && !scope_p->is_escaping());
+  }
+
+  value lambda::call1(const value& arg1)
+  {
+    value result;
+    if (call_native(&arg1, 1, result))
+      return result;
+    return run(body, bind_values(&arg1, 1, true));
+  }
+
+  value lambda::call2(const value& arg1, const value& arg2)
+  {
+    value args[] = { arg1, arg2 };
+    value result;
+    if (call_native(args, 2, result))
+      return result;
+    return run(body, bind_values(args, 2, true));
+  }
+
+  value lambda::call3(const value& arg1, const value& arg2, const value& arg3)
+  {
+    value args[] = { arg1, arg2, arg3 };
+    value result;
+    if (call_native(args, 3, result))
+      return result;
+    return run(body, bind_values(args, 3, true));
+  }
+
+  value lambda::tail_call_values(const value* args, int n)
+  {
+    value result;
+    if (body && call_native(args, n, result))
+      return result;
+    if (body)
+      return lime::tail_call(body, bind_values(args, n, false));
+    switch (n) {
+    case 1:
+      return call1(args[0]);
+    case 2:
+      return call2(args[0], args[1]);
+    default:
+      return call3(args[0], args[1], args[2]);
+    }
+  }
+
+  value macro::call(const vector< value >& args,
+                    const shared_ptr< environment >& caller_env_p)
+  {
+    return run(compiled_expansion(args, caller_env_p), caller_env_p);
+  }
+
+  value macro::expand(const vector< value >& args) const
   {
     check(args.size() == params.size(), "wrong number of arguments to macro.");
-    value expanded_expr(expand(expr, params, args));
-    return eval(expanded_expr, caller_env_p);
+    return lime::expand(expr, params, args);
+  }
+
+  bool identical_args(const vector< value >& a, const vector< value >& b)
+  {
+    if (a.size() != b.size())
+      return false;
+    for (int i = 0; i < a.size(); ++i)
+      if (!a[i].identical(b[i]))
+        return false;
+    return true;
+  }
+
+  intrusive_ptr< node > macro::compiled_expansion(const vector< value >& args,
+                                                  const shared_ptr< environment >& env_p)
+  {
+    shared_ptr< scope > scope_p = env_p->get_scope();
+    for (int i = expansions.size() - 1; i >= 0; --i)
+      if (expansions[i].scope_p == scope_p && identical_args(expansions[i].args, args))
+        return expansions[i].code;
+    intrusive_ptr< node > code = compile(expand(args), env_p, true);
+    if (expansions.size() == max_expansions)
+      expansions.erase(expansions.begin());
+    expansions.push_back(expansion { scope_p, args, code });
+    return code;
   }
 
   value delayed::force()
@@ -150,73 +490,179 @@ namespace lime {
     return cache;
   }
 
-  class output_visitor : public static_visitor<> {
-  public:
-    output_visitor(ostream& out) : out_stream(out) {}
-    void operator()(int i) const
-    {
-      out_stream << i;
-    }
-    void operator()(const string& s) const
-    {
-      out_stream << '"' << escape(s) << '"';
-    }
-    void operator()(bool b) const
-    {
-      out_stream << (b ? "true" : "false");
-    }
-    void operator()(const nil& n) const
-    {
+  ostream& operator<<(ostream& out_stream, const value& val)
+  {
+    return output(out_stream, val);
+  }
+
+  ostream& output(ostream& out_stream, const value& val)
+  {
+    switch (val.get_type()) {
+    case type::nil:
       out_stream << "nil";
-    }
-    void operator()(const list& l) const
-    {
+      break;
+    case type::boolean:
+      out_stream << (val.get_bool() ? "true" : "false");
+      break;
+    case type::integer:
+      out_stream << val.get_int();
+      break;
+    case type::bignum:
+      out_stream << integer_to_string(val);
+      break;
+    case type::real:
+      out_stream << real_to_string(get_real(val));
+      break;
+    case type::symbol:
+      out_stream << val.get_symbol().name();
+      break;
+    case type::string:
+      out_stream << '"' << escape(val.get_string()) << '"';
+      break;
+    case type::list: {
+      const list& l = val.get_list();
       out_stream << "(";
       for (int i = 0; i + 1 < l.size(); ++i)
         out_stream << l[i] << " ";
       if (!l.empty())
         out_stream << l.back();
       out_stream << ")";
+      break;
     }
-    void operator()(const shared_ptr< delayed >& del) const
-    {
-      out_stream << "...";
+    case type::vector: {
+      const vector< value >& items = get_vector(val);
+      out_stream << "[";
+      for (int i = 0; i + 1 < items.size(); ++i)
+        out_stream << items[i] << " ";
+      if (!items.empty())
+        out_stream << items.back();
+      out_stream << "]";
+      break;
     }
-    void operator()(const symbol& sym) const
-    {
-      out_stream << sym;
+    case type::hash_table: {
+      out_stream << "{";
+      bool first = true;
+      get_hash_table(val).for_each([&](const value& k, const value& v) {
+          out_stream << (first ? "" : ", ") << k << " " << v;
+          first = false;
+        });
+      out_stream << "}";
+      break;
     }
-    void operator()(const shared_ptr< lambda >& lam_p) const
-    {
-      out_stream << "lambda at address " << lam_p;
+    case type::map: {
+      out_stream << "#map{";
+      bool first = true;
+      get_map(val).for_each([&](const value& k, const value& v) {
+          out_stream << (first ? "" : ", ") << k << " " << v;
+          first = false;
+        });
+      out_stream << "}";
+      break;
     }
-    void operator()(const shared_ptr< macro >& mac_p) const
-    {
-      out_stream << "macro at address " << mac_p;
+    case type::int_array: {
+      out_stream << "#i64[";
+      const vector< int64_t >& items = get_int_array(val);
+      for (size_t i = 0; i < items.size(); ++i)
+        out_stream << (i == 0 ? "" : " ") << items[i];
+      out_stream << "]";
+      break;
     }
-    void operator()(const shared_ptr< reference >& ref) const
-    {
-      out_stream << ref->get();
+    case type::float_array: {
+      out_stream << "#f64[";
+      const vector< double >& items = get_float_array(val);
+      for (size_t i = 0; i < items.size(); ++i)
+        out_stream << (i == 0 ? "" : " ") << real_to_string(items[i]);
+      out_stream << "]";
+      break;
     }
-  private:
-    ostream& out_stream;
-  };
+    case type::bitset: {
+      out_stream << "#bitset{";
+      const bitset_object& bits = get_bitset(val);
+      bool first = true;
+      for (long i = 0; i < bits.size; ++i)
+        if ((bits.words[i / 64] >> (i % 64)) & 1) {
+          out_stream << (first ? "" : " ") << i;
+          first = false;
+        }
+      out_stream << "}";
+      break;
+    }
+    case type::reference:
+      out_stream << val.get_reference()->get();
+      break;
+    case type::lambda:
+      out_stream << "lambda at address " << val.get_object();
+      break;
+    case type::macro:
+      out_stream << "macro at address " << val.get_object();
+      break;
+    case type::delayed:
+      out_stream << "...";
+      break;
+    case type::node:
+      out_stream << "compiled expression at address " << val.get_object();
+      break;
+    }
+    return out_stream;
+  }
 
-  ostream& operator<<(ostream& out_stream, const value& val)
+  int scope::size() const
   {
-    output(out_stream, val);
+    return names.size();
   }
 
-  ostream& output(ostream& out_stream, const value& val)
+  int scope::find(symbol sym) const
   {
-    apply_visitor(output_visitor(out_stream), val);
-    return out_stream;
+    for (int i = 0; i < names.size(); ++i)
+      if (names[i] == sym)
+        return i;
+    return -1;
+  }
+
+  symbol scope::name(int index) const
+  {
+    return names[index];
+  }
+
+  int scope::add(symbol sym)
+  {
+    int i = find(sym);
+    if (i >= 0)
+      return i;
+    names.push_back(sym);
+    return names.size() - 1;
+  }
+
+  void scope::mark_changing(symbol sym)
+  {
+    if (!is_changing(sym))
+      changing.push_back(sym);
+  }
+
+  void scope::add_callee(symbol sym)
+  {
+    for (symbol callee: callees)
+      if (callee == sym)
+        return;
+    callees.push_back(sym);
+  }
+
+  bool scope::is_changing(symbol sym) const
+  {
+    for (symbol changing_sym: changing)
+      if (changing_sym == sym)
+        return true;
+    return false;
+  }
+
+  int environment::index(symbol sym) const
+  {
+    return scope_p ? scope_p->find(sym) : sym.id();
   }
 
   bool environment::find(symbol sym)
   {
-    return (values.find(sym) != end(values) || 
-            (outer_env_p && outer_env_p->find(sym)));
+    return find_local(sym) || (outer_env_p && outer_env_p->find(sym));
   }
 
   bool environment::find(string str)
@@ -226,9 +672,7 @@ namespace lime {
   
   value environment::get(symbol sym)
   {
-    if (values.find(sym) != end(values))
-      return values[sym];
-    return outer_env_p->get(sym);
+    return get_ref(sym);
   }
 
   value environment::get(string str)
@@ -238,7 +682,7 @@ namespace lime {
 
   void environment::set(symbol sym, value val)
   {
-    values[sym] = val;
+    slot(scope_p ? scope_p->add(sym) : sym.id()) = val;
   }
 
   void environment::set(string str, value val)
@@ -248,7 +692,7 @@ namespace lime {
 
   bool environment::find_local(symbol sym)
   {
-    return values.find(sym) != end(values);
+    return variable(index(sym)) != nullptr;
   }
 
   void environment::set_outermost(symbol sym, value val)
@@ -261,15 +705,95 @@ namespace lime {
 
   value& environment::get_ref(symbol sym)
   {
-    if (values.find(sym) != end(values))
-      return values[sym];
+    value* var_p = variable(index(sym));
+    if (var_p)
+      return *var_p;
     return outer_env_p->get_ref(sym);
   }
 
-  shared_ptr< environment > nested_environment(shared_ptr< environment > outer_env_p)
+  void environment::resize(int n)
+  {
+    if (slots == small_slots && n <= n_small_slots)
+      for (int i = n_slots; i < n; ++i)
+        small_slots[i] = value::unbound();
+    else {
+      if (slots == small_slots)
+        large_slots.assign(make_move_iterator(small_slots),
+                           make_move_iterator(small_slots + n_slots));
+      large_slots.resize(n, value::unbound());
+      slots = large_slots.data();
+    }
+    n_slots = n;
+  }
+
+  // A block of the frame stack, with its frames after the header. The blocks
+  // above the current one are empty, kept for reuse when calls nest deeply
+  // again.
+  class frame_block {
+  public:
+    static const size_t size = 256 << 10;
+    char* begin()
+    {
+      return reinterpret_cast< char* >(this + 1);
+    }
+    char* end()
+    {
+      return reinterpret_cast< char* >(this) + size;
+    }
+    frame_block* below;
+    frame_block* above;
+    char* top;
+    long n_frames;
+  };
+
+  frame_block* current_block = nullptr;
+
+  void* frame_stack::allocate(size_t size)
+  {
+    while (!current_block || current_block->top + size > current_block->end()) {
+      frame_block* block_p = current_block ? current_block->above : nullptr;
+      if (!block_p) {
+        block_p = static_cast< frame_block* >(::operator new(frame_block::size));
+        block_p->below = current_block;
+        block_p->above = nullptr;
+        block_p->top = block_p->begin();
+        block_p->n_frames = 0;
+        if (current_block)
+          current_block->above = block_p;
+      }
+      current_block = block_p;
+    }
+    void* p = current_block->top;
+    current_block->top += size;
+    ++current_block->n_frames;
+    return p;
+  }
+
+  void frame_stack::deallocate(void* p, size_t size)
+  {
+    char* frame_p = static_cast< char* >(p);
+    frame_block* block_p = current_block;
+    while (frame_p < block_p->begin() || frame_p >= block_p->end())
+      block_p = block_p->below;
+    if (frame_p + size == block_p->top)
+      block_p->top = frame_p;
+    if (--block_p->n_frames == 0)
+      block_p->top = block_p->begin();
+    while (current_block->n_frames == 0 && current_block->below)
+      current_block = current_block->below;
+  }
+
+  shared_ptr< environment > nested_environment(const shared_ptr< environment >&
+                                               outer_env_p,
+                                               const shared_ptr< scope >& scope_p,
+                                               bool on_stack)
   {
-    auto nested_env_p = make_shared< environment >();
+    auto nested_env_p =
+      on_stack ? allocate_shared< environment >(frame_stack_allocator< environment >()) :
+                 allocate_shared< environment >(frame_allocator< environment >());
     nested_env_p->outer_env_p = outer_env_p;
+    nested_env_p->scope_p = scope_p;
+    nested_env_p->resize(scope_p->size());
     return nested_env_p;
   }
 
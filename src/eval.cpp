@@ -1,332 +1,945 @@
+// C headers
+#include <sys/resource.h>
+#include <ucontext.h>
+
 // STL headers
-#include <algorithm>
+#include <initializer_list>
+#include <new>
 
 // lime headers
+#include <closure.hpp>
 #include <eval.hpp>
 #include <interpreter.hpp>
+#include <optimize.hpp>
+#include <vm.hpp>
 
 namespace lime {
   // STL
+  using std::begin;
+  using std::end;
+  using std::initializer_list;
   using std::make_shared;
-  using std::transform;
-
-  // Boost
-  using boost::apply_visitor;
-  using boost::static_visitor;
+  using std::move;
+  using std::nothrow;
+  using std::to_string;
 
   // lime
   using lime::check;
+  using lime::closure_layout;
   using lime::load_file;
+  using lime::make_object;
   using lime::nested_environment;
+  using lime::scan_scope;
+  using lime::scope;
 
-  class test_visitor : public static_visitor< bool > {
-  public:
-    bool operator()(bool b) const
-    {
-      return b;
+  const symbol if_sym("if");
+  const symbol define_sym("define");
+  const symbol set_sym("set!");
+  const symbol begin_sym("begin");
+  const symbol local_sym("local");
+  const symbol lambda_sym("lambda");
+  const symbol defmacro_sym("defmacro");
+  const symbol quote_sym("quote");
+  const symbol while_sym("while");
+  const symbol for_sym("for");
+  const symbol for_each_sym("for-each");
+  const symbol and_sym("and");
+  const symbol or_sym("or");
+  const symbol not_sym("not");
+  const symbol less_than_sym("<");
+  const symbol plus_sym("+");
+
+  vector< location > resolve(symbol sym, const scope_chain& scopes)
+  {
+    vector< location > locations;
+    for (int i = scopes.size() - 1; i >= 0; --i) {
+      int index = scopes[i]->find(sym);
+      if (index >= 0 || scopes[i]->is_open())
+        locations.emplace_back(scopes.size() - 1 - i, index);
     }
-    template< typename T >
-    bool operator()(const T& t) const
-    {
-      check(false, "first argument to 'if' must evaluate to boolean.");
+    locations.emplace_back(scopes.size(), sym.id());
+    return locations;
+  }
+
+  // Variables defined at run time by eval or a macro may be missing from the
+  // scopes the reference was resolved in, so they are looked up by name in
+  // the frames of open scopes, and in the whole environment if not found.
+  value load_variable(symbol sym, const vector< location >& locations,
+                      const shared_ptr< environment >& env_p)
+  {
+    value* var_p = nullptr;
+    for (int i = 0; i < locations.size() && !var_p; ++i)
+      var_p = bound(sym, locations[i], env_p.get());
+    if (!var_p) {
+      check(env_p->find(sym), "symbol '", sym.name(), "' not found.");
+      var_p = &env_p->get_ref(sym);
     }
-  };
+    if (var_p->is(type::reference))
+      return var_p->get_reference()->get();
+    return *var_p;
+  }
+
+  void assign_by_name(symbol sym, const value& new_val,
+                      const shared_ptr< environment >& env_p)
+  {
+    check(env_p->find(sym), "argument '", sym.name(), "' to 'set!' is undefined.");
+    value old_val = env_p->get(sym);
+    if (old_val.is(type::reference))
+      old_val.get_reference()->set(new_val);
+    else if (env_p->find_local(sym))
+      env_p->set(sym, new_val);
+    else
+      env_p->set_outermost(sym, new_val);
+  }
+
+  // set! changes a reference's target, a local variable, or else the outermost
+  // variable of that name
+  void assign_variable(symbol sym, const vector< location >& locations,
+                       const value& new_val, const shared_ptr< environment >& env_p)
+  {
+    int target = -1;
+    for (int i = 0; i < locations.size() && target < 0; ++i)
+      if (bound(sym, locations[i], env_p.get()))
+        target = i;
+    if (target < 0) {
+      assign_by_name(sym, new_val, env_p);
+      return;
+    }
+    value* var_p = bound(sym, locations[target], env_p.get());
+    if (var_p->is(type::reference)) {
+      var_p->get_reference()->set(new_val);
+      return;
+    }
+    if (locations[target].depth > 0)
+      for (int i = locations.size() - 1; i > target; --i)
+        if (bound(sym, locations[i], env_p.get())) {
+          target = i;
+          break;
+        }
+    *bound(sym, locations[target], env_p.get()) = new_val;
+  }
+
+  long assignment_epoch = 0;
 
-  class parameter_visitor : public static_visitor< symbol > {
+  // whether each symbol, by id, has been marked
+  vector< bool > assigned_names;
+
+  void mark_assigned(symbol sym)
+  {
+    if (sym.id() >= assigned_names.size())
+      assigned_names.resize(sym.id() + 1);
+    if (!assigned_names[sym.id()]) {
+      assigned_names[sym.id()] = true;
+      ++assignment_epoch;
+    }
+  }
+
+  bool is_assigned(symbol sym)
+  {
+    return sym.id() < assigned_names.size() && assigned_names[sym.id()];
+  }
+
+  value global_binding::lookup(symbol sym, const vector< location >& locations,
+                               const shared_ptr< environment >& env_p)
+  {
+    value* var_p = bound(locations.front(), env_p.get());
+    if (!var_p || !var_p->is(type::lambda))
+      return load_variable(sym, locations, env_p);
+    if (!is_assigned(sym)) {
+      val = *var_p;
+      epoch = assignment_epoch;
+    }
+    return *var_p;
+  }
+
+  void guarded_node::check_dependencies()
+  {
+    for (symbol sym: dependencies)
+      if (is_assigned(sym))
+        code = fallback;
+    epoch = assignment_epoch;
+  }
+
+  bool is_special_form(symbol sym)
+  {
+    return sym == if_sym || sym == define_sym || sym == set_sym || sym == begin_sym ||
+      sym == local_sym || sym == lambda_sym || sym == defmacro_sym || sym == while_sym ||
+      sym == for_sym || sym == for_each_sym || sym == and_sym || sym == or_sym;
+  }
+
+  bool inlines_not(const list& expr, const scope_chain& scopes)
+  {
+    return expr.size() == 2 && expr.front().is_symbol() &&
+      expr.front().get_symbol() == not_sym && resolve(not_sym, scopes).size() == 1 &&
+      !is_assigned(not_sym);
+  }
+
+  // The call that a node in tail position has left for the innermost run to
+  // make. At most one is pending at a time, since the marker is returned
+  // straight to run.
+  intrusive_ptr< node > pending_code;
+  shared_ptr< environment > pending_env_p;
+
+  value tail_call(intrusive_ptr< node > code, shared_ptr< environment > env_p)
+  {
+    pending_code = move(code);
+    pending_env_p = move(env_p);
+    return value::tail_call();
+  }
+
+  value run_loop(intrusive_ptr< node > code, shared_ptr< environment > env_p)
+  {
+    value result = code->execute(env_p);
+    while (result.is_tail_call()) {
+      code = move(pending_code);
+      env_p = move(pending_env_p);
+      result = code->execute(env_p);
+    }
+    return result;
+  }
+
+  // Calls that are not in tail position nest on the C++ stack, so deep
+  // recursion continues on stack segments allocated from the heap: when run
+  // finds the current segment nearly used up, it switches to a new one for
+  // the rest of the call. Segments are kept for reuse once deep recursion
+  // returns, since a loop around the boundary would otherwise allocate one on
+  // every call.
+  const size_t segment_size = 4 << 20;
+  const size_t segment_reserve = 256 << 10;
+
+  // the cap on nested runs, or 0 for none
+  long max_depth = 0;
+  long depth = 0;
+  char* segment_top = nullptr;
+  size_t segment_budget = 0;
+  vector< char* > free_segments;
+
+  // what run passes to the code started on a new segment, and back
+  class segment_call {
   public:
-    symbol operator()(const symbol& sym) const
-    {
-      return sym;
+    intrusive_ptr< node > code;
+    shared_ptr< environment > env_p;
+    value result;
+  };
+
+  segment_call* current_segment_call;
+
+  void run_segment_call()
+  {
+    segment_call* call_p = current_segment_call;
+    call_p->result = run_loop(move(call_p->code), move(call_p->env_p));
+  }
+
+  value run_on_new_segment(intrusive_ptr< node > code, shared_ptr< environment > env_p)
+  {
+    char* segment_p;
+    if (free_segments.empty()) {
+      segment_p = new (nothrow) char[segment_size];
+      check(segment_p, "out of memory for recursion.");
+    }
+    else {
+      segment_p = free_segments.back();
+      free_segments.pop_back();
+    }
+    char* outer_top = segment_top;
+    size_t outer_budget = segment_budget;
+    segment_top = segment_p + segment_size;
+    segment_budget = segment_size - segment_reserve;
+    segment_call call { move(code), move(env_p), value() };
+    current_segment_call = &call;
+    ucontext_t caller_context, segment_context;
+    getcontext(&segment_context);
+    segment_context.uc_stack.ss_sp = segment_p;
+    segment_context.uc_stack.ss_size = segment_size;
+    segment_context.uc_link = &caller_context;
+    makecontext(&segment_context, run_segment_call, 0);
+    swapcontext(&caller_context, &segment_context);
+    segment_top = outer_top;
+    segment_budget = outer_budget;
+    free_segments.push_back(segment_p);
+    return call.result;
+  }
+
+  // the part of the process stack that run uses before switching segments
+  size_t main_stack_budget()
+  {
+    rlimit limit;
+    size_t size = 8 << 20;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        limit.rlim_cur < size)
+      size = limit.rlim_cur;
+    return size > 2 * segment_reserve ? size - 2 * segment_reserve : size / 2;
+  }
+
+  void set_max_depth(long n)
+  {
+    check(n > 0, "maximum recursion depth must be positive.");
+    max_depth = n;
+  }
+
+  value run(intrusive_ptr< node > code, shared_ptr< environment > env_p)
+  {
+    char here;
+    if (!segment_top) {
+      segment_top = &here;
+      segment_budget = main_stack_budget();
     }
-    template< typename T >
-    symbol operator()(const T& t) const
+    if (++depth > max_depth && max_depth > 0)
+      check(false, "maximum recursion depth (" + to_string(max_depth) + ") exceeded.");
+    value result;
+    if (size_t(segment_top - &here) > segment_budget)
+      result = run_on_new_segment(move(code), move(env_p));
+    else
+      result = run_loop(move(code), move(env_p));
+    --depth;
+    return result;
+  }
+
+  // Analysis never fails: an ill-formed expression compiles to a node that
+  // reports the error when it is executed, as the interpreter did, since it
+  // might be quoted data that is never run.
+  class error_node : public node {
+  public:
+    explicit error_node(const string& msg) : error_msg(msg) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      check(false, 
-            "parameter-list in lambda or macro definition must only contain symbols.");
+      check(false, error_msg);
+      return nil();
     }
+  private:
+    string error_msg;
   };
 
-  class lambda_params_visitor : public static_visitor< vector< symbol > > {
+  class constant_node : public node {
   public:
-    vector< symbol > operator()(const list& lst) const
-    {
-      vector< symbol > params(lst.size());
-      transform(begin(lst), end(lst), begin(params), [](value v) {
-          return apply_visitor(parameter_visitor(), v);
-        });
-      return params;
-    }
-    template< typename T >
-    vector< symbol > operator()(const T& t) const
+    explicit constant_node(const value& v) : val(v) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      check(false, "first argument to 'lambda' must be a list of parameters.");
+      return val;
     }
+  private:
+    value val;
   };
 
-  class function_name_visitor : public static_visitor< symbol > {
+  class variable_node : public node {
   public:
-    symbol operator()(const symbol& sym) const
+    variable_node(symbol s, const vector< location >& locs) : sym(s), locations(locs) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      return sym;
+      return load_variable(sym, locations, env_p);
     }
-    template< typename T >
-    symbol operator()(const T& t) const
+    bool is_variable(symbol& s) const
     {
-      check(false, "function name must be a symbol.");
+      s = sym;
+      return true;
     }
+  private:
+    symbol sym;
+    vector< location > locations;
   };
 
-  class define_visitor : public static_visitor<> {
+  // a variable that can only be global (see global_binding)
+  class global_variable_node : public node {
   public:
-    define_visitor(list x, shared_ptr< environment > ep) : expr(x), env_p(ep) {}
-    void operator()(const symbol& sym) const
+    global_variable_node(symbol s, const vector< location >& locs)
+      : sym(s), locations(locs) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      check(!env_p->find_local(sym), "attempting to redefine symbol '" + sym + "'.");
-      env_p->set(sym, eval(expr[2], env_p));
+      return binding.get(sym, locations, env_p);
     }
-    void operator()(const list& lst) const
-    {
-      check(lst.size() >= 0, "syntax error in 'define'.");
-      value sym_v = lst.head();
-      symbol sym = apply_visitor(function_name_visitor(), sym_v);
-      check(!env_p->find_local(sym), "attempting to redefine symbol '" + sym + "'.");
-      value params_v = lst.tail();
-      vector< symbol > params = apply_visitor(lambda_params_visitor(), params_v);
-      env_p->set(sym, make_shared< lambda >(params, expr[2], env_p));
-    }
-    template< typename T >
-    void operator()(const T& t) const
+    bool is_variable(symbol& s) const
     {
-      check(false, "first argument to 'define' must be a symbol or list.");
+      s = sym;
+      return true;
     }
   private:
-    list expr;
-    shared_ptr< environment > env_p;
+    symbol sym;
+    vector< location > locations;
+    global_binding binding;
   };
 
-  class set_reference_visitor : public static_visitor< bool > {
+  class reference_node : public node {
   public:
-    set_reference_visitor(list x, shared_ptr< environment > ep) : expr(x), env_p(ep) {}
-    bool operator()(const shared_ptr< reference >& ref) const
+    explicit reference_node(const value& r) : ref(r) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      ref->set(eval(expr[2], env_p));
-      return true;
+      return ref.get_reference()->get();
     }
-    template< typename T>
-    bool operator()(const T& t) const
+  private:
+    value ref;
+  };
+
+  class if_node : public node {
+  public:
+    if_node(intrusive_ptr< node > c, intrusive_ptr< node > t, intrusive_ptr< node > e)
+      : condition(c), then_branch(t), else_branch(e) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      return false;
+      value cond = condition->execute(env_p);
+      check(cond.is_bool(), "first argument to 'if' must evaluate to boolean.");
+      return (cond.get_bool() ? then_branch : else_branch)->execute(env_p);
     }
   private:
-    list expr;
-    shared_ptr< environment > env_p;
+    intrusive_ptr< node > condition, then_branch, else_branch;
   };
 
-  class set_visitor : public static_visitor<> {
+  class define_node : public node {
   public:
-    set_visitor(list x, shared_ptr< environment > ep) : expr(x), env_p(ep) {}
-    void operator()(const symbol& sym) const
+    define_node(symbol s, int i, intrusive_ptr< node > v) : sym(s), index(i), val(v) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      check(env_p->find(sym), "argument '" + sym + "' to 'set!' is undefined.");
-      value val = env_p->get(sym);
-      if (apply_visitor(set_reference_visitor(expr, env_p), val))
-        return;
-      if (env_p->find_local(sym))
-        env_p->set(sym, eval(expr[2], env_p));
-      else
-        env_p->set_outermost(sym, eval(expr[2], env_p));
+      check(!env_p->variable(index),
+            "attempting to redefine symbol '", sym.name(), "'.");
+      value new_val = val->execute(env_p);
+      env_p->slot(index) = new_val;
+      return nil();
     }
-    template< typename T >
-    void operator()(const T& t) const
+  private:
+    symbol sym;
+    int index;
+    intrusive_ptr< node > val;
+  };
+
+  class set_node : public node {
+  public:
+    set_node(symbol s, const vector< location >& locs, intrusive_ptr< node > v)
+      : sym(s), locations(locs), val(v) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      check(false, "first argument to 'set!' must be a symbol.");
+      assign_variable(sym, locations, val->execute(env_p), env_p);
+      return nil();
     }
   private:
-    list expr;
-    shared_ptr< environment > env_p;
+    symbol sym;
+    vector< location > locations;
+    intrusive_ptr< node > val;
   };
 
-  class function_call_visitor : public static_visitor< value > {
+  // begin, or local if it has a scope of its own
+  class sequence_node : public node {
   public:
-    function_call_visitor(list x, shared_ptr< environment > ep) : expr(x), env_p(ep) {}
-    value operator()(const shared_ptr< lambda >& lam_p) const
+    sequence_node(const vector< intrusive_ptr< node > >& b, const shared_ptr< scope >& s)
+      : body(b), scope_p(s) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      vector< value > args(begin(expr) + 1, end(expr));
-      return lam_p->call(args, env_p);
+      if (scope_p)
+        return execute_body(nested_environment(env_p, scope_p));
+      return execute_body(env_p);
     }
-    value operator()(const shared_ptr< macro >& mac_p) const
+  private:
+    value execute_body(const shared_ptr< environment >& env_p)
     {
-      vector< value > args(begin(expr) + 1, end(expr));
-      return mac_p->call(args, env_p);
+      for (int i = 0; i + 1 < body.size(); ++i)
+        body[i]->execute(env_p);
+      if (!body.empty())
+        return body.back()->execute(env_p);
+      return nil();
     }
-    template< typename T>
-    value operator()(const T& t) const
+  private:
+    vector< intrusive_ptr< node > > body;
+    shared_ptr< scope > scope_p;
+  };
+
+  // The loops keep the semantics of the macros they replace. while evaluates
+  // its test a second time with eval, as (if (eval test) ...) did.
+  class while_node : public node {
+  public:
+    while_node(intrusive_ptr< node > t, intrusive_ptr< node > b) : test(t), body(b) {}
+    value execute(const shared_ptr< environment >& env_p)
     {
-      check(false, "first element of a list must be a lambda, macro or builtin operator.");
+      while (true) {
+        value cond = eval(test->execute(env_p), env_p);
+        check(cond.is_bool(), "first argument to 'if' must evaluate to boolean.");
+        if (!cond.get_bool())
+          return nil();
+        body->execute(env_p);
+      }
     }
   private:
-    list expr;
-    shared_ptr< environment > env_p;
+    intrusive_ptr< node > test, body;
   };
 
-  class macro_params_visitor : public static_visitor< vector< symbol > > {
+  // for-each runs its body in a frame of its own for each element, with the
+  // element in the first slot
+  class for_each_node : public node {
   public:
-    vector< symbol > operator()(const list& lst) const
-    {
-      vector< symbol > params(lst.size());
-      transform(begin(lst), end(lst), begin(params), [](value v) {
-          return apply_visitor(parameter_visitor(), v);
-        });
-      return params;
-    }
-    template< typename T >
-    vector< symbol > operator()(const T& t) const
-    {
-      check(false, 
-            "first argument to 'defmacro' must be a list with the macro's name followed "
-            "by the parameters' names.");
+    for_each_node(intrusive_ptr< node > l, shared_ptr< scope > s, intrusive_ptr< node > b)
+      : lst(l), scope_p(s), body(b) {}
+    value execute(const shared_ptr< environment >& env_p)
+    {
+      value lst_v = lst->execute(env_p);
+      check(lst_v.is(type::list), "second argument to 'for-each' must be a list.");
+      for (const value& item: lst_v.get_list()) {
+        auto iteration_env_p = nested_environment(env_p, scope_p);
+        iteration_env_p->slot(0) = item;
+        body->execute(iteration_env_p);
+      }
+      return nil();
     }
+  private:
+    intrusive_ptr< node > lst;
+    shared_ptr< scope > scope_p;
+    intrusive_ptr< node > body;
   };
 
-  class defmacro_visitor : public static_visitor<> {
+  class lambda_node : public node {
   public:
-    defmacro_visitor(list x, shared_ptr< environment > ep) : expr(x), env_p(ep) {}
-    void operator()(const list& lst) const
-    {
-      check(lst.size() >= 0, "syntax error in 'defmacro'.");
-      value sym_v = lst.head();
-      symbol sym = apply_visitor(function_name_visitor(), sym_v);
-      check(!env_p->find_local(sym), "attempting to redefine symbol '" + sym + "'.");
-      value params_v = lst.tail();
-      vector< symbol > params = apply_visitor(macro_params_visitor(), params_v);
-      env_p->set(sym, make_shared< macro >(params, expr[2]));
-    }
-    template< typename T >
-    void operator()(const T& t) const
-    {
-      check(false, 
-            "first argument to 'defmacro' must be a list with the macro's name followed "
-            "by the parameters' names.");
+    lambda_node(int n, const vector< bool >& ref_arg, const vector< bool >& del_arg,
+                const shared_ptr< scope >& s, intrusive_ptr< node > b, const value& src,
+                const closure_layout& l)
+      : n_params(n), reference_arg(ref_arg), delayed_arg(del_arg), scope_p(s), body(b),
+        source(src), layout(l) {}
+    value execute(const shared_ptr< environment >& env_p)
+    {
+      return make_object< lambda >(n_params, reference_arg, delayed_arg, scope_p, body,
+                                   source, layout.capture(env_p));
     }
   private:
-    list expr;
-    shared_ptr< environment > env_p;
+    int n_params;
+    vector< bool > reference_arg, delayed_arg;
+    shared_ptr< scope > scope_p;
+    intrusive_ptr< node > body;
+    value source;
+    closure_layout layout;
   };
 
-  class operator_visitor : public static_visitor< value > {
+  // A call keeps its arguments' source code for macros and for builtins that
+  // quote their arguments; everything else gets them compiled. A call in tail
+  // position leaves lambdas and macro expansions to the innermost run.
+  class call_node : public node {
   public:
-    operator_visitor(list x, shared_ptr< environment > ep) : expr(x), env_p(ep) {}    
-    value operator()(const symbol& sym) const
-    {
-      if (sym == "if") {
-        check(expr.size() == 4, "wrong number of arguments to 'if' (must be 3).");
-        test_visitor visitor;
-        value condition = eval(expr[1], env_p);
-        bool test = apply_visitor(visitor, condition);
-        return eval(test ? expr[2] : expr[3], env_p);
+    call_node(intrusive_ptr< node > f, const vector< value >& args,
+              const vector< value >& source_args, bool t)
+      : func(f), compiled_args(args), raw_args(source_args), tail(t) {}
+    value execute(const shared_ptr< environment >& env_p)
+    {
+      value func_v = func->execute(env_p);
+      switch (func_v.get_type()) {
+      case type::lambda: {
+        lambda* lambda_p = func_v.get_lambda();
+        int n_args = compiled_args.size();
+        if (n_args >= 1 && n_args <= 3 && lambda_p->arity() == n_args)
+          return call_fixed_arity(lambda_p, env_p);
+        const vector< value >& args = lambda_p->quotes_arguments() ? raw_args :
+                                                                      compiled_args;
+        if (tail)
+          return lambda_p->tail_call(args, env_p);
+        return lambda_p->call(args, env_p);
       }
-      else if (sym == "define") {
-        check(expr.size() == 3, "wrong number of arguments to 'define' (must be 2).");
-        apply_visitor(define_visitor(expr, env_p), expr[1]);
+      case type::macro:
+        if (!func_v.identical(expanded_macro)) {
+          expansion = func_v.get_macro()->compiled_expansion(raw_args, env_p);
+          expanded_macro = func_v;
+        }
+        if (tail)
+          return tail_call(expansion, env_p);
+        return run(expansion, env_p);
+      default:
+        check(false, "first element of a list must be a lambda, macro or builtin operator.");
+        return nil();
       }
-      else if (sym == "set!") {
-        check(expr.size() == 3, "wrong number of arguments to 'set!' (must be 2).");
-        apply_visitor(set_visitor(expr, env_p), expr[1]);
+    }
+  private:
+    value call_fixed_arity(lambda* lambda_p, const shared_ptr< environment >& env_p)
+    {
+      if (tail) {
+        value args[3];
+        for (int i = 0; i < compiled_args.size(); ++i)
+          args[i] = eval(compiled_args[i], env_p);
+        return lambda_p->tail_call_values(args, compiled_args.size());
       }
-      else if (sym == "begin") {
-        for (int i = 1; i + 1 < expr.size(); ++i)
-          eval(expr[i], env_p);
-        if (expr.size() > 1)
-          return eval(expr.back(), env_p);
-        else
-          return nil();
+      switch (compiled_args.size()) {
+      case 1:
+        return lambda_p->call1(eval(compiled_args[0], env_p));
+      case 2: {
+        value arg1 = eval(compiled_args[0], env_p);
+        return lambda_p->call2(arg1, eval(compiled_args[1], env_p));
       }
-      else if (sym == "local") {
-        auto local_env_p = nested_environment(env_p);
-        for (int i = 1; i + 1 < expr.size(); ++i)
-          eval(expr[i], local_env_p);
-        if (expr.size() > 1)
-          return eval(expr.back(), local_env_p);
-        else
-          return nil();
+      default: {
+        value arg1 = eval(compiled_args[0], env_p);
+        value arg2 = eval(compiled_args[1], env_p);
+        return lambda_p->call3(arg1, arg2, eval(compiled_args[2], env_p));
       }
-      else if (sym == "lambda") {
-        check(expr.size() == 3, "wrong number of arguments to 'lambda' (must be 2).");
-        vector< symbol > params = apply_visitor(lambda_params_visitor(), expr[1]);
-        return make_shared< lambda >(params, expr[2], env_p);
       }
-      else if (sym == "defmacro") {
-        check(expr.size() == 3, "wrong number of arguments to 'defmacro' (must be 2).");
-        apply_visitor(defmacro_visitor(expr, env_p), expr[1]);
+    }
+    intrusive_ptr< node > func;
+    vector< value > compiled_args, raw_args;
+    bool tail;
+    // the macro this call was last made to, and its expansion
+    value expanded_macro;
+    intrusive_ptr< node > expansion;
+  };
+
+  intrusive_ptr< node > error(const string& error_msg)
+  {
+    return make_object< error_node >(error_msg);
+  }
+
+  // the global environment of the expression being compiled
+  environment* globals_p = nullptr;
+
+  // Gives a slot in a new scope to every variable its body defines, so that
+  // references can be resolved before the definitions run. Definitions inside
+  // arguments of calls count too, which at worst leaves a slot unused.
+  void add_definitions(const value& expr, scope& body_scope)
+  {
+    if (!expr.is(type::list) || expr.get_list().empty())
+      return;
+    const list& lst = expr.get_list();
+    if (lst.front().is_symbol()) {
+      symbol sym = lst.front().get_symbol();
+      if (sym == lambda_sym || sym == local_sym || sym == quote_sym || sym == for_sym ||
+          sym == for_each_sym)
+        return;
+      if ((sym == define_sym || sym == defmacro_sym) && lst.size() == 3) {
+        const value& target = lst[1];
+        if (target.is_symbol())
+          body_scope.add(target.get_symbol());
+        else if (target.is(type::list) && !target.get_list().empty() &&
+                 target.get_list().head().is_symbol())
+          body_scope.add(target.get_list().head().get_symbol());
+        if (sym == define_sym && target.is_symbol())
+          add_definitions(lst[2], body_scope);
+        return;
       }
-      else { // sym must refer to a lambda or macro
-        function_call_visitor visitor(expr, env_p);
-        value func_v = eval(value(sym), env_p);
-        return apply_visitor(visitor, func_v);
+    }
+    for (const value& sub_expr: lst)
+      add_definitions(sub_expr, body_scope);
+  }
+
+  intrusive_ptr< node > compile_lambda(const value& params_v, const value& body,
+                                       scope_chain& scopes)
+  {
+    string error_msg("first argument to 'lambda' must be a list of parameters.");
+    if (!params_v.is(type::list))
+      return error(error_msg);
+    auto scope_p = make_shared< scope >();
+    vector< bool > reference_arg, delayed_arg;
+    for (const value& v: params_v.get_list()) {
+      if (!v.is_symbol())
+        return error("parameter-list in lambda or macro definition must only contain "
+                     "symbols.");
+      const string& name = v.get_symbol().name();
+      reference_arg.push_back(name.front() == '&');
+      delayed_arg.push_back(name.front() == '$');
+      if (name.front() == '&' || name.front() == '$') {
+        if (name.size() == 1)
+          return error(name.front() == '&' ? "unnamed reference argument." :
+                       "unnamed delayed argument.");
+        scope_p->add(symbol(name.substr(1)));
       }
-      return nil();
+      else
+        scope_p->add(v.get_symbol());
     }
-    value operator()(const list& lambda_lst) const
-    {
-      value lam_p = eval(lambda_lst, env_p);
-      return apply_visitor(function_call_visitor(expr, env_p), lam_p);
+    int n_params = reference_arg.size();
+    add_definitions(body, *scope_p);
+    scopes.push_back(scope_p);
+    scan_scope(body, *scope_p, scopes, globals_p);
+    scopes.pop_back();
+    closure_layout layout(body, *scope_p, scopes);
+    scope_chain body_scopes = layout.body_scopes(scopes, scope_p);
+    intrusive_ptr< node > body_node = compile(body, body_scopes, true);
+    return make_object< lambda_node >(n_params, reference_arg, delayed_arg, scope_p,
+                                      body_node, body, layout);
+  }
+
+  int definition_slot(symbol sym, scope_chain& scopes)
+  {
+    return scopes.empty() ? sym.id() : scopes.back()->add(sym);
+  }
+
+  intrusive_ptr< node > compile_define(const list& expr, scope_chain& scopes)
+  {
+    const value& target = expr[1];
+    if (target.is_symbol()) {
+      symbol sym = target.get_symbol();
+      int index = definition_slot(sym, scopes);
+      return make_object< define_node >(sym, index, compile(expr[2], scopes, false));
     }
-    value operator()(const shared_ptr< reference >& ref) const
-    {
-      return operator()(ref->get());
+    if (!target.is(type::list))
+      return error("first argument to 'define' must be a symbol or list.");
+    const list& lst = target.get_list();
+    if (lst.empty())
+      return error("syntax error in 'define'.");
+    if (!lst.head().is_symbol())
+      return error("function name must be a symbol.");
+    symbol sym = lst.head().get_symbol();
+    int index = definition_slot(sym, scopes);
+    return make_object< define_node >(sym, index, compile_lambda(lst.tail(), expr[2], scopes));
+  }
+
+  intrusive_ptr< node > compile_defmacro(const list& expr, scope_chain& scopes)
+  {
+    string error_msg("first argument to 'defmacro' must be a list with the macro's name "
+                     "followed by the parameters' names.");
+    if (!expr[1].is(type::list))
+      return error(error_msg);
+    const list& lst = expr[1].get_list();
+    if (lst.empty())
+      return error("syntax error in 'defmacro'.");
+    if (!lst.head().is_symbol())
+      return error("function name must be a symbol.");
+    vector< symbol > params;
+    for (const value& v: lst.tail()) {
+      if (!v.is_symbol())
+        return error("parameter-list in lambda or macro definition must only contain "
+                     "symbols.");
+      params.push_back(v.get_symbol());
     }
-    template< typename T >
-    value operator()(const T& t) const
-    {
-      check(false, "first element of a list must be a lambda or builtin operator.");
+    symbol sym = lst.head().get_symbol();
+    int index = definition_slot(sym, scopes);
+    return make_object< define_node >(sym, index, make_object< constant_node >(
+                                        make_object< macro >(params, expr[2])));
+  }
+
+  void push_scope(const shared_ptr< scope >& s, const list& expr, int first,
+                  scope_chain& scopes)
+  {
+    for (int i = first; i < expr.size(); ++i)
+      add_definitions(expr[i], *s);
+    scopes.push_back(s);
+    for (int i = first; i < expr.size(); ++i)
+      scan_scope(expr[i], *s, scopes, globals_p);
+  }
+
+  intrusive_ptr< node > compile_sequence(const list& expr, bool nested, scope_chain& scopes,
+                                         bool tail)
+  {
+    shared_ptr< scope > scope_p;
+    if (nested) {
+      scope_p = make_shared< scope >();
+      push_scope(scope_p, expr, 1, scopes);
     }
-  private:
-    list expr;
-    shared_ptr< environment > env_p;
-  };
-  
-  class maybe_reference_visitor : public static_visitor< value > {
-  public:
-    value operator()(const shared_ptr< reference >& ref) const
-    {
-      return ref->get();
+    vector< intrusive_ptr< node > > body;
+    for (int i = 1; i < expr.size(); ++i)
+      body.push_back(compile(expr[i], scopes, tail && i + 1 == expr.size()));
+    if (nested)
+      scopes.pop_back();
+    return make_object< sequence_node >(body, scope_p);
+  }
+
+  value form(initializer_list< value > items)
+  {
+    list lst;
+    for (const value& item: items)
+      lst.push_back(item);
+    return lst;
+  }
+
+  // (for i a b body) is what the library macro expanded to, with <= and inc!
+  // written out and not made an if, which does not depend on what not is:
+  // (local (define i a) (while (if (< b i) false true)
+  //                       (begin body (set! i (+ i 1)))))
+  value for_loop(const list& expr)
+  {
+    const value& var = expr[1];
+    value loop = form({ while_sym,
+                        form({ if_sym, form({ less_than_sym, expr[3], var }), false,
+                               true }),
+                        form({ begin_sym, expr[4],
+                               form({ set_sym, var, form({ plus_sym, var, 1 }) }) }) });
+    return form({ local_sym, form({ define_sym, var, expr[2] }), loop });
+  }
+
+  intrusive_ptr< node > compile_for_each(const list& expr, scope_chain& scopes)
+  {
+    if (!expr[1].is_symbol())
+      return error("first argument to 'for-each' must be a symbol.");
+    auto scope_p = make_shared< scope >();
+    scope_p->add(expr[1].get_symbol());
+    intrusive_ptr< node > lst = compile(expr[2], scopes, false);
+    push_scope(scope_p, expr, 3, scopes);
+    intrusive_ptr< node > body = compile(expr[3], scopes, false);
+    scopes.pop_back();
+    return make_object< for_each_node >(lst, scope_p, body);
+  }
+
+  intrusive_ptr< node > compile_call(intrusive_ptr< node > func, const list& expr,
+                                     scope_chain& scopes, bool tail)
+  {
+    vector< value > source_args(begin(expr) + 1, end(expr));
+    vector< value > args;
+    for (const value& arg: source_args)
+      if (arg.is(type::list) || arg.is_symbol() || arg.is(type::node))
+        args.push_back(compile(arg, scopes, false));
+      else
+        args.push_back(arg);
+    return make_object< call_node >(func, args, source_args, tail);
+  }
+
+  intrusive_ptr< node > compile_special_form(symbol sym, const list& expr,
+                                             scope_chain& scopes, bool tail)
+  {
+    if (sym == if_sym) {
+      if (expr.size() != 4)
+        return error("wrong number of arguments to 'if' (must be 3).");
+      return make_object< if_node >(compile(expr[1], scopes, false),
+                                    compile(expr[2], scopes, tail),
+                                    compile(expr[3], scopes, tail));
     }
-    template< typename T >
-    value operator()(const T& t) const
-    {
-      return t;
+    else if (sym == define_sym) {
+      if (expr.size() != 3)
+        return error("wrong number of arguments to 'define' (must be 2).");
+      return compile_define(expr, scopes);
     }
-  };
+    else if (sym == set_sym) {
+      if (expr.size() != 3)
+        return error("wrong number of arguments to 'set!' (must be 2).");
+      if (!expr[1].is_symbol())
+        return error("first argument to 'set!' must be a symbol.");
+      symbol var = expr[1].get_symbol();
+      mark_assigned(var);
+      return make_object< set_node >(var, resolve(var, scopes),
+                                     compile(expr[2], scopes, false));
+    }
+    else if (sym == begin_sym)
+      return compile_sequence(expr, false, scopes, tail);
+    else if (sym == local_sym)
+      return compile_sequence(expr, true, scopes, tail);
+    else if (sym == lambda_sym) {
+      if (expr.size() != 3)
+        return error("wrong number of arguments to 'lambda' (must be 2).");
+      return compile_lambda(expr[1], expr[2], scopes);
+    }
+    else if (sym == defmacro_sym) {
+      if (expr.size() != 3)
+        return error("wrong number of arguments to 'defmacro' (must be 2).");
+      return compile_defmacro(expr, scopes);
+    }
+    else if (sym == while_sym) {
+      if (expr.size() != 3)
+        return error("wrong number of arguments to 'while' (must be 2).");
+      return make_object< while_node >(compile(expr[1], scopes, false),
+                                       compile(expr[2], scopes, false));
+    }
+    else if (sym == for_sym) {
+      if (expr.size() != 5)
+        return error("wrong number of arguments to 'for' (must be 4).");
+      return compile(for_loop(expr), scopes, tail);
+    }
+    else if (sym == for_each_sym) {
+      if (expr.size() != 4)
+        return error("wrong number of arguments to 'for-each' (must be 3).");
+      return compile_for_each(expr, scopes);
+    }
+    else { // and, or
+      if (expr.size() != 3)
+        return error("wrong number of arguments to '" + sym.name() + "' (must be 2).");
+      intrusive_ptr< node > first = compile(expr[1], scopes, false);
+      intrusive_ptr< node > second = compile(expr[2], scopes, tail);
+      if (sym == and_sym)
+        return make_object< if_node >(first, second, make_constant(false));
+      return make_object< if_node >(first, make_constant(true), second);
+    }
+  }
 
-  class eval_visitor : public static_visitor< value > {
-  public:
-    eval_visitor(shared_ptr< environment > ep) : env_p(ep) {}
-    value operator()(const symbol& sym) const
-    {
-      check(env_p->find(sym), "symbol '" + sym + "' not found.");
-      value val = env_p->get(sym);
-      return apply_visitor(maybe_reference_visitor(), val);
+  // (not e) as an if, which falls back to the call once not is assigned
+  intrusive_ptr< node > compile_not(const list& expr, scope_chain& scopes, bool tail)
+  {
+    intrusive_ptr< node > arg = compile(expr[1], scopes, false);
+    intrusive_ptr< node > call = make_object< call_node >(compile(not_sym, scopes, false),
+                                                          vector< value >(1, arg),
+                                                          vector< value >(1, expr[1]),
+                                                          tail);
+    return make_object< guarded_node >(vector< symbol >(1, not_sym),
+                                       make_object< if_node >(arg, make_constant(false),
+                                                              make_constant(true)),
+                                       call);
+  }
+
+  intrusive_ptr< node > compile_list(const list& expr, scope_chain& scopes, bool tail)
+  {
+    if (expr.empty())
+      return error("attempting to evaluate an empty list.");
+    const value& op = expr.front();
+    switch (op.get_type()) {
+    case type::symbol:
+      if (is_special_form(op.get_symbol()))
+        return compile_special_form(op.get_symbol(), expr, scopes, tail);
+      if (inlines_not(expr, scopes))
+        return compile_not(expr, scopes, tail);
+      // the symbol must refer to a lambda or macro
+      return compile_call(compile(op, scopes, false), expr, scopes, tail);
+    case type::list:
+    case type::reference:
+    case type::node:
+      return compile_call(compile(op, scopes, false), expr, scopes, tail);
+    default:
+      return error("first element of a list must be a lambda or builtin operator.");
     }
-    value operator()(const list& lst) const
-    {
-      return apply_visitor(operator_visitor(lst, env_p), lst.front());
+  }
+
+  intrusive_ptr< node > compile_tree(const value& expr, scope_chain& scopes, bool tail)
+  {
+    switch (expr.get_type()) {
+    case type::symbol: {
+      symbol sym = expr.get_symbol();
+      vector< location > locations = resolve(sym, scopes);
+      if (locations.size() == 1)
+        return make_object< global_variable_node >(sym, locations);
+      return make_object< variable_node >(sym, locations);
     }
-    value operator()(const shared_ptr< reference >& ref) const
-    {
-      return ref->get();
+    case type::list:
+      return compile_list(expr.get_list(), scopes, tail);
+    case type::reference:
+      return make_object< reference_node >(expr);
+    case type::node:
+      if (optimized_form* form_p = dynamic_cast< optimized_form* >(expr.get_object()))
+        return form_p->compile(scopes, tail);
+      return static_cast< node* >(expr.get_object());
+    default:
+      return make_object< constant_node >(expr);
     }
-    template< typename T >
-    value operator()(const T& t) const
-    {
-      return t;
-    }    
-  private:
-    shared_ptr< environment > env_p;
-  };
-  
-  value eval(value expr, shared_ptr< environment > env_p)
+  }
+
+  // Compiling an expression in tail position makes the calls that produce its
+  // value tail calls, so it must be executed by run.
+  intrusive_ptr< node > compile(const value& expr, scope_chain& scopes, bool tail)
   {
-    return apply_visitor(eval_visitor(env_p), expr);
+    if (vm_enabled() && expr.is(type::list)) {
+      intrusive_ptr< node > code = compile_bytecode(expr.get_list(), scopes, tail);
+      if (code)
+        return code;
+    }
+    return compile_tree(expr, scopes, tail);
+  }
+
+  intrusive_ptr< node > compile(const value& expr, const shared_ptr< environment >& env_p,
+                                bool tail)
+  {
+    scope_chain scopes;
+    environment* frame_p = env_p.get();
+    for (; frame_p->outer(); frame_p = frame_p->outer())
+      scopes.insert(scopes.begin(), frame_p->get_scope());
+    globals_p = frame_p;
+    return compile(optimize(expr, scopes, frame_p), scopes, tail);
+  }
+
+  intrusive_ptr< node > make_constant(const value& val)
+  {
+    return make_object< constant_node >(val);
+  }
+
+  value eval(const value& expr, const shared_ptr< environment >& env_p)
+  {
+    switch (expr.get_type()) {
+    case type::symbol: {
+      symbol sym = expr.get_symbol();
+      check(env_p->find(sym), "symbol '", sym.name(), "' not found.");
+      value val = env_p->get(sym);
+      if (val.is(type::reference))
+        return val.get_reference()->get();
+      return val;
+    }
+    case type::list:
+      return run(compile(expr, env_p, true), env_p);
+    case type::reference:
+      return expr.get_reference()->get();
+    case type::node:
+      return static_cast< node* >(expr.get_object())->execute(env_p);
+    default:
+      return expr;
+    }
   }
 
 } // namespace lime
@@ -6,48 +6,40 @@
 
 namespace lime {
   // STL
-  using std::unordered_map;  
+  using std::unordered_map;
 
   // lime
   using lime::symbol_hash;
 
-  class expand_visitor : public static_visitor< value > {
-  public:
-    expand_visitor(vector< symbol > params, vector< value > args)
-    {
-      for (int i = 0; i < params.size(); ++i)
-        substitutions[params[i]] = args[i];
-    }
-    expand_visitor(unordered_map< symbol, value, symbol_hash > sub)
-      : substitutions(sub) {}
-    value operator()(const symbol& sym)
-    {
-      if (substitutions.find(sym) != substitutions.end())
-        return substitutions[sym];
-      return sym;
+  typedef unordered_map< symbol, value, symbol_hash > substitution_map;
+
+  value substitute(const value& expr, const substitution_map& substitutions)
+  {
+    switch (expr.get_type()) {
+    case type::symbol: {
+      auto it = substitutions.find(expr.get_symbol());
+      if (it != substitutions.end())
+        return it->second;
+      return expr;
     }
-    value operator()(const list& lst) const
-    {
+    case type::list: {
       list new_lst;
-      for (value expr: lst) {
-        auto visitor = expand_visitor(substitutions);
-        value new_expr(apply_visitor(visitor, expr));
-        new_lst.push_back(new_expr);
-      }
+      for (const value& sub_expr: expr.get_list())
+        new_lst.push_back(substitute(sub_expr, substitutions));
       return new_lst;
     }
-    template< typename T>
-    value operator()(const T& t) const
-    {
-      return t;
+    default:
+      return expr;
     }
-  private:
-    unordered_map< symbol, value, symbol_hash > substitutions;
-  };
+  }
 
-  value expand(value expr, vector< symbol > params, vector< value > args)
+  value expand(const value& expr, const vector< symbol >& params,
+               const vector< value >& args)
   {
-    return apply_visitor(expand_visitor(params, args), expr);
+    substitution_map substitutions;
+    for (int i = 0; i < params.size(); ++i)
+      substitutions[params[i]] = args[i];
+    return substitute(expr, substitutions);
   }
 
 } // namespace lime
@@ -0,0 +1,445 @@
+// lime headers
+#include <builtins.hpp>
+#include <eval.hpp>
+#include <hamt.hpp>
+#include <hash_table.hpp>
+#include <interpreter.hpp>
+
+namespace lime {
+  // lime
+  using lime::apply_function;
+  using lime::call_binary;
+  using lime::call_modify_variable;
+  using lime::call_set_element;
+  using lime::check;
+  using lime::eval;
+  using lime::hash_value;
+  using lime::keys_equal;
+  using lime::make_object;
+  using lime::nil;
+
+  typedef intrusive_ptr< hamt_node > node_ptr;
+
+  // each level of the trie consumes this many bits of the hash
+  const int bits_per_level = 5;
+  const int hash_bits = 8 * sizeof(size_t);
+
+  class map_entry {
+  public:
+    size_t hash;
+    value key;
+    value val;
+  };
+
+  // An inner node keeps its entries and its children in two arrays, indexed
+  // by the population count of two bitmaps (CHAMP layout). Below the last
+  // level, where the hashes are exhausted, a node is a plain list of entries
+  // with colliding hashes. A subtrie always holds at least two entries, which
+  // makes the layout of a trie depend only on its contents.
+  class hamt_node {
+  public:
+    hamt_node() : ref_count(0), datamap(0), nodemap(0) {}
+    hamt_node(const hamt_node& other)
+      : ref_count(0), datamap(other.datamap), nodemap(other.nodemap),
+        entries(other.entries), children(other.children) {}
+    long ref_count;
+    uint32_t datamap;
+    uint32_t nodemap;
+    vector< map_entry > entries;
+    vector< node_ptr > children;
+  };
+
+  void intrusive_ptr_add_ref(hamt_node* node_p)
+  {
+    ++node_p->ref_count;
+  }
+
+  void intrusive_ptr_release(hamt_node* node_p)
+  {
+    if (--node_p->ref_count == 0)
+      delete node_p;
+  }
+
+  uint32_t hash_bit(size_t hash, int shift)
+  {
+    return uint32_t(1) << ((hash >> shift) & 31);
+  }
+
+  int bitmap_index(uint32_t bitmap, uint32_t bit)
+  {
+    return __builtin_popcount(bitmap & (bit - 1));
+  }
+
+  // the node, copied first if another trie shares it
+  hamt_node& editable(node_ptr& node_p)
+  {
+    if (node_p->ref_count > 1)
+      node_p = new hamt_node(*node_p);
+    return *node_p;
+  }
+
+  const value* find_entry(const hamt_node* node_p, const value& key, size_t hash)
+  {
+    for (int shift = 0; shift < hash_bits; shift += bits_per_level) {
+      uint32_t bit = hash_bit(hash, shift);
+      if (node_p->datamap & bit) {
+        const map_entry& e = node_p->entries[bitmap_index(node_p->datamap, bit)];
+        return e.hash == hash && keys_equal(e.key, key) ? &e.val : nullptr;
+      }
+      if (!(node_p->nodemap & bit))
+        return nullptr;
+      node_p = node_p->children[bitmap_index(node_p->nodemap, bit)].get();
+    }
+    for (const map_entry& e: node_p->entries)
+      if (e.hash == hash && keys_equal(e.key, key))
+        return &e.val;
+    return nullptr;
+  }
+
+  // a subtrie holding two entries with different keys
+  node_ptr make_subtrie(const map_entry& a, const map_entry& b, int shift)
+  {
+    node_ptr node_p(new hamt_node);
+    if (shift >= hash_bits) {
+      node_p->entries.push_back(a);
+      node_p->entries.push_back(b);
+      return node_p;
+    }
+    uint32_t a_bit = hash_bit(a.hash, shift), b_bit = hash_bit(b.hash, shift);
+    if (a_bit == b_bit) {
+      node_p->nodemap = a_bit;
+      node_p->children.push_back(make_subtrie(a, b, shift + bits_per_level));
+    }
+    else {
+      node_p->datamap = a_bit | b_bit;
+      node_p->entries.push_back(a_bit < b_bit ? a : b);
+      node_p->entries.push_back(a_bit < b_bit ? b : a);
+    }
+    return node_p;
+  }
+
+  // returns false if the entry replaced one with the same key
+  bool insert_entry(node_ptr& node_p, const map_entry& entry, int shift)
+  {
+    hamt_node& node = editable(node_p);
+    if (shift >= hash_bits) {
+      for (map_entry& e: node.entries)
+        if (e.hash == entry.hash && keys_equal(e.key, entry.key)) {
+          e.val = entry.val;
+          return false;
+        }
+      node.entries.push_back(entry);
+      return true;
+    }
+    uint32_t bit = hash_bit(entry.hash, shift);
+    if (node.datamap & bit) {
+      int i = bitmap_index(node.datamap, bit);
+      map_entry& e = node.entries[i];
+      if (e.hash == entry.hash && keys_equal(e.key, entry.key)) {
+        e.val = entry.val;
+        return false;
+      }
+      node_ptr child_p = make_subtrie(e, entry, shift + bits_per_level);
+      node.entries.erase(node.entries.begin() + i);
+      node.datamap ^= bit;
+      node.nodemap |= bit;
+      node.children.insert(node.children.begin() + bitmap_index(node.nodemap, bit),
+                           child_p);
+      return true;
+    }
+    if (node.nodemap & bit)
+      return insert_entry(node.children[bitmap_index(node.nodemap, bit)], entry,
+                          shift + bits_per_level);
+    node.datamap |= bit;
+    node.entries.insert(node.entries.begin() + bitmap_index(node.datamap, bit), entry);
+    return true;
+  }
+
+  // the key must be present
+  void erase_entry(node_ptr& node_p, const value& key, size_t hash, int shift)
+  {
+    hamt_node& node = editable(node_p);
+    if (shift >= hash_bits) {
+      for (int i = 0; i < node.entries.size(); ++i)
+        if (node.entries[i].hash == hash && keys_equal(node.entries[i].key, key)) {
+          node.entries.erase(node.entries.begin() + i);
+          return;
+        }
+      return;
+    }
+    uint32_t bit = hash_bit(hash, shift);
+    if (node.datamap & bit) {
+      node.entries.erase(node.entries.begin() + bitmap_index(node.datamap, bit));
+      node.datamap ^= bit;
+      return;
+    }
+    int i = bitmap_index(node.nodemap, bit);
+    node_ptr& child_p = node.children[i];
+    erase_entry(child_p, key, hash, shift + bits_per_level);
+    if (child_p->children.empty() && child_p->entries.size() == 1) {
+      // a subtrie left with a single entry is replaced by the entry itself
+      map_entry last = child_p->entries.front();
+      node.children.erase(node.children.begin() + i);
+      node.nodemap ^= bit;
+      node.datamap |= bit;
+      node.entries.insert(node.entries.begin() + bitmap_index(node.datamap, bit), last);
+    }
+  }
+
+  void for_each_entry(const hamt_node* node_p,
+                      const function< void(const value&, const value&) >& f)
+  {
+    for (const map_entry& e: node_p->entries)
+      f(e.key, e.val);
+    for (const node_ptr& child_p: node_p->children)
+      for_each_entry(child_p.get(), f);
+  }
+
+  persistent_map::persistent_map()
+    : object(type::map), root(new hamt_node), count(0) {}
+
+  persistent_map::persistent_map(const persistent_map& other)
+    : object(type::map), root(other.root), count(other.count) {}
+
+  long persistent_map::size() const
+  {
+    return count;
+  }
+
+  const value* persistent_map::find(const value& key) const
+  {
+    return find_entry(root.get(), key, hash_value(key));
+  }
+
+  void persistent_map::set(const value& key, const value& val)
+  {
+    map_entry entry = { hash_value(key), key, val };
+    if (insert_entry(root, entry, 0))
+      ++count;
+  }
+
+  bool persistent_map::remove(const value& key)
+  {
+    size_t hash = hash_value(key);
+    if (!find_entry(root.get(), key, hash))
+      return false;
+    erase_entry(root, key, hash, 0);
+    --count;
+    return true;
+  }
+
+  void persistent_map::for_each(const function< void(const value&, const value&) >& f) const
+  {
+    for_each_entry(root.get(), f);
+  }
+
+  bool maps_equal(const persistent_map& a, const persistent_map& b)
+  {
+    if (a.size() != b.size())
+      return false;
+    bool equal = true;
+    a.for_each([&](const value& k, const value& v) {
+        const value* other_p = b.find(k);
+        if (!other_p || !keys_equal(v, *other_p))
+          equal = false;
+      });
+    return equal;
+  }
+
+  const persistent_map& get_map(const value& val)
+  {
+    return *static_cast< persistent_map* >(val.get_object());
+  }
+
+  // the map in a variable, unshared so it can be modified in place
+  persistent_map& get_mutable_map(value& var)
+  {
+    if (var.get_object()->ref_count > 1)
+      var = make_object< persistent_map >(get_map(var));
+    return *static_cast< persistent_map* >(var.get_object());
+  }
+
+  value make_map::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() % 2 == 0,
+          "arguments to 'hash-map' must be alternating keys and values.");
+    auto map_p = make_object< persistent_map >();
+    for (int i = 0; i < args.size(); i += 2) {
+      value key = eval(args[i], caller_env_p);
+      map_p->set(key, eval(args[i + 1], caller_env_p));
+    }
+    return map_p;
+  }
+
+  value map_assoc::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 3, "wrong number of arguments to 'assoc' (must be 3).");
+    value m = eval(args[0], caller_env_p);
+    check(m.is(type::map), "first argument to 'assoc' must be a map.");
+    value key = eval(args[1], caller_env_p);
+    value val = eval(args[2], caller_env_p);
+    return call3(m, key, val);
+  }
+
+  value map_assoc::call3(const value& m, const value& key, const value& val)
+  {
+    check(m.is(type::map), "first argument to 'assoc' must be a map.");
+    auto map_p = make_object< persistent_map >(get_map(m));
+    map_p->set(key, val);
+    return map_p;
+  }
+
+  value dissociate(const value& m, const value& key)
+  {
+    check(m.is(type::map), "first argument to 'dissoc' must be a map.");
+    if (!get_map(m).find(key))
+      return m;
+    auto map_p = make_object< persistent_map >(get_map(m));
+    map_p->remove(key);
+    return map_p;
+  }
+
+  map_dissoc::map_dissoc() : binary_builtin(dissociate, "dissoc") {}
+
+  void assoc_variable(value& var, const value& key, const value& val)
+  {
+    check(var.is(type::map),
+          "arguments to 'assoc!' must be a reference to a map, a key, and a value.");
+    get_mutable_map(var).set(key, val);
+  }
+
+  value map_assoc_in_place::call(const vector< value >& args,
+                                 const shared_ptr< environment >& caller_env_p)
+  {
+    return call_set_element(assoc_variable, "assoc!", args, caller_env_p);
+  }
+
+  void dissoc_variable(value& var, const value& key)
+  {
+    check(var.is(type::map),
+          "arguments to 'dissoc!' must be a reference to a map and a key.");
+    if (get_map(var).find(key))
+      get_mutable_map(var).remove(key);
+  }
+
+  value map_dissoc_in_place::call(const vector< value >& args,
+                                  const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(dissoc_variable, "dissoc!", args, caller_env_p);
+  }
+
+  value map_lookup(const value& m, const value& key)
+  {
+    check(m.is(type::map), "first argument to 'get' must be a map.");
+    const value* val_p = get_map(m).find(key);
+    check(val_p, "key not found in map.");
+    return *val_p;
+  }
+
+  map_get::map_get() : binary_builtin(map_lookup, "get") {}
+
+  value map_contains_key(const value& m, const value& key)
+  {
+    check(m.is(type::map), "first argument to 'contains-key?' must be a map.");
+    return get_map(m).find(key) != nullptr;
+  }
+
+  map_contains::map_contains() : binary_builtin(map_contains_key, "contains-key?") {}
+
+  value merge_maps(const value& a, const value& b)
+  {
+    check(a.is(type::map) && b.is(type::map), "arguments to 'merge' must be maps.");
+    if (get_map(a).size() < get_map(b).size()) {
+      // insert the smaller map into the larger one, without overriding b
+      auto map_p = make_object< persistent_map >(get_map(b));
+      get_map(a).for_each([&](const value& k, const value& v) {
+          if (!map_p->find(k))
+            map_p->set(k, v);
+        });
+      return map_p;
+    }
+    auto map_p = make_object< persistent_map >(get_map(a));
+    get_map(b).for_each([&](const value& k, const value& v) { map_p->set(k, v); });
+    return map_p;
+  }
+
+  map_merge::map_merge() : binary_builtin(merge_maps, "merge") {}
+
+  value map_fold::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 3, "wrong number of arguments to 'fold-map' (must be 3).");
+    value f = eval(args[0], caller_env_p);
+    value acc = eval(args[1], caller_env_p);
+    value m = eval(args[2], caller_env_p);
+    check(m.is(type::map), "third argument to 'fold-map' must be a map.");
+    get_map(m).for_each([&](const value& k, const value& v) {
+        acc = apply_function(f, { acc, k, v });
+      });
+    return acc;
+  }
+
+  const persistent_map& map_argument(const vector< value >& args, const char* name,
+                                     const shared_ptr< environment >& caller_env_p,
+                                     value& arg)
+  {
+    check(args.size() == 1, "wrong number of arguments to '", name, "' (must be 1).");
+    arg = eval(args.front(), caller_env_p);
+    check(arg.is(type::map), "argument to '", name, "' must be a map.");
+    return get_map(arg);
+  }
+
+  value map_keys::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    value arg;
+    list keys;
+    map_argument(args, "map-keys", caller_env_p, arg)
+      .for_each([&keys](const value& k, const value& v) { keys.push_back(k); });
+    return keys;
+  }
+
+  value map_values::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    value arg;
+    list vals;
+    map_argument(args, "map-values", caller_env_p, arg)
+      .for_each([&vals](const value& k, const value& v) { vals.push_back(v); });
+    return vals;
+  }
+
+  value map_to_list::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    value arg;
+    list entries;
+    map_argument(args, "map->list", caller_env_p, arg)
+      .for_each([&entries](const value& k, const value& v) {
+          list entry;
+          entry.push_back(k);
+          entry.push_back(v);
+          entries.push_back(entry);
+        });
+    return entries;
+  }
+
+  void add_map_builtins(const shared_ptr< environment >& env_p)
+  {
+    env_p->set("hash-map", make_object< make_map >());
+    env_p->set("assoc", make_object< map_assoc >());
+    env_p->set("dissoc", make_object< map_dissoc >());
+    env_p->set("assoc!", make_object< map_assoc_in_place >());
+    env_p->set("dissoc!", make_object< map_dissoc_in_place >());
+    env_p->set("get", make_object< map_get >());
+    env_p->set("contains-key?", make_object< map_contains >());
+    env_p->set("merge", make_object< map_merge >());
+    env_p->set("fold-map", make_object< map_fold >());
+    env_p->set("map-keys", make_object< map_keys >());
+    env_p->set("map-values", make_object< map_values >());
+    env_p->set("map->list", make_object< map_to_list >());
+  }
+
+} // namespace lime
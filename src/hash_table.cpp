@@ -0,0 +1,390 @@
+// C headers
+#include <cmath>
+#include <cstring>
+
+// STL headers
+#include <functional>
+
+// lime headers
+#include <bignum.hpp>
+#include <builtins.hpp>
+#include <eval.hpp>
+#include <hamt.hpp>
+#include <hash_table.hpp>
+#include <interpreter.hpp>
+#include <real.hpp>
+#include <vectors.hpp>
+
+namespace lime {
+  // STL
+  using std::hash;
+  using std::isfinite;
+  using std::trunc;
+
+  // lime
+  using lime::call_binary;
+  using lime::call_modify_variable;
+  using lime::call_set_element;
+  using lime::check;
+  using lime::eval;
+  using lime::get_vector;
+  using lime::make_object;
+  using lime::nil;
+
+  const size_t min_capacity = 8;
+
+  // the finalizer of splitmix64, to spread out integers and ids
+  size_t mix(uint64_t x)
+  {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+  size_t hash_combine(size_t seed, size_t h)
+  {
+    return seed ^ (h + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+  }
+
+  // whether a float is a whole number, which as a key is the integer it equals
+  bool is_integral(double d)
+  {
+    return isfinite(d) && d == trunc(d);
+  }
+
+  size_t hash_value(const value& val)
+  {
+    switch (val.get_type()) {
+    case type::nil:
+      return mix(1);
+    case type::boolean:
+      return mix(val.get_bool() ? 2 : 3);
+    case type::integer:
+      return mix(val.get_int());
+    case type::bignum: {
+      const bignum* big = static_cast< const bignum* >(val.get_object());
+      size_t h = mix(big->negative ? 5 : 4);
+      for (uint32_t digit: big->digits)
+        h = hash_combine(h, mix(digit));
+      return h;
+    }
+    case type::real: {
+      double d = get_real(val);
+      if (is_integral(d))   // -0.0 included
+        return hash_value(integer_from_double(d));
+      uint64_t bits;
+      memcpy(&bits, &d, sizeof(bits));
+      return mix(bits ^ 11);
+    }
+    case type::symbol:
+      return mix(uint64_t(val.get_symbol().id()) << 32 | 6);
+    case type::string:
+      return hash< string >()(val.get_string());
+    case type::list: {
+      size_t h = mix(7);
+      for (const value& item: val.get_list())
+        h = hash_combine(h, hash_value(item));
+      return h;
+    }
+    case type::vector: {
+      size_t h = mix(8);
+      for (const value& item: get_vector(val))
+        h = hash_combine(h, hash_value(item));
+      return h;
+    }
+    case type::hash_table: {
+      // independent of the order of the entries
+      size_t h = mix(9);
+      get_hash_table(val).for_each([&h](const value& k, const value& v) {
+          h += hash_combine(hash_value(k), hash_value(v));
+        });
+      return h;
+    }
+    case type::map: {
+      size_t h = mix(10);
+      get_map(val).for_each([&h](const value& k, const value& v) {
+          h += hash_combine(hash_value(k), hash_value(v));
+        });
+      return h;
+    }
+    default:
+      return mix(reinterpret_cast< uintptr_t >(val.get_object()));
+    }
+  }
+
+  template< typename Sequence >
+  bool sequences_equal(const Sequence& a, const Sequence& b)
+  {
+    if (a.size() != b.size())
+      return false;
+    for (int i = 0; i < a.size(); ++i)
+      if (!keys_equal(a[i], b[i]))
+        return false;
+    return true;
+  }
+
+  bool keys_equal(const value& a, const value& b)
+  {
+    if (a.identical(b))
+      return true;
+    type t = a.get_type();
+    if (t == type::real && is_integer(b))
+      return is_integral(get_real(a)) &&
+        integer_compare(integer_from_double(get_real(a)), b) == 0;
+    if (is_integer(a) && b.is(type::real))
+      return keys_equal(b, a);
+    if (t != b.get_type())
+      return false;
+    switch (t) {
+    case type::bignum:
+      return integer_compare(a, b) == 0;
+    case type::real:
+      return get_real(a) == get_real(b);
+    case type::string:
+      return a.get_string() == b.get_string();
+    case type::list:
+      return sequences_equal(a.get_list(), b.get_list());
+    case type::vector:
+      return sequences_equal(get_vector(a), get_vector(b));
+    case type::hash_table:
+      return hash_tables_equal(get_hash_table(a), get_hash_table(b));
+    case type::map:
+      return maps_equal(get_map(a), get_map(b));
+    default:
+      return false;
+    }
+  }
+
+  hash_table::hash_table()
+    : object(type::hash_table), slots(min_capacity), count(0), used(0) {}
+
+  hash_table::hash_table(const hash_table& other)
+    : object(type::hash_table), slots(other.slots), count(other.count),
+      used(other.used) {}
+
+  long hash_table::size() const
+  {
+    return count;
+  }
+
+  // the slot holding key, or -1 - the slot where it should be inserted
+  long hash_table::find_slot(const value& key, size_t hash) const
+  {
+    size_t mask = slots.size() - 1;
+    long insert_at = -1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const slot& s = slots[i];
+      if (s.state == slot::empty)
+        return -1 - (insert_at >= 0 ? insert_at : long(i));
+      if (s.state == slot::deleted) {
+        if (insert_at < 0)
+          insert_at = i;
+      }
+      else if (s.hash == hash && keys_equal(s.key, key))
+        return i;
+    }
+  }
+
+  const value* hash_table::find(const value& key) const
+  {
+    long i = find_slot(key, hash_value(key));
+    return i >= 0 ? &slots[i].val : nullptr;
+  }
+
+  void hash_table::set(const value& key, const value& val)
+  {
+    size_t hash = hash_value(key);
+    long i = find_slot(key, hash);
+    if (i >= 0) {
+      slots[i].val = val;
+      return;
+    }
+    // keep at most 3/4 of the slots non-empty, so that probing terminates early
+    if (4 * (used + 1) > 3 * long(slots.size())) {
+      rehash(4 * (count + 1) > long(slots.size()) ? 2 * slots.size() : slots.size());
+      i = find_slot(key, hash);
+    }
+    slot& s = slots[-1 - i];
+    if (s.state == slot::empty)
+      ++used;
+    s.state = slot::full;
+    s.hash = hash;
+    s.key = key;
+    s.val = val;
+    ++count;
+  }
+
+  bool hash_table::remove(const value& key)
+  {
+    long i = find_slot(key, hash_value(key));
+    if (i < 0)
+      return false;
+    slots[i].state = slot::deleted;
+    slots[i].key = nil();
+    slots[i].val = nil();
+    --count;
+    return true;
+  }
+
+  void hash_table::rehash(size_t capacity)
+  {
+    vector< slot > old_slots(capacity);
+    old_slots.swap(slots);
+    size_t mask = capacity - 1;
+    for (slot& old: old_slots)
+      if (old.state == slot::full) {
+        size_t i = old.hash & mask;
+        while (slots[i].state != slot::empty)
+          i = (i + 1) & mask;
+        slots[i] = old;
+      }
+    used = count;
+  }
+
+  bool hash_tables_equal(const hash_table& a, const hash_table& b)
+  {
+    if (a.size() != b.size())
+      return false;
+    bool equal = true;
+    a.for_each([&](const value& k, const value& v) {
+        const value* other_p = b.find(k);
+        if (!other_p || !keys_equal(v, *other_p))
+          equal = false;
+      });
+    return equal;
+  }
+
+  const hash_table& get_hash_table(const value& val)
+  {
+    return *static_cast< hash_table* >(val.get_object());
+  }
+
+  hash_table& get_mutable_hash_table(value& var)
+  {
+    if (var.get_object()->ref_count > 1)
+      var = make_object< hash_table >(get_hash_table(var));
+    return *static_cast< hash_table* >(var.get_object());
+  }
+
+  value make_hash_table::call(const vector< value >& args,
+                              const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() % 2 == 0,
+          "arguments to 'hash-table' must be alternating keys and values.");
+    auto table_p = make_object< hash_table >();
+    for (int i = 0; i < args.size(); i += 2) {
+      value key = eval(args[i], caller_env_p);
+      table_p->set(key, eval(args[i + 1], caller_env_p));
+    }
+    return table_p;
+  }
+
+  value table_lookup(const value& table, const value& key)
+  {
+    check(table.is(type::hash_table),
+          "first argument to 'hash-ref' must be a hash table.");
+    const value* val_p = get_hash_table(table).find(key);
+    check(val_p, "key not found in hash table.");
+    return *val_p;
+  }
+
+  hash_ref::hash_ref() : binary_builtin(table_lookup, "hash-ref") {}
+
+  value table_contains(const value& table, const value& key)
+  {
+    check(table.is(type::hash_table),
+          "first argument to 'hash-contains?' must be a hash table.");
+    return get_hash_table(table).find(key) != nullptr;
+  }
+
+  hash_contains::hash_contains() : binary_builtin(table_contains, "hash-contains?") {}
+
+  void table_set(value& var, const value& key, const value& val)
+  {
+    check(var.is(type::hash_table),
+          "arguments to 'hash-set!' must be a reference to a hash table, a key, "
+          "and a value.");
+    get_mutable_hash_table(var).set(key, val);
+  }
+
+  value hash_set::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    return call_set_element(table_set, "hash-set!", args, caller_env_p);
+  }
+
+  void table_remove(value& var, const value& key)
+  {
+    check(var.is(type::hash_table),
+          "arguments to 'hash-remove!' must be a reference to a hash table and a key.");
+    if (get_hash_table(var).find(key))
+      get_mutable_hash_table(var).remove(key);
+  }
+
+  value hash_remove::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(table_remove, "hash-remove!", args, caller_env_p);
+  }
+
+  const hash_table& table_argument(const vector< value >& args, const char* name,
+                                   const shared_ptr< environment >& caller_env_p,
+                                   value& arg)
+  {
+    check(args.size() == 1, "wrong number of arguments to '", name, "' (must be 1).");
+    arg = eval(args.front(), caller_env_p);
+    check(arg.is(type::hash_table), "argument to '", name, "' must be a hash table.");
+    return get_hash_table(arg);
+  }
+
+  value hash_keys::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    value arg;
+    list keys;
+    table_argument(args, "hash-keys", caller_env_p, arg)
+      .for_each([&keys](const value& k, const value& v) { keys.push_back(k); });
+    return keys;
+  }
+
+  value hash_values::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    value arg;
+    list vals;
+    table_argument(args, "hash-values", caller_env_p, arg)
+      .for_each([&vals](const value& k, const value& v) { vals.push_back(v); });
+    return vals;
+  }
+
+  value hash_to_list::call(const vector< value >& args,
+                           const shared_ptr< environment >& caller_env_p)
+  {
+    value arg;
+    list entries;
+    table_argument(args, "hash->list", caller_env_p, arg)
+      .for_each([&entries](const value& k, const value& v) {
+          list entry;
+          entry.push_back(k);
+          entry.push_back(v);
+          entries.push_back(entry);
+        });
+    return entries;
+  }
+
+  void add_hash_table_builtins(const shared_ptr< environment >& env_p)
+  {
+    env_p->set("hash-table", make_object< make_hash_table >());
+    env_p->set("hash-ref", make_object< hash_ref >());
+    env_p->set("hash-contains?", make_object< hash_contains >());
+    env_p->set("hash-set!", make_object< hash_set >());
+    env_p->set("hash-remove!", make_object< hash_remove >());
+    env_p->set("hash-keys", make_object< hash_keys >());
+    env_p->set("hash-values", make_object< hash_values >());
+    env_p->set("hash->list", make_object< hash_to_list >());
+  }
+
+} // namespace lime
@@ -21,10 +21,6 @@ namespace lime {
   using std::ifstream;
   using std::istreambuf_iterator;
 
-  // Boost
-  using boost::apply_visitor;
-  using boost::static_visitor;
-
   // lime
   using lime::eval;
   using lime::indent;
@@ -42,10 +38,10 @@ namespace lime {
     }
   }
 
-  void load_file(const string& path, shared_ptr< environment > env_p)
+  void load_file(const string& path, const shared_ptr< environment >& env_p)
   {
     ifstream source_file(path);
-    check(source_file, "could not open source file '" + path + "'.");
+    check(source_file.is_open(), "could not open source file '", path, "'.");
     string code((istreambuf_iterator< char >(source_file)),
                 istreambuf_iterator< char >());
     source_file.close();
@@ -54,7 +50,7 @@ namespace lime {
       eval(parse(part), env_p);
   }
 
-  void load_stdlib(shared_ptr< environment > env_p)
+  void load_stdlib(const shared_ptr< environment >& env_p)
   {
     string interpreter_path = getenv("_");
     string bin_path = interpreter_path.substr(0, interpreter_path.length() - 4);
@@ -63,18 +59,7 @@ namespace lime {
       load_file(lib_path + filename, env_p);
   }
 
-  class return_value_visitor : public static_visitor<> {
-  public:
-    void operator()(const nil& n) const {}
-    template< typename T >
-    void operator()(const T& t) const
-    {
-      output(cout, t);
-      cout << endl;
-    }
-  };
-
-  void repl(shared_ptr< environment > env_p)
+  void repl(const shared_ptr< environment >& env_p)
   {
     cout << prompt;
     string line;
@@ -97,7 +82,8 @@ namespace lime {
         eval(parse(*it), env_p);
       if (!parts.empty()) {
         value retval = eval(parse(parts.back()), env_p);
-        apply_visitor(return_value_visitor(), retval);
+        if (!retval.is_nil())
+          output(cout, retval) << endl;
       }
       cout << prompt;
     }
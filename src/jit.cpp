@@ -0,0 +1,588 @@
+// C headers
+#include <cstring>
+#include <sys/mman.h>
+
+// STL headers
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+// lime headers
+#include <builtins.hpp>
+#include <jit.hpp>
+#include <optimize.hpp>
+
+namespace lime {
+  // STL
+  using std::initializer_list;
+  using std::make_shared;
+  using std::vector;
+
+  // lime
+  using lime::lambda;
+  using lime::scope;
+
+  const symbol if_sym("if");
+  const symbol begin_sym("begin");
+  const symbol and_sym("and");
+  const symbol or_sym("or");
+  const symbol not_sym("not");
+
+#if defined(__x86_64__) && defined(__linux__)
+  const bool jit_supported = true;
+#else
+  const bool jit_supported = false;
+#endif
+
+  bool jit_on = jit_supported;
+
+  void use_jit(bool on)
+  {
+    jit_on = on && jit_supported;
+  }
+
+  bool jit_enabled()
+  {
+    return jit_on;
+  }
+
+  // Machine code gives up when the stack pointer goes below this limit, which
+  // each call from the interpreter sets native_stack_size bytes below itself.
+  // run always leaves more than that free.
+  uintptr_t native_stack_limit = 0;
+  const uintptr_t native_stack_size = 64 << 10;
+
+  // machine code that has given up this many times is dropped
+  const int max_bailouts = 100;
+
+  // The arguments and result are value words; a result of 0 means that the
+  // machine code gave up.
+  typedef uintptr_t (*native_function)(uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
+
+  // A global variable that compiled code assumes to keep its value: an
+  // operator, the lambda itself, or a constant such as true. val keeps
+  // operators alive, so that no other object can take their address.
+  class dependency {
+  public:
+    unsigned id;
+    uintptr_t word;
+    value val;
+  };
+
+  class native_code {
+  public:
+    native_code(const vector< unsigned char >& code, const vector< dependency >& deps,
+                environment* global_env_p)
+      : entry(nullptr), n_bailouts(0), memory(nullptr), size(code.size()),
+        dependencies(deps), global_p(global_env_p)
+    {
+      void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+      if (p == MAP_FAILED)
+        return;
+      memory = p;
+      memcpy(memory, code.data(), size);
+      if (mprotect(memory, size, PROT_READ | PROT_EXEC) == 0)
+        entry = reinterpret_cast< native_function >(memory);
+    }
+    native_code(const native_code&) = delete;
+    native_code& operator=(const native_code&) = delete;
+    ~native_code()
+    {
+      if (memory)
+        munmap(memory, size);
+    }
+    // true while the global variables the code depends on keep their values
+    bool valid() const
+    {
+      for (const dependency& dep: dependencies) {
+        value* var_p = global_p->variable(dep.id);
+        if (!var_p || var_p->get_word() != dep.word)
+          return false;
+      }
+      return true;
+    }
+    native_function entry;
+    int n_bailouts;
+  private:
+    void* memory;
+    size_t size;
+    vector< dependency > dependencies;
+    environment* global_p;
+  };
+
+  // Emits x86-64 machine code from fixed instruction templates, patching in
+  // the immediates and jump offsets.
+  class assembler {
+  public:
+    class label {
+    public:
+      label() : position(-1) {}
+      int position;
+      // the offsets of the rel32 fields that jump here
+      vector< int > uses;
+    };
+    enum condition { overflow = 0x0, below = 0x2, equal = 0x4, not_equal = 0x5,
+                     less = 0xc, greater_equal = 0xd };
+    void emit(initializer_list< unsigned char > bytes)
+    {
+      code.insert(code.end(), bytes);
+    }
+    void emit32(uint32_t n)
+    {
+      for (int i = 0; i < 4; ++i)
+        code.push_back(n >> (8 * i));
+    }
+    void emit64(uint64_t n)
+    {
+      for (int i = 0; i < 8; ++i)
+        code.push_back(n >> (8 * i));
+    }
+    // jcc, jmp and call with a 32 bit offset
+    void jump_if(condition cc, label& target)
+    {
+      emit({ 0x0f, (unsigned char)(0x80 + cc) });
+      refer(target);
+    }
+    void jump(label& target)
+    {
+      emit({ 0xe9 });
+      refer(target);
+    }
+    void call(label& target)
+    {
+      emit({ 0xe8 });
+      refer(target);
+    }
+    void bind(label& l)
+    {
+      l.position = code.size();
+      for (int use: l.uses)
+        patch(use, l.position);
+    }
+    const vector< unsigned char >& bytes() const
+    {
+      return code;
+    }
+  private:
+    void refer(label& target)
+    {
+      int use = code.size();
+      emit32(0);
+      if (target.position >= 0)
+        patch(use, target.position);
+      else
+        target.uses.push_back(use);
+    }
+    void patch(int use, int position)
+    {
+      uint32_t offset = position - (use + 4);
+      for (int i = 0; i < 4; ++i)
+        code[use + i] = offset >> (8 * i);
+    }
+    vector< unsigned char > code;
+  };
+
+  enum class operation { none, add, subtract, multiply, divide, remainder, less, equal,
+                         self };
+
+  // Compiles the body of a lambda with its parameters in rdi, rsi and rdx to
+  // a function returning the result in rax. Values stay tagged words, so
+  // integer arithmetic only has to adjust the tag bit; every operation
+  // checks its operands and gives up on anything but integers, and on
+  // overflow. Parameters live in the frame at rbp - 8, - 16 and - 24, and
+  // intermediate results on the stack.
+  class native_compiler {
+  public:
+    native_compiler(int n, scope* s, environment* creation_env_p,
+                    environment* global_env_p, uintptr_t self)
+      : n_params(n), scope_p(s), creation_p(creation_env_p), global_p(global_env_p),
+        self_word(self), true_word(value(true).get_word()),
+        false_word(value(false).get_word()) {}
+    bool compile(const value& body)
+    {
+      as.bind(entry);
+      as.emit({ 0x55,                            // push rbp
+                0x48, 0x89, 0xe5,                // mov rbp, rsp
+                0x48, 0x83, 0xec, 0x20,          // sub rsp, 32
+                0x49, 0xbb });                   // mov r11, &native_stack_limit
+      as.emit64(reinterpret_cast< uintptr_t >(&native_stack_limit));
+      as.emit({ 0x49, 0x3b, 0x23 });             // cmp rsp, [r11]
+      as.jump_if(assembler::below, bail);
+      as.emit({ 0x48, 0x89, 0x7d, 0xf8,          // mov [rbp - 8], rdi
+                0x48, 0x89, 0x75, 0xf0,          // mov [rbp - 16], rsi
+                0x48, 0x89, 0x55, 0xe8 });       // mov [rbp - 24], rdx
+      as.bind(body_start);
+      if (!compile_value(body, true))
+        return false;
+      as.emit({ 0xc9, 0xc3 });                   // leave; ret
+      as.bind(bail);
+      as.emit({ 0x31, 0xc0, 0xc9, 0xc3 });       // xor eax, eax; leave; ret
+      return true;
+    }
+    const vector< unsigned char >& code() const
+    {
+      return as.bytes();
+    }
+    const vector< dependency >& dependencies() const
+    {
+      return deps;
+    }
+  private:
+    void load_word(uintptr_t word)
+    {
+      as.emit({ 0x48, 0xb8 });                   // mov rax, word
+      as.emit64(word);
+    }
+    void load_parameter(int i)
+    {
+      // mov rax, [rbp - 8i - 8]
+      as.emit({ 0x48, 0x8b, 0x45, (unsigned char)(-8 * (i + 1)) });
+    }
+    // The value of a free variable, which must be global; it is recorded as a
+    // dependency.
+    bool global(symbol sym, value& val)
+    {
+      if (scope_p->find(sym) >= 0)
+        return false;
+      for (environment* frame_p = creation_p; frame_p->outer();
+           frame_p = frame_p->outer())
+        if (frame_p->get_scope()->find(sym) >= 0)
+          return false;
+      value* var_p = global_p->variable(sym.id());
+      if (!var_p)
+        return false;
+      val = *var_p;
+      for (const dependency& dep: deps)
+        if (dep.id == sym.id())
+          return true;
+      deps.push_back(dependency { sym.id(), val.get_word(),
+                                  val.get_word() == self_word ? value() : val });
+      return true;
+    }
+    // A call the optimizer rewrote is compiled as it was rewritten, which
+    // depends on the functions it relies on.
+    const optimized_form* rewritten_form(const value& expr)
+    {
+      if (!expr.is(type::node))
+        return nullptr;
+      return dynamic_cast< const optimized_form* >(expr.get_object());
+    }
+    bool depend_on(const vector< symbol >& syms)
+    {
+      value val;
+      for (symbol sym: syms)
+        if (!global(sym, val))
+          return false;
+      return true;
+    }
+    operation operation_of(const value& func)
+    {
+      value val;
+      if (!func.is_symbol() || !global(func.get_symbol(), val) || !val.is(type::lambda))
+        return operation::none;
+      if (val.get_word() == self_word)
+        return operation::self;
+      lambda* lambda_p = val.get_lambda();
+      if (dynamic_cast< plus* >(lambda_p))
+        return operation::add;
+      if (dynamic_cast< minus* >(lambda_p))
+        return operation::subtract;
+      if (dynamic_cast< times* >(lambda_p))
+        return operation::multiply;
+      if (dynamic_cast< divide* >(lambda_p))
+        return operation::divide;
+      if (dynamic_cast< modulo* >(lambda_p))
+        return operation::remainder;
+      if (dynamic_cast< less_than* >(lambda_p))
+        return operation::less;
+      if (dynamic_cast< equals* >(lambda_p))
+        return operation::equal;
+      return operation::none;
+    }
+    bool is_form(const value& expr, symbol sym, int size)
+    {
+      if (!expr.is(type::list) || expr.get_list().size() != size)
+        return false;
+      const value& head = expr.get_list().front();
+      return head.is_symbol() && head.get_symbol() == sym;
+    }
+    // the operands of a binary operation in rax and rcx, both integers
+    bool compile_operands(const value& a, const value& b)
+    {
+      if (!compile_value(a, false))
+        return false;
+      as.emit({ 0x50 });                         // push rax
+      if (!compile_value(b, false))
+        return false;
+      as.emit({ 0x48, 0x89, 0xc1,                // mov rcx, rax
+                0x58,                            // pop rax
+                0x48, 0x89, 0xc2,                // mov rdx, rax
+                0x48, 0x21, 0xca,                // and rdx, rcx
+                0xf6, 0xc2, 0x01 });             // test dl, 1
+      as.jump_if(assembler::equal, bail);
+      return true;
+    }
+    void compile_division()
+    {
+      as.emit({ 0x48, 0xd1, 0xf8,                // sar rax, 1
+                0x48, 0xd1, 0xf9,                // sar rcx, 1
+                0x48, 0x85, 0xc9 });             // test rcx, rcx
+      as.jump_if(assembler::equal, bail);
+      as.emit({ 0x48, 0x99,                      // cqo
+                0x48, 0xf7, 0xf9 });             // idiv rcx
+    }
+    bool compile_value(const value& expr, bool tail)
+    {
+      switch (expr.get_type()) {
+      case type::integer:
+      case type::boolean:
+        load_word(expr.get_word());
+        return true;
+      case type::symbol: {
+        symbol sym = expr.get_symbol();
+        int index = scope_p->find(sym);
+        if (index >= 0 && index < n_params) {
+          load_parameter(index);
+          return true;
+        }
+        value val;
+        if (!global(sym, val) || !(val.is_int() || val.is_bool()))
+          return false;
+        load_word(val.get_word());
+        return true;
+      }
+      case type::list:
+        return compile_form(expr.get_list(), tail);
+      case type::node: {
+        const optimized_form* form_p = rewritten_form(expr);
+        return form_p && depend_on(form_p->dependencies) &&
+          compile_value(form_p->rewritten, tail);
+      }
+      default:
+        return false;
+      }
+    }
+    bool compile_form(const list& expr, bool tail)
+    {
+      if (expr.empty() || !expr.front().is_symbol())
+        return false;
+      symbol sym = expr.front().get_symbol();
+      if (sym == if_sym) {
+        if (expr.size() != 4)
+          return false;
+        assembler::label else_branch, end;
+        if (!compile_test(expr[1], else_branch, false) || !compile_value(expr[2], tail))
+          return false;
+        as.jump(end);
+        as.bind(else_branch);
+        if (!compile_value(expr[3], tail))
+          return false;
+        as.bind(end);
+        return true;
+      }
+      if (sym == begin_sym) {
+        for (int i = 1; i < expr.size(); ++i)
+          if (!compile_value(expr[i], tail && i + 1 == expr.size()))
+            return false;
+        return expr.size() > 1;
+      }
+      if ((sym == and_sym || sym == or_sym) && expr.size() == 3) {
+        assembler::label decided, end;
+        if (!compile_test(expr[1], decided, sym == or_sym) ||
+            !compile_value(expr[2], tail))
+          return false;
+        as.jump(end);
+        as.bind(decided);
+        load_word(sym == or_sym ? true_word : false_word);
+        as.bind(end);
+        return true;
+      }
+      if (sym == not_sym && expr.size() == 2) {
+        assembler::label is_false, end;
+        if (!compile_test(expr[1], is_false, false))
+          return false;
+        load_word(false_word);
+        as.jump(end);
+        as.bind(is_false);
+        load_word(true_word);
+        as.bind(end);
+        return true;
+      }
+      operation op = operation_of(expr.front());
+      if (op == operation::self)
+        return expr.size() == n_params + 1 && compile_self_call(expr, tail);
+      if (op == operation::none || expr.size() != 3 ||
+          !compile_operands(expr[1], expr[2]))
+        return false;
+      switch (op) {
+      case operation::add:
+        as.emit({ 0x48, 0xff, 0xc8,              // dec rax
+                  0x48, 0x01, 0xc8 });           // add rax, rcx
+        as.jump_if(assembler::overflow, bail);
+        break;
+      case operation::subtract:
+        as.emit({ 0x48, 0x29, 0xc8 });           // sub rax, rcx
+        as.jump_if(assembler::overflow, bail);
+        as.emit({ 0x48, 0xff, 0xc0 });           // inc rax
+        break;
+      case operation::multiply:
+        as.emit({ 0x48, 0xd1, 0xf8,              // sar rax, 1
+                  0x48, 0xff, 0xc9,              // dec rcx
+                  0x48, 0x0f, 0xaf, 0xc1 });     // imul rax, rcx
+        as.jump_if(assembler::overflow, bail);
+        as.emit({ 0x48, 0xff, 0xc0 });           // inc rax
+        break;
+      case operation::divide:
+        compile_division();
+        as.emit({ 0x48, 0x01, 0xc0 });           // add rax, rax
+        as.jump_if(assembler::overflow, bail);
+        as.emit({ 0x48, 0xff, 0xc0 });           // inc rax
+        break;
+      case operation::remainder:
+        compile_division();
+        as.emit({ 0x48, 0x89, 0xd0,              // mov rax, rdx
+                  0x48, 0x01, 0xc0,              // add rax, rax
+                  0x48, 0xff, 0xc0 });           // inc rax
+        break;
+      default:
+        as.emit({ 0x48, 0x39, 0xc8,              // cmp rax, rcx
+                  0x0f, (unsigned char)(op == operation::less ? 0x9c : 0x94), 0xc0,
+                                                 // setl al or sete al
+                  0x0f, 0xb6, 0xc0,              // movzx eax, al
+                  0x48, 0x8d, 0x04, 0xc5 });     // lea rax, [8 * rax + false]
+        as.emit32(false_word);
+      }
+      return true;
+    }
+    // Arguments are evaluated onto the stack and then moved to the argument
+    // registers; a call in tail position jumps back to the start of the body
+    // with them as the new parameters.
+    bool compile_self_call(const list& expr, bool tail)
+    {
+      for (int i = 1; i < expr.size(); ++i) {
+        if (!compile_value(expr[i], false))
+          return false;
+        as.emit({ 0x50 });                       // push rax
+      }
+      static const unsigned char pops[] = { 0x5f, 0x5e, 0x5a }; // pop rdi, rsi, rdx
+      for (int i = n_params - 1; i >= 0; --i)
+        as.emit({ pops[i] });
+      if (tail) {
+        as.emit({ 0x48, 0x89, 0x7d, 0xf8,        // mov [rbp - 8], rdi
+                  0x48, 0x89, 0x75, 0xf0,        // mov [rbp - 16], rsi
+                  0x48, 0x89, 0x55, 0xe8 });     // mov [rbp - 24], rdx
+        as.jump(body_start);
+        return true;
+      }
+      as.call(entry);
+      as.emit({ 0x48, 0x85, 0xc0 });             // test rax, rax
+      as.jump_if(assembler::equal, bail);
+      return true;
+    }
+    // jumps to target if expr evaluates to when, and gives up if it is not a
+    // boolean
+    bool compile_test(const value& expr, assembler::label& target, bool when)
+    {
+      if (const optimized_form* form_p = rewritten_form(expr))
+        return depend_on(form_p->dependencies) &&
+          compile_test(form_p->rewritten, target, when);
+      if (is_form(expr, not_sym, 2))
+        return compile_test(expr.get_list()[1], target, !when);
+      if (is_form(expr, and_sym, 3) || is_form(expr, or_sym, 3)) {
+        const list& lst = expr.get_list();
+        bool decisive = lst.front().get_symbol() == or_sym;
+        assembler::label skip;
+        if (!compile_test(lst[1], when == decisive ? target : skip, decisive) ||
+            !compile_test(lst[2], target, when))
+          return false;
+        as.bind(skip);
+        return true;
+      }
+      if (expr.is(type::list) && expr.get_list().size() == 3) {
+        const list& lst = expr.get_list();
+        operation op = operation_of(lst.front());
+        if (op == operation::less || op == operation::equal) {
+          if (!compile_operands(lst[1], lst[2]))
+            return false;
+          as.emit({ 0x48, 0x39, 0xc8 });         // cmp rax, rcx
+          if (op == operation::less)
+            as.jump_if(when ? assembler::less : assembler::greater_equal, target);
+          else
+            as.jump_if(when ? assembler::equal : assembler::not_equal, target);
+          return true;
+        }
+      }
+      if (!compile_value(expr, false))
+        return false;
+      as.emit({ 0x48, 0x3d });                   // cmp rax, when
+      as.emit32(when ? true_word : false_word);
+      as.jump_if(assembler::equal, target);
+      as.emit({ 0x48, 0x3d });                   // cmp rax, !when
+      as.emit32(when ? false_word : true_word);
+      as.jump_if(assembler::not_equal, bail);
+      return true;
+    }
+    assembler as;
+    assembler::label entry, body_start, bail;
+    int n_params;
+    scope* scope_p;
+    environment* creation_p;
+    environment* global_p;
+    uintptr_t self_word, true_word, false_word;
+    vector< dependency > deps;
+  };
+
+  void lambda::compile_native()
+  {
+    n_calls = -1;
+    if (!body || !bound_args.empty() || value_arity != n_params || n_params < 1 ||
+        n_params > 3)
+      return;
+    environment* global_env_p = creation_env_p.get();
+    while (global_env_p->outer())
+      global_env_p = global_env_p->outer();
+    native_compiler compiler(n_params, scope_p.get(), creation_env_p.get(), global_env_p,
+                             reinterpret_cast< uintptr_t >(static_cast< object* >(this)));
+    if (!compiler.compile(source))
+      return;
+    native_p = make_shared< native_code >(compiler.code(), compiler.dependencies(),
+                                          global_env_p);
+    if (!native_p->entry)
+      native_p.reset();
+  }
+
+  bool lambda::call_native(const value* args, int n, value& result)
+  {
+    if (!native_p) {
+      if (n_calls < 0 || !jit_enabled() || ++n_calls < jit_threshold)
+        return false;
+      compile_native();
+      if (!native_p)
+        return false;
+    }
+    if (!native_p->valid()) {
+      native_p.reset();
+      return false;
+    }
+    uintptr_t words[3] = { 0, 0, 0 };
+    for (int i = 0; i < n; ++i) {
+      if (!args[i].is_int() && !args[i].is_bool())
+        return false;
+      words[i] = args[i].get_word();
+    }
+    char here;
+    uintptr_t outer_limit = native_stack_limit;
+    native_stack_limit = reinterpret_cast< uintptr_t >(&here) - native_stack_size;
+    uintptr_t word = native_p->entry(words[0], words[1], words[2]);
+    native_stack_limit = outer_limit;
+    if (!word) {
+      if (++native_p->n_bailouts == max_bailouts)
+        native_p.reset();
+      return false;
+    }
+    result = value::from_word(word);
+    return true;
+  }
+
+} // namespace lime
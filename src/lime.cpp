@@ -1,28 +1,86 @@
+// C headers
+#include <cstdlib>
+
 // STL headers
+#include <iostream>
 #include <memory>
+#include <string>
 
 // lime headers
 #include <builtins.hpp>
+#include <eval.hpp>
 #include <interpreter.hpp>
+#include <jit.hpp>
+#include <optimize.hpp>
+#include <vm.hpp>
 
 // STL
+using std::cout;
 using std::make_shared;
 using std::shared_ptr;
+using std::string;
 
 // lime
 using lime::add_builtins;
+using lime::dump_optimized;
 using lime::environment;
 using lime::load_file;
 using lime::load_stdlib;
 using lime::repl;
+using lime::set_max_depth;
+using lime::use_jit;
+using lime::use_optimizer;
+using lime::use_vm;
+
+const string max_depth_option("--max-depth=");
+const string vm_option("--vm");
+const string no_jit_option("--no-jit");
+const string no_optimize_option("--no-optimize");
+const string dump_optimized_option("--dump-optimized");
+const string help_option("--help");
+
+const char* const usage =
+  "usage: lime [options] [program.lm]\n"
+  "Runs the program, or the REPL if none is given.\n"
+  "\n"
+  "  --max-depth=N     stop with an error once more than N calls that are not in\n"
+  "                    tail position are nested (unlimited by default)\n"
+  "  --vm              run on the bytecode virtual machine. Coverage is partial:\n"
+  "                    lambda, defmacro, macro calls, partial applications, & and\n"
+  "                    $ parameters and calls with no arguments or more than\n"
+  "                    three still run on the tree-walking evaluator\n"
+  "  --no-jit          do not compile hot arithmetic functions to machine code\n"
+  "  --no-optimize     do not fold constants or inline small functions\n"
+  "  --dump-optimized  print every expression the optimizer rewrites\n"
+  "  --help            print this text\n";
 
 int main(int argc, char *argv[])
 {
+  string source_path;
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg.compare(0, max_depth_option.size(), max_depth_option) == 0)
+      set_max_depth(atol(arg.c_str() + max_depth_option.size()));
+    else if (arg == vm_option)
+      use_vm(true);
+    else if (arg == no_jit_option)
+      use_jit(false);
+    else if (arg == no_optimize_option)
+      use_optimizer(false);
+    else if (arg == dump_optimized_option)
+      dump_optimized(true);
+    else if (arg == help_option) {
+      cout << usage;
+      return 0;
+    }
+    else
+      source_path = arg;
+  }
   auto env_p = make_shared< environment >();
   add_builtins(env_p);
   load_stdlib(env_p);
-  if (argc == 1)
+  if (source_path.empty())
     repl(env_p);
   else
-    load_file(argv[1], env_p);
+    load_file(source_path, env_p);
 }
@@ -0,0 +1,695 @@
+// STL headers
+#include <iostream>
+#include <string>
+#include <vector>
+
+// lime headers
+#include <bignum.hpp>
+#include <builtins.hpp>
+#include <optimize.hpp>
+#include <real.hpp>
+
+namespace lime {
+  // STL
+  using std::cout;
+  using std::endl;
+  using std::string;
+  using std::vector;
+
+  // lime
+  using lime::eval;
+  using lime::is_assigned;
+  using lime::list;
+  using lime::make_object;
+
+  const symbol if_sym("if");
+  const symbol define_sym("define");
+  const symbol set_sym("set!");
+  const symbol begin_sym("begin");
+  const symbol local_sym("local");
+  const symbol lambda_sym("lambda");
+  const symbol defmacro_sym("defmacro");
+  const symbol while_sym("while");
+  const symbol for_sym("for");
+  const symbol for_each_sym("for-each");
+  const symbol and_sym("and");
+  const symbol or_sym("or");
+  const symbol not_sym("not");
+
+  // Small functions have bodies of at most this many symbols and constants.
+  // Inlining stops at this depth, which also keeps recursive functions from
+  // counting as free of side effects.
+  const int max_inline_size = 16;
+  const int max_inline_depth = 4;
+
+  bool optimizer_on = true;
+  bool dump_on = false;
+
+  void use_optimizer(bool on)
+  {
+    optimizer_on = on;
+  }
+
+  void dump_optimized(bool on)
+  {
+    dump_on = on;
+  }
+
+  value optimized_form::execute(const shared_ptr< environment >& env_p)
+  {
+    return eval(original, env_p);
+  }
+
+  intrusive_ptr< node > optimized_form::compile(scope_chain& scopes, bool tail) const
+  {
+    return make_object< guarded_node >(dependencies,
+                                       lime::compile(rewritten, scopes, tail),
+                                       lime::compile(original, scopes, tail));
+  }
+
+  optimized_form* as_optimized_form(const value& expr)
+  {
+    if (!expr.is(type::node))
+      return nullptr;
+    return dynamic_cast< optimized_form* >(static_cast< node* >(expr.get_object()));
+  }
+
+  // expr with the expressions the optimizer rewrote replaced by what they were
+  // rewritten to, whose dependencies are added to deps
+  value plain_form(const value& expr, vector< symbol >& deps)
+  {
+    if (optimized_form* form_p = as_optimized_form(expr)) {
+      deps.insert(deps.end(), form_p->dependencies.begin(), form_p->dependencies.end());
+      return plain_form(form_p->rewritten, deps);
+    }
+    if (!expr.is(type::list))
+      return expr;
+    list lst;
+    for (const value& v: expr.get_list())
+      lst.push_back(plain_form(v, deps));
+    return lst;
+  }
+
+  bool is_form(const value& expr, symbol sym)
+  {
+    if (!expr.is(type::list) || expr.get_list().empty())
+      return false;
+    const value& head = expr.get_list().front();
+    return head.is_symbol() && head.get_symbol() == sym;
+  }
+
+  // the builtins that are folded when their arguments are constants
+  bool is_arithmetic(lambda* lambda_p)
+  {
+    return dynamic_cast< plus* >(lambda_p) || dynamic_cast< minus* >(lambda_p) ||
+      dynamic_cast< times* >(lambda_p) || dynamic_cast< divide* >(lambda_p) ||
+      dynamic_cast< modulo* >(lambda_p) || dynamic_cast< less_than* >(lambda_p) ||
+      dynamic_cast< equals* >(lambda_p);
+  }
+
+  // whether applying an arithmetic builtin to a and b cannot fail
+  bool can_fold(lambda* lambda_p, const value& a, const value& b)
+  {
+    if (!is_number(a) || !is_number(b))
+      return false;
+    bool divides = dynamic_cast< divide* >(lambda_p) || dynamic_cast< modulo* >(lambda_p);
+    return !divides || !b.identical(0);
+  }
+
+  bool is_constant(const value& expr)
+  {
+    return !expr.is(type::list) && !expr.is_symbol() && !expr.is(type::node);
+  }
+
+  // what an expression the optimizer rewrote comes down to, which is a constant if
+  // it was folded; the dependencies on the way are added to deps
+  value folded(const value& expr, vector< symbol >& deps)
+  {
+    optimized_form* form_p = as_optimized_form(expr);
+    if (!form_p)
+      return expr;
+    deps.insert(deps.end(), form_p->dependencies.begin(), form_p->dependencies.end());
+    return folded(form_p->rewritten, deps);
+  }
+
+  bool is_folded_constant(const value& expr)
+  {
+    vector< symbol > deps;
+    return is_constant(folded(expr, deps));
+  }
+
+  // result in place of expr, as an optimized form if it depends on anything
+  value rewritten_form(const value& expr, const value& result,
+                       const vector< symbol >& deps)
+  {
+    if (deps.empty())
+      return result;
+    return make_object< optimized_form >(expr, result, deps);
+  }
+
+  int form_size(const value& expr)
+  {
+    if (!expr.is(type::list))
+      return 1;
+    int size = 0;
+    for (const value& v: expr.get_list())
+      size += form_size(v);
+    return size;
+  }
+
+  int find_parameter(symbol sym, const vector< symbol >& params)
+  {
+    for (int i = 0; i < params.size(); ++i)
+      if (params[i] == sym)
+        return i;
+    return -1;
+  }
+
+  value substitute(const value& expr, const vector< symbol >& params,
+                   const vector< value >& args)
+  {
+    if (expr.is_symbol()) {
+      int i = find_parameter(expr.get_symbol(), params);
+      return i >= 0 ? args[i] : expr;
+    }
+    if (!expr.is(type::list))
+      return expr;
+    list lst;
+    for (const value& v: expr.get_list())
+      lst.push_back(substitute(v, params, args));
+    return lst;
+  }
+
+  // A parameter's use in a body, in the order the body is evaluated; uses
+  // in the branches of if, and and or are conditional.
+  class use {
+  public:
+    int param;
+    bool conditional;
+  };
+
+  void find_uses(const value& expr, const vector< symbol >& params, bool conditional,
+                 vector< use >& uses)
+  {
+    if (expr.is_symbol()) {
+      int i = find_parameter(expr.get_symbol(), params);
+      if (i >= 0)
+        uses.push_back(use { i, conditional });
+      return;
+    }
+    if (!expr.is(type::list))
+      return;
+    const list& lst = expr.get_list();
+    bool branches = is_form(expr, if_sym) || is_form(expr, and_sym) ||
+      is_form(expr, or_sym);
+    for (int i = 0; i < lst.size(); ++i)
+      find_uses(lst[i], params, conditional || (branches && i > 1), uses);
+  }
+
+  // Whether a body free of side effects can take args in place of params.
+  // Variables and constants can be copied to every use; any other argument
+  // must be evaluated once, in order, so then each parameter has to be used
+  // exactly once, in order and unconditionally.
+  bool can_substitute(const value& body, const vector< symbol >& params,
+                      const vector< value >& args)
+  {
+    vector< use > uses;
+    find_uses(body, params, false, uses);
+    bool copyable = true;
+    for (const value& arg: args)
+      if (!arg.is_symbol() && !is_folded_constant(arg))
+        copyable = false;
+    if (!copyable) {
+      if (uses.size() != params.size())
+        return false;
+      for (int i = 0; i < uses.size(); ++i)
+        if (uses[i].param != i || uses[i].conditional)
+          return false;
+      return true;
+    }
+    // a variable must still be looked up, in case it is not bound
+    for (int i = 0; i < args.size(); ++i)
+      if (args[i].is_symbol()) {
+        bool used = false;
+        for (const use& u: uses)
+          used = used || u.param == i;
+        if (!used)
+          return false;
+      }
+    return true;
+  }
+
+  // Rewrites the expressions compiled in a scope chain, using the functions
+  // bound in the global environment.
+  class optimizer {
+  public:
+    optimizer(const scope_chain& s, environment* g)
+      : changed(false), scopes(s), globals_p(g), depth(0), open(false)
+    {
+      for (const auto& scope_p: scopes)
+        open = open || scope_p->is_open();
+    }
+    // Notes every name expr binds or assigns anywhere in it, so that such
+    // names are never taken for the global variables, and the functions it
+    // defines.
+    void find_bindings(const value& expr)
+    {
+      if (!expr.is(type::list) || expr.get_list().empty())
+        return;
+      const list& lst = expr.get_list();
+      bool binds = is_form(expr, lambda_sym) || is_form(expr, define_sym) ||
+        is_form(expr, defmacro_sym) || is_form(expr, set_sym) || is_form(expr, for_sym) ||
+        is_form(expr, for_each_sym);
+      if (lst.size() > 1 && binds)
+        add_bindings(lst[1]);
+      if (lst.size() > 1 && is_form(expr, define_sym) && lst[1].is(type::list) &&
+          !lst[1].get_list().empty() && lst[1].get_list().front().is_symbol())
+        defined_functions.push_back(lst[1].get_list().front().get_symbol());
+      for (const value& v: lst)
+        find_bindings(v);
+    }
+    value rewrite(const value& expr);
+    // Whether the body expr is part of calls a macro or a builtin that runs
+    // in the caller's environment, such as eval or read-from-string, which
+    // may define any name in its frame while it runs, as scan_scope notes.
+    // Nested lambdas and local blocks have frames of their own and are left
+    // out.
+    bool defines_at_run_time(const value& expr) const
+    {
+      if (!expr.is(type::list) || expr.get_list().empty())
+        return false;
+      const list& lst = expr.get_list();
+      int from = 0;
+      if (lst.front().is_symbol()) {
+        symbol sym = lst.front().get_symbol();
+        if (sym == lambda_sym || sym == defmacro_sym || sym == local_sym || sym == for_sym)
+          return false;
+        if (sym == define_sym && lst.size() > 1 && lst[1].is(type::list))
+          return false;
+        if (sym == for_each_sym)
+          return lst.size() > 2 && defines_at_run_time(lst[2]);
+        value* var_p = is_bound(sym) ? nullptr : globals_p->variable(sym.id());
+        if (var_p && var_p->is(type::macro))
+          return true;
+        if (var_p && var_p->is(type::lambda)) {
+          if (var_p->get_lambda()->runs_in_caller_environment())
+            return true;
+          if (var_p->get_lambda()->quotes_arguments())
+            return false;
+        }
+        from = 1;
+      }
+      for (int i = from; i < lst.size(); ++i)
+        if (defines_at_run_time(lst[i]))
+          return true;
+      return false;
+    }
+    // whether expr gives the forms in it a frame of their own that
+    // defines_at_run_time
+    bool opens_frame(const value& expr) const
+    {
+      const list& lst = expr.get_list();
+      int from = lst.size();
+      if (is_form(expr, lambda_sym) || (is_form(expr, define_sym) && lst.size() == 3 &&
+                                         lst[1].is(type::list)))
+        from = 2;
+      else if (is_form(expr, local_sym) || is_form(expr, for_sym))
+        from = 1;
+      else if (is_form(expr, for_each_sym))
+        from = 3;
+      for (int i = from; i < lst.size(); ++i)
+        if (defines_at_run_time(lst[i]))
+          return true;
+      return false;
+    }
+    bool changed;
+    // set while the expression being rewritten runs in a frame where names
+    // may be defined at run time, which leaves every name possibly local
+    bool open;
+  private:
+    void add_bindings(const value& target)
+    {
+      if (target.is_symbol()) {
+        const string& name = target.get_symbol().name();
+        if (name.size() > 1 && (name.front() == '&' || name.front() == '$'))
+          bound_names.push_back(symbol(name.substr(1)));
+        bound_names.push_back(target.get_symbol());
+      }
+      else if (target.is(type::list))
+        for (const value& v: target.get_list())
+          add_bindings(v);
+    }
+    bool is_local(symbol sym) const
+    {
+      return open || is_bound(sym);
+    }
+    bool is_bound(symbol sym) const
+    {
+      for (symbol name: bound_names)
+        if (name == sym)
+          return true;
+      for (const auto& scope_p: scopes)
+        if (scope_p->find(sym) >= 0)
+          return true;
+      return false;
+    }
+    // whether sym names a function expr defines with (define (sym ...) ...)
+    // and binds to nothing else, which takes its arguments evaluated
+    bool is_defined_function(symbol sym) const
+    {
+      int n = 0;
+      for (symbol name: defined_functions)
+        n += name == sym;
+      for (symbol name: bound_names)
+        n -= name == sym;
+      for (const auto& scope_p: scopes)
+        if (scope_p->find(sym) >= 0)
+          return false;
+      return n == 0 && find_parameter(sym, defined_functions) >= 0;
+    }
+    // the function bound to a global variable that nothing has assigned to
+    lambda* global_function(symbol sym) const
+    {
+      if (is_local(sym) || is_assigned(sym))
+        return nullptr;
+      value* var_p = globals_p->variable(sym.id());
+      if (!var_p || !var_p->is(type::lambda))
+        return nullptr;
+      return var_p->get_lambda();
+    }
+    // expr with its elements from index from on rewritten, the first of them
+    // being done already if given
+    value rewrite_elements(const value& expr, int from,
+                           const vector< value >& done = vector< value >())
+    {
+      const list& lst = expr.get_list();
+      list result;
+      bool same = true;
+      for (int i = 0; i < lst.size(); ++i) {
+        if (i < from)
+          result.push_back(lst[i]);
+        else if (i - from < done.size())
+          result.push_back(done[i - from]);
+        else
+          result.push_back(rewrite(lst[i]));
+        same = same && result.back().identical(lst[i]);
+      }
+      return same ? expr : value(result);
+    }
+    // The arguments of a call, leaving variables as they are, since the
+    // function may take references to them.
+    value rewrite_arguments(const value& expr)
+    {
+      const list& lst = expr.get_list();
+      vector< value > done;
+      for (int i = 1; i < lst.size(); ++i)
+        done.push_back(lst[i].is_symbol() ? lst[i] : rewrite(lst[i]));
+      return rewrite_elements(expr, 1, done);
+    }
+    value rewrite_variable(const value& expr);
+    value rewrite_sequence(const value& expr);
+    value rewrite_call(const value& expr, symbol sym, lambda* lambda_p);
+    value rewrite_application(const value& expr);
+    value inline_body(const value& call, const vector< symbol >& params,
+                      const value& body, bool in_place, vector< symbol >& deps);
+    bool is_pure(const value& expr, const vector< symbol >& params, bool in_place,
+                 vector< symbol >& deps, int level) const;
+    const scope_chain& scopes;
+    environment* globals_p;
+    vector< symbol > bound_names, defined_functions;
+    // the functions being inlined
+    vector< symbol > inlining;
+    int depth;
+  };
+
+  value optimizer::rewrite(const value& expr)
+  {
+    if (expr.is_symbol())
+      return rewrite_variable(expr);
+    if (!expr.is(type::list) || expr.get_list().empty())
+      return expr;
+    const list& lst = expr.get_list();
+    if (lst.front().is(type::list))
+      return rewrite_application(expr);
+    if (!lst.front().is_symbol())
+      return expr;
+    if (!open && opens_frame(expr)) {
+      open = true;
+      value result = rewrite(expr);
+      open = false;
+      return result;
+    }
+    symbol sym = lst.front().get_symbol();
+    if (sym == if_sym && lst.size() == 4) {
+      value test = rewrite(lst[1]);
+      vector< symbol > deps;
+      value constant = folded(test, deps);
+      if (constant.is_bool()) {
+        changed = true;
+        return rewritten_form(expr, rewrite(lst[constant.get_bool() ? 2 : 3]), deps);
+      }
+      return rewrite_elements(expr, 1, { test });
+    }
+    if ((sym == and_sym || sym == or_sym) && lst.size() == 3) {
+      value first = rewrite(lst[1]);
+      vector< symbol > deps;
+      value constant = folded(first, deps);
+      if (constant.is_bool()) {
+        changed = true;
+        return rewritten_form(expr, constant.get_bool() == (sym == and_sym) ?
+                              rewrite(lst[2]) : constant, deps);
+      }
+      return rewrite_elements(expr, 1, { first });
+    }
+    if (sym == not_sym && lst.size() == 2 && !is_local(sym) && !is_assigned(sym)) {
+      value arg = rewrite(lst[1]);
+      vector< symbol > deps(1, not_sym);
+      value constant = folded(arg, deps);
+      if (constant.is_bool()) {
+        changed = true;
+        return rewritten_form(expr, !constant.get_bool(), deps);
+      }
+      return rewrite_elements(expr, 1, { arg });
+    }
+    if (sym == begin_sym || sym == local_sym)
+      return rewrite_sequence(expr);
+    if ((sym == define_sym || sym == set_sym || sym == lambda_sym) && lst.size() == 3)
+      return rewrite_elements(expr, 2);
+    if (sym == while_sym && lst.size() == 3)
+      return rewrite_elements(expr, 1);
+    if ((sym == for_sym && lst.size() == 5) || (sym == for_each_sym && lst.size() == 4))
+      return rewrite_elements(expr, 2);
+    if (is_special_form(sym))
+      return expr;
+    // the arguments of macros and of builtins such as quote are source code
+    lambda* lambda_p = global_function(sym);
+    if (!lambda_p && is_defined_function(sym))
+      return rewrite_arguments(expr);
+    if (!lambda_p || lambda_p->quotes_arguments())
+      return expr;
+    value call = rewrite_arguments(expr);
+    if (lambda_p->arity() != lst.size() - 1)
+      return call;
+    return rewrite_call(call, sym, lambda_p);
+  }
+
+  // true and false are global variables
+  value optimizer::rewrite_variable(const value& expr)
+  {
+    symbol sym = expr.get_symbol();
+    if (is_local(sym) || is_assigned(sym))
+      return expr;
+    value* var_p = globals_p->variable(sym.id());
+    if (!var_p || !var_p->is_bool())
+      return expr;
+    return make_object< optimized_form >(expr, *var_p, vector< symbol >(1, sym));
+  }
+
+  // Nested begins are merged, constants whose values are dropped are left
+  // out, and a sequence of a single expression becomes that expression. A
+  // local is only dropped when it holds nothing it could define.
+  value optimizer::rewrite_sequence(const value& expr)
+  {
+    const list& lst = expr.get_list();
+    bool nested = is_form(expr, local_sym);
+    vector< value > items;
+    for (int i = 1; i < lst.size(); ++i) {
+      value item = rewrite(lst[i]);
+      if (!nested && is_form(item, begin_sym)) {
+        const list& inner = item.get_list();
+        items.insert(items.end(), inner.begin() + 1, inner.end());
+      }
+      else
+        items.push_back(item);
+    }
+    list result;
+    result.push_back(lst.front());
+    bool may_define = false;
+    for (int i = 0; i < items.size(); ++i) {
+      if (i + 1 < items.size() && is_constant(items[i]))
+        continue;
+      result.push_back(items[i]);
+      may_define = may_define || items[i].is(type::list);
+    }
+    if (result.size() == 2 && (!nested || !may_define)) {
+      changed = true;
+      return result[1];
+    }
+    if (result.size() != lst.size())
+      changed = true;
+    else {
+      bool same = true;
+      for (int i = 1; i < lst.size(); ++i)
+        same = same && result[i].identical(lst[i]);
+      if (same)
+        return expr;
+    }
+    return result;
+  }
+
+  // A call of a global function that takes evaluated arguments, already
+  // rewritten: arithmetic on constants is folded, and small functions free of
+  // side effects are inlined.
+  value optimizer::rewrite_call(const value& expr, symbol sym, lambda* lambda_p)
+  {
+    const list& lst = expr.get_list();
+    if (is_arithmetic(lambda_p) && lst.size() == 3) {
+      vector< symbol > deps(1, sym);
+      value a = folded(lst[1], deps), b = folded(lst[2], deps);
+      if (can_fold(lambda_p, a, b)) {
+        changed = true;
+        return make_object< optimized_form >(expr, lambda_p->call2(a, b), deps);
+      }
+    }
+    vector< symbol > params;
+    value src;
+    if (depth == max_inline_depth || !lambda_p->inline_source(params, src) ||
+        find_parameter(sym, inlining) >= 0)
+      return expr;
+    vector< symbol > deps(1, sym);
+    inlining.push_back(sym);
+    value result = inline_body(expr, params, src, false, deps);
+    inlining.pop_back();
+    if (result.identical(expr))
+      return expr;
+    return make_object< optimized_form >(expr, result, deps);
+  }
+
+  // A lambda expression applied to arguments where it is written is replaced
+  // by its body, if it can be inlined. The arguments are left alone unless
+  // it takes them evaluated.
+  value optimizer::rewrite_application(const value& expr)
+  {
+    const list& lst = expr.get_list();
+    const value& func = lst.front();
+    vector< symbol > params;
+    bool evaluated = is_form(func, lambda_sym) && func.get_list().size() == 3 &&
+      func.get_list()[1].is(type::list);
+    if (evaluated)
+      for (const value& v: func.get_list()[1].get_list()) {
+        const string& name = v.is_symbol() ? v.get_symbol().name() : "&";
+        evaluated = evaluated && name.front() != '&' && name.front() != '$';
+        params.push_back(v.is_symbol() ? v.get_symbol() : symbol());
+      }
+    if (!evaluated) {
+      value new_func = rewrite(func);
+      if (new_func.identical(func))
+        return expr;
+      list result = lst.tail();
+      result.push_front(new_func);
+      return result;
+    }
+    value call = rewrite_elements(expr, 0);
+    if (params.size() != lst.size() - 1 || depth == max_inline_depth)
+      return call;
+    vector< symbol > deps;
+    value result = inline_body(call, params, call.get_list().front().get_list()[2], true,
+                               deps);
+    if (result.identical(call))
+      return call;
+    return rewritten_form(call, result, deps);
+  }
+
+  // The body of a function with its arguments in place of its parameters,
+  // rewritten, or call itself if the body cannot be inlined. in_place is set
+  // for lambda expressions, whose free variables are where they were.
+  value optimizer::inline_body(const value& call, const vector< symbol >& params,
+                               const value& body, bool in_place, vector< symbol >& deps)
+  {
+    for (symbol param: params)
+      if (is_special_form(param))
+        return call;
+    vector< value > args(call.get_list().begin() + 1, call.get_list().end());
+    value plain_body = plain_form(body, deps);
+    if (form_size(plain_body) > max_inline_size ||
+        !is_pure(plain_body, params, in_place, deps, 0) ||
+        !can_substitute(plain_body, params, args))
+      return call;
+    changed = true;
+    ++depth;
+    value result = rewrite(substitute(plain_body, params, args));
+    --depth;
+    return result;
+  }
+
+  // Whether expr only evaluates its parameters, variables, constants, if,
+  // and, or, not, begin, and calls of arithmetic builtins and of functions
+  // that are themselves pure. The functions it depends on are added to deps.
+  bool optimizer::is_pure(const value& expr, const vector< symbol >& params,
+                          bool in_place, vector< symbol >& deps, int level) const
+  {
+    if (expr.is_symbol())
+      return in_place || find_parameter(expr.get_symbol(), params) >= 0 ||
+        !is_local(expr.get_symbol());
+    if (!expr.is(type::list))
+      return is_constant(expr);
+    const list& lst = expr.get_list();
+    if (lst.empty() || !lst.front().is_symbol())
+      return false;
+    symbol sym = lst.front().get_symbol();
+    if (is_special_form(sym)) {
+      bool valid = (sym == if_sym && lst.size() == 4) ||
+        ((sym == and_sym || sym == or_sym) && lst.size() == 3) ||
+        (sym == begin_sym && lst.size() > 1);
+      if (!valid)
+        return false;
+    }
+    else {
+      lambda* lambda_p = find_parameter(sym, params) < 0 ? global_function(sym) : nullptr;
+      if (!lambda_p || lambda_p->arity() != lst.size() - 1)
+        return false;
+      if (!is_arithmetic(lambda_p)) {
+        vector< symbol > callee_params;
+        value src;
+        if (level == max_inline_depth || !lambda_p->inline_source(callee_params, src) ||
+            !is_pure(plain_form(src, deps), callee_params, false, deps, level + 1))
+          return false;
+      }
+      deps.push_back(sym);
+    }
+    for (int i = 1; i < lst.size(); ++i)
+      if (!is_pure(lst[i], params, in_place, deps, level))
+        return false;
+    return true;
+  }
+
+  value readable_form(const value& expr)
+  {
+    vector< symbol > deps;
+    return plain_form(expr, deps);
+  }
+
+  value optimize(const value& expr, const scope_chain& scopes, environment* globals_p)
+  {
+    if (!optimizer_on || !expr.is(type::list))
+      return expr;
+    optimizer opt(scopes, globals_p);
+    opt.find_bindings(expr);
+    opt.open = opt.open || opt.defines_at_run_time(expr);
+    value result = opt.rewrite(expr);
+    if (dump_on && opt.changed)
+      cout << readable_form(result) << endl;
+    return result;
+  }
+
+} // namespace lime
@@ -1,3 +1,7 @@
+// C headers
+#include <cctype>
+#include <cstdlib>
+
 // STL headers
 #include <algorithm>
 #include <deque>
@@ -8,16 +12,16 @@
 #include <unordered_set>
 
 // lime headers
+#include <bignum.hpp>
 #include <interpreter.hpp>
 #include <parse.hpp>
+#include <real.hpp>
 
 namespace lime {
   // STL
-  using std::back_inserter;
-  using std::copy;
   using std::deque;
-  using std::istream_iterator;
   using std::istringstream;
+  using std::min;
   using std::stack;
   using std::unordered_set;
 
@@ -26,43 +30,54 @@ namespace lime {
   using lime::list;
   using lime::symbol;
 
-  string add_blanks(const string& code)
+  bool is_separator(char c)
   {
-    string new_code;
-    bool string_expr = false;
-    for (char c: code)
-      if (c == '(' && !string_expr)
-        new_code += " ( ";
-      else if (c == ')' && !string_expr)
-        new_code += " ) ";
-      else if (c == ' ' && string_expr)
-        new_code += "\\s";    
-      else {
-        if (c == '"')
-          string_expr = !string_expr;
-        new_code.push_back(c);
-      }
-    return new_code;
+    return c == ' ' || c == '\n' || c == '\t';
   }
 
+  // A string token keeps its quotation marks and escape sequences; they are
+  // only interpreted by atom().
   deque< string > tokenize(const string& code)
   {
-    istringstream iss(add_blanks(code));
     deque< string > tokens;
-    copy(istream_iterator< string >(iss),
-         istream_iterator< string >(),
-         back_inserter(tokens));
-    return tokens;    
+    int pos = 0;
+    while (pos < code.length()) {
+      char c = code[pos];
+      int start = pos;
+      if (c == '(' || c == ')')
+        ++pos;
+      else if (isspace(c)) {
+        ++pos;
+        continue;
+      }
+      else if (c == '"') {
+        ++pos;
+        while (pos < code.length() && code[pos] != '"')
+          pos += code[pos] == '\\' ? 2 : 1;
+        pos = min(pos + 1, int(code.length()));
+      }
+      else
+        while (pos < code.length() && !isspace(code[pos]) && code[pos] != '(' &&
+               code[pos] != ')')
+          ++pos;
+      tokens.push_back(code.substr(start, pos - start));
+    }
+    return tokens;
   }
 
   string escape(const string& str)
   {
     string escaped;
+    escaped.reserve(str.length());
     for (char c: str)
       if (c == '\n')
         escaped += "\\n";
+      else if (c == '\t')
+        escaped += "\\t";
       else if (c == '"')
         escaped += "\\\"";
+      else if (c == '\\')
+        escaped += "\\\\";
       else
         escaped.push_back(c);
     return escaped;
@@ -71,35 +86,44 @@ namespace lime {
   string unescape(const string& str)
   {
     string unescaped;
-    int i;
-    for (i = 0; i + 1 < str.length(); ++i)
-      if (str[i] == '\\' && str[i + 1] == 'n') {
-        unescaped.push_back('\n');
-        ++i;
-      }
-      else if (str[i] == '\\' && str[i + 1] == '"') {
-        unescaped.push_back('"');
-        ++i;
-      }
-      else if (str[i] == '\\' && str[i + 1] == 's') {
-        unescaped.push_back(' ');
-        ++i;
+    unescaped.reserve(str.length());
+    for (int i = 0; i < str.length(); ++i) {
+      if (str[i] == '\\' && i + 1 < str.length()) {
+        char next = str[i + 1];
+        if (next == 'n' || next == 't' || next == '"' || next == '\\') {
+          unescaped.push_back(next == 'n' ? '\n' : (next == 't' ? '\t' : next));
+          ++i;
+          continue;
+        }
       }
-      else
-        unescaped.push_back(str[i]);
-    if (i < str.length())
-      unescaped.push_back(str.back());
+      unescaped.push_back(str[i]);
+    }
     return unescaped;
   }
 
+  bool integer_literal(const string& token)
+  {
+    size_t start = (token[0] == '-' || token[0] == '+') ? 1 : 0;
+    if (start == token.length())
+      return false;
+    for (size_t i = start; i < token.length(); ++i)
+      if (!isdigit(token[i]))
+        return false;
+    return true;
+  }
+
   value atom(const string& token)
   {
     check(token.length() > 0, "attempting to parse an empty token.");
+    if (integer_literal(token))
+      return parse_integer(token);
+    if (float_literal(token))
+      return make_real(strtod(token.c_str(), nullptr));
     istringstream iss(token);
-    int n;
+    long n;
     if (iss >> n)
       return n;
-    if (*begin(token) == '"' && *(end(token) - 1) == '"')
+    if (token.length() > 1 && token.front() == '"' && token.back() == '"')
       return unescape(token.substr(1, token.length() - 2));
     return symbol(token);
   }
@@ -127,11 +151,6 @@ namespace lime {
     return parse_tokens(tokens);
   }
 
-  bool is_separator(char c)
-  {
-    return c == ' ' || c == '\n' || c == '\t';
-  }
-
   vector< string > split(const string& code)
   {
     vector< string > parts;
@@ -146,7 +165,9 @@ namespace lime {
         part += code[pos];
         if (code[pos] != ' ' && code[pos] != '\n' && code[pos] != '\t')
           empty = false;
-        if (code[pos] == '"')
+        if (string_expr && code[pos] == '\\' && pos + 1 < code.length())
+          part += code[++pos];
+        else if (code[pos] == '"')
           string_expr = !string_expr;
         if (code[pos] == '(' && !string_expr) {
           ++paren_count;
@@ -167,12 +188,14 @@ namespace lime {
   {
     int paren_count = 0;
     bool string_expr = false;
-    for (char c: code)
-      if (c == '"')
+    for (int i = 0; i < code.length(); ++i)
+      if (string_expr && code[i] == '\\')
+        ++i;
+      else if (code[i] == '"')
         string_expr = !string_expr;
-      else if (c == '(' && !string_expr)
+      else if (code[i] == '(' && !string_expr)
         ++paren_count;
-      else if (c == ')' && !string_expr) {
+      else if (code[i] == ')' && !string_expr) {
         check(paren_count != 0, "parentheses don't match.");
         --paren_count;
       }
@@ -182,14 +205,11 @@ namespace lime {
   bool quot_match(const string& code)
   {
     bool string_expr = false;
-    int i;
-    for (i = 0; i + 1 < code.length(); ++i)
-      if (code[i] == '"')
-        string_expr = !string_expr;
-      else if (string_expr && code[i] == '\\' && code[i + 1] == '"')
+    for (int i = 0; i < code.length(); ++i)
+      if (string_expr && code[i] == '\\')
         ++i;
-    if (i < code.length() && code.back() == '"')
-      string_expr = !string_expr;
+      else if (code[i] == '"')
+        string_expr = !string_expr;
     return !string_expr;
   }
 
@@ -233,7 +253,9 @@ namespace lime {
     if (!quot_match(code))
       return initial_indent;
     for (int i = 0; i < code.length(); ++i)
-      if (code[i] == '"')
+      if (string_expr && code[i] == '\\')
+        ++i;
+      else if (code[i] == '"')
         string_expr = !string_expr;
       else if (code[i] == '(' && !string_expr) {
         if (align_arguments(code, i))
@@ -0,0 +1,144 @@
+// C headers
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// STL headers
+#include <algorithm>
+
+// lime headers
+#include <bignum.hpp>
+#include <eval.hpp>
+#include <interpreter.hpp>
+#include <real.hpp>
+
+namespace lime {
+  // lime
+  using lime::check;
+  using lime::eval;
+  using lime::integer_from_double;
+  using lime::integer_to_double;
+  using lime::is_integer;
+  using lime::make_object;
+
+  value make_real(double d)
+  {
+    return make_object< real_object >(d);
+  }
+
+  double get_real(const value& val)
+  {
+    return static_cast< real_object* >(val.get_object())->number;
+  }
+
+  bool is_number(const value& val)
+  {
+    return is_integer(val) || val.is(type::real);
+  }
+
+  double to_double(const value& val)
+  {
+    if (val.is_int())
+      return val.get_int();
+    if (val.is(type::real))
+      return get_real(val);
+    return integer_to_double(val);
+  }
+
+  string real_to_string(double d)
+  {
+    if (std::isnan(d))
+      return "nan";
+    if (std::isinf(d))
+      return d > 0 ? "inf" : "-inf";
+    // find the fewest significant digits that read back as d, then use
+    // positional notation unless the exponent is very large or small
+    char buffer[32];
+    int digits = 1;
+    for (; digits < 17; ++digits) {
+      snprintf(buffer, sizeof(buffer), "%.*e", digits - 1, d);
+      if (strtod(buffer, nullptr) == d)
+        break;
+    }
+    snprintf(buffer, sizeof(buffer), "%.*e", digits - 1, d);
+    int exponent = atoi(strchr(buffer, 'e') + 1);
+    if (exponent >= -4 && exponent < 16)
+      snprintf(buffer, sizeof(buffer), "%.*f", std::max(digits - 1 - exponent, 0), d);
+    string str(buffer);
+    if (str.find_first_of(".e") == string::npos)
+      str += ".0";
+    return str;
+  }
+
+  bool float_literal(const string& token)
+  {
+    size_t i = (token[0] == '-' || token[0] == '+') ? 1 : 0;
+    bool digits = false, point = false, exponent = false;
+    for (; i < token.length(); ++i)
+      if (isdigit(token[i]))
+        digits = true;
+      else if (token[i] == '.' && !point && !exponent)
+        point = true;
+      else if ((token[i] == 'e' || token[i] == 'E') && digits && !exponent) {
+        exponent = true;
+        digits = false;
+        if (i + 1 < token.length() && (token[i + 1] == '-' || token[i + 1] == '+'))
+          ++i;
+      }
+      else
+        return false;
+    return digits && (point || exponent);
+  }
+
+  value to_float::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'float' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value to_float::call1(const value& arg)
+  {
+    check(is_number(arg), "argument to 'float' must be a number.");
+    return make_real(to_double(arg));
+  }
+
+  value truncate::call(const vector< value >& args,
+                       const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'truncate' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value truncate::call1(const value& arg)
+  {
+    check(is_number(arg), "argument to 'truncate' must be a number.");
+    if (is_integer(arg))
+      return arg;
+    check(std::isfinite(get_real(arg)), "argument to 'truncate' must be finite.");
+    return integer_from_double(get_real(arg));
+  }
+
+  value square_root::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'sqrt' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value square_root::call1(const value& arg)
+  {
+    check(is_number(arg), "argument to 'sqrt' must be a number.");
+    return make_real(std::sqrt(to_double(arg)));
+  }
+
+  void add_real_builtins(const shared_ptr< environment >& env_p)
+  {
+    env_p->set("float", make_object< to_float >());
+    env_p->set("truncate", make_object< truncate >());
+    env_p->set("sqrt", make_object< square_root >());
+  }
+
+} // namespace lime
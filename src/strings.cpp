@@ -0,0 +1,195 @@
+// C headers
+#include <cctype>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// lime headers
+#include <bignum.hpp>
+#include <builtins.hpp>
+#include <eval.hpp>
+#include <interpreter.hpp>
+#include <strings.hpp>
+
+namespace lime {
+  // lime
+  using lime::call_binary;
+  using lime::check;
+  using lime::eval;
+  using lime::integer_to_string;
+  using lime::is_integer;
+  using lime::make_object;
+  using lime::parse_integer;
+
+  // Candidate positions are those where both the first and the last byte of
+  // the needle match; with SSE2 they are found sixteen positions at a time,
+  // and only the candidates are compared in full.
+  size_t find_substring(const string& haystack, const string& needle, size_t from)
+  {
+    const char* s = haystack.data();
+    const char* t = needle.data();
+    size_t n = haystack.length(), k = needle.length();
+    if (from > n || k > n - from)
+      return string::npos;
+    if (k == 0)
+      return from;
+    size_t i = from;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(t[0]);
+    const __m128i last = _mm_set1_epi8(t[k - 1]);
+    for (; i + k - 1 + 16 <= n; i += 16) {
+      __m128i block_first = _mm_loadu_si128(reinterpret_cast< const __m128i* >(s + i));
+      __m128i block_last = _mm_loadu_si128(reinterpret_cast< const __m128i* >(s + i + k - 1));
+      unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                      _mm_cmpeq_epi8(last, block_last)));
+      while (mask != 0) {
+        int offset = __builtin_ctz(mask);
+        if (k <= 2 || memcmp(s + i + offset + 1, t + 1, k - 2) == 0)
+          return i + offset;
+        mask &= mask - 1;
+      }
+    }
+#endif
+    for (; i + k <= n; ++i)
+      if (s[i] == t[0] && s[i + k - 1] == t[k - 1] && memcmp(s + i, t, k) == 0)
+        return i;
+    return string::npos;
+  }
+
+  value string_length::call(const vector< value >& args,
+                            const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'string-length' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value string_length::call1(const value& arg)
+  {
+    check(arg.is(type::string), "argument to 'string-length' must be a string.");
+    return long(arg.get_string().length());
+  }
+
+  value concatenate(const value& a, const value& b)
+  {
+    check(a.is(type::string) && b.is(type::string),
+          "arguments to 'string-concat' must be strings.");
+    return a.get_string() + b.get_string();
+  }
+
+  string_concat::string_concat() : binary_builtin(concatenate, "string-concat") {}
+
+  value substring::call(const vector< value >& args,
+                        const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 3, "wrong number of arguments to 'substring' (must be 3).");
+    value str = eval(args[0], caller_env_p);
+    value from = eval(args[1], caller_env_p);
+    value to = eval(args[2], caller_env_p);
+    return call3(str, from, to);
+  }
+
+  value substring::call3(const value& str, const value& from, const value& to)
+  {
+    check(str.is(type::string) && from.is_int() && to.is_int(),
+          "arguments to 'substring' must be a string and two integer indices.");
+    check(from.get_int() >= 1 && from.get_int() <= to.get_int() + 1 &&
+          to.get_int() <= str.get_string().length(), "substring out of range.");
+    return str.get_string().substr(from.get_int() - 1, to.get_int() - from.get_int() + 1);
+  }
+
+  value find_position(const value& str, const value& needle)
+  {
+    check(str.is(type::string) && needle.is(type::string),
+          "arguments to 'index-of' must be strings.");
+    size_t pos = find_substring(str.get_string(), needle.get_string());
+    return pos == string::npos ? 0L : long(pos + 1);
+  }
+
+  index_of::index_of() : binary_builtin(find_position, "index-of") {}
+
+  value split_on(const value& str, const value& sep)
+  {
+    check(str.is(type::string) && sep.is(type::string) && !sep.get_string().empty(),
+          "arguments to 'split' must be a string and a non-empty separator.");
+    const string& s = str.get_string();
+    const string& separator = sep.get_string();
+    list parts;
+    size_t start = 0, pos;
+    while ((pos = find_substring(s, separator, start)) != string::npos) {
+      parts.push_back(s.substr(start, pos - start));
+      start = pos + separator.length();
+    }
+    parts.push_back(s.substr(start));
+    return parts;
+  }
+
+  split_string::split_string() : binary_builtin(split_on, "split") {}
+
+  value join_with(const value& strs, const value& sep)
+  {
+    const string error_msg("arguments to 'join' must be a list of strings and a string.");
+    check(strs.is(type::list) && sep.is(type::string), error_msg);
+    const list& parts = strs.get_list();
+    size_t length = 0;
+    for (const value& part: parts) {
+      check(part.is(type::string), error_msg);
+      length += part.get_string().length() + sep.get_string().length();
+    }
+    string joined;
+    joined.reserve(length);
+    for (int i = 0; i < parts.size(); ++i) {
+      if (i > 0)
+        joined += sep.get_string();
+      joined += parts[i].get_string();
+    }
+    return joined;
+  }
+
+  join_strings::join_strings() : binary_builtin(join_with, "join") {}
+
+  value string_to_int::call(const vector< value >& args,
+                            const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'string->int' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value string_to_int::call1(const value& arg)
+  {
+    check(arg.is(type::string), "argument to 'string->int' must be a string.");
+    const string& str = arg.get_string();
+    size_t start = !str.empty() && (str[0] == '-' || str[0] == '+') ? 1 : 0;
+    bool digits = start < str.length();
+    for (size_t i = start; i < str.length(); ++i)
+      digits = digits && isdigit(str[i]);
+    check(digits, "argument to 'string->int' must be a decimal integer.");
+    return parse_integer(str);
+  }
+
+  value int_to_string::call(const vector< value >& args,
+                            const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'int->string' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value int_to_string::call1(const value& arg)
+  {
+    check(is_integer(arg), "argument to 'int->string' must be an integer.");
+    return integer_to_string(arg);
+  }
+
+  void add_string_builtins(const shared_ptr< environment >& env_p)
+  {
+    env_p->set("string-length", make_object< string_length >());
+    env_p->set("string-concat", make_object< string_concat >());
+    env_p->set("substring", make_object< substring >());
+    env_p->set("index-of", make_object< index_of >());
+    env_p->set("split", make_object< split_string >());
+    env_p->set("join", make_object< join_strings >());
+    env_p->set("string->int", make_object< string_to_int >());
+    env_p->set("int->string", make_object< int_to_string >());
+  }
+
+} // namespace lime
@@ -0,0 +1,162 @@
+// lime headers
+#include <builtins.hpp>
+#include <eval.hpp>
+#include <interpreter.hpp>
+#include <vectors.hpp>
+
+namespace lime {
+  // lime
+  using lime::call_binary;
+  using lime::call_modify_variable;
+  using lime::call_set_element;
+  using lime::check;
+  using lime::eval;
+  using lime::make_object;
+  using lime::nil;
+  using lime::variable_ref;
+
+  const vector< value >& get_vector(const value& val)
+  {
+    return static_cast< vector_object* >(val.get_object())->items;
+  }
+
+  vector< value >& get_mutable_vector(value& var)
+  {
+    if (var.get_object()->ref_count > 1)
+      var = make_object< vector_object >(get_vector(var));
+    return static_cast< vector_object* >(var.get_object())->items;
+  }
+
+  value make_vector::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    auto vec_p = make_object< vector_object >();
+    vec_p->items.reserve(args.size());
+    for (const value& arg: args)
+      vec_p->items.push_back(eval(arg, caller_env_p));
+    return vec_p;
+  }
+
+  value filled_vector(const value& n, const value& fill)
+  {
+    check(n.is_int() && n.get_int() >= 0,
+          "first argument to 'make-vector' must be a non-negative integer.");
+    return make_object< vector_object >(vector< value >(n.get_int(), fill));
+  }
+
+  make_filled_vector::make_filled_vector()
+    : binary_builtin(filled_vector, "make-vector") {}
+
+  value vector_element(const value& vec, const value& i)
+  {
+    check(vec.is(type::vector) && i.is_int(),
+          "arguments to 'vector-ref' must be a vector and an integer index.");
+    const vector< value >& items = get_vector(vec);
+    check(i.get_int() >= 1 && i.get_int() <= items.size(), "vector index out of range.");
+    return items[i.get_int() - 1];
+  }
+
+  vector_ref::vector_ref() : binary_builtin(vector_element, "vector-ref") {}
+
+  void vector_set_element(value& var, const value& i, const value& val)
+  {
+    check(var.is(type::vector) && i.is_int(),
+          "arguments to 'vector-set!' must be a reference to a vector, an integer "
+          "index, and a value.");
+    vector< value >& items = get_mutable_vector(var);
+    check(i.get_int() >= 1 && i.get_int() <= items.size(), "vector index out of range.");
+    items[i.get_int() - 1] = val;
+  }
+
+  value vector_set::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    return call_set_element(vector_set_element, "vector-set!", args, caller_env_p);
+  }
+
+  void vector_push_back(value& var, const value& val)
+  {
+    check(var.is(type::vector),
+          "arguments to 'vector-push!' must be a reference to a vector and a value.");
+    get_mutable_vector(var).push_back(val);
+  }
+
+  value vector_push::call(const vector< value >& args,
+                          const shared_ptr< environment >& caller_env_p)
+  {
+    return call_modify_variable(vector_push_back, "vector-push!", args, caller_env_p);
+  }
+
+  value vector_pop::call(const vector< value >& args,
+                         const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'vector-pop!' (must be 1).");
+    value& var = variable_ref(args[0], caller_env_p);
+    check(var.is(type::vector) && !get_vector(var).empty(),
+          "argument to 'vector-pop!' must be a reference to a non-empty vector.");
+    vector< value >& items = get_mutable_vector(var);
+    value last = items.back();
+    items.pop_back();
+    return last;
+  }
+
+  value vector_slice::call(const vector< value >& args,
+                           const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 3, "wrong number of arguments to 'vector-slice' (must be 3).");
+    value vec = eval(args[0], caller_env_p);
+    value from = eval(args[1], caller_env_p);
+    value to = eval(args[2], caller_env_p);
+    check(vec.is(type::vector) && from.is_int() && to.is_int(),
+          "arguments to 'vector-slice' must be a vector and two integer indices.");
+    const vector< value >& items = get_vector(vec);
+    check(from.get_int() >= 1 && from.get_int() <= to.get_int() + 1 &&
+          to.get_int() <= items.size(), "vector slice out of range.");
+    return make_object< vector_object >(
+      vector< value >(items.begin() + from.get_int() - 1, items.begin() + to.get_int()));
+  }
+
+  value list_to_vector::call(const vector< value >& args,
+                             const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'list->vector' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value list_to_vector::call1(const value& arg)
+  {
+    check(arg.is(type::list), "argument to 'list->vector' must be a list.");
+    const list& lst = arg.get_list();
+    return make_object< vector_object >(vector< value >(lst.begin(), lst.end()));
+  }
+
+  value vector_to_list::call(const vector< value >& args,
+                             const shared_ptr< environment >& caller_env_p)
+  {
+    check(args.size() == 1, "wrong number of arguments to 'vector->list' (must be 1).");
+    return call1(eval(args.front(), caller_env_p));
+  }
+
+  value vector_to_list::call1(const value& arg)
+  {
+    check(arg.is(type::vector), "argument to 'vector->list' must be a vector.");
+    list lst;
+    for (const value& item: get_vector(arg))
+      lst.push_back(item);
+    return lst;
+  }
+
+  void add_vector_builtins(const shared_ptr< environment >& env_p)
+  {
+    env_p->set("vector", make_object< make_vector >());
+    env_p->set("make-vector", make_object< make_filled_vector >());
+    env_p->set("vector-ref", make_object< vector_ref >());
+    env_p->set("vector-set!", make_object< vector_set >());
+    env_p->set("vector-push!", make_object< vector_push >());
+    env_p->set("vector-pop!", make_object< vector_pop >());
+    env_p->set("vector-slice", make_object< vector_slice >());
+    env_p->set("list->vector", make_object< list_to_vector >());
+    env_p->set("vector->list", make_object< vector_to_list >());
+  }
+
+} // namespace lime
@@ -0,0 +1,744 @@
+// STL headers
+#include <memory>
+#include <vector>
+
+// lime headers
+#include <interpreter.hpp>
+#include <vm.hpp>
+
+namespace lime {
+  // STL
+  using std::make_shared;
+  using std::move;
+  using std::vector;
+
+  // lime
+  using lime::check;
+  using lime::location;
+  using lime::make_object;
+  using lime::nested_environment;
+
+  const symbol if_sym("if");
+  const symbol define_sym("define");
+  const symbol set_sym("set!");
+  const symbol begin_sym("begin");
+  const symbol local_sym("local");
+  const symbol lambda_sym("lambda");
+  const symbol defmacro_sym("defmacro");
+  const symbol while_sym("while");
+  const symbol for_sym("for");
+  const symbol for_each_sym("for-each");
+  const symbol and_sym("and");
+  const symbol or_sym("or");
+  const symbol not_sym("not");
+
+  bool vm_on = false;
+
+  void use_vm(bool on)
+  {
+    vm_on = on;
+  }
+
+  bool vm_enabled()
+  {
+    return vm_on;
+  }
+
+  // The instructions work on a stack of values. Their operands a and b are
+  // indices into the tables of the code, jump targets and flags:
+  //
+  //   push_constant a          pushes constants[a]
+  //   load_variable a          pushes the value of variables[a]
+  //   load_global a            load_variable of a variable that can only be
+  //                            global (see global_binding)
+  //   execute a                pushes the value of the tree nodes[a]
+  //   pop                      drops the top value
+  //   jump a                   continues at a
+  //   jump_if_false a b        pops a boolean and continues at a if it is
+  //   jump_if_true a b         false (true); if b is set, the value is first
+  //                            evaluated again, as while does with its test
+  //   check_undefined a        reports an error if definitions[a] is bound
+  //   define a                 pops the value of definitions[a], pushes nil
+  //   set_variable a           pops the value set! gives variables[a], pushes nil
+  //   enter_call a             starts calls[a] (see call_site)
+  //   call1 b, call2 b, call3 b
+  //                            pops the arguments and the function, pushes its
+  //                            result; b is set in tail position (see run)
+  //   call2_constant a         call2 with constants[a] as the second argument
+  //   call2_jump_if_false a b  call2 followed by jump_if_false, and the same
+  //   call2_jump_if_true a b   for jump_if_true
+  //   enter_scope a            runs the code that follows in a new frame of
+  //                            frame_scopes[a], as local does
+  //   leave_scope              goes back to the frame enter_scope was run in
+  //   start_iteration          checks that the top value is a list for
+  //                            for-each, pushes its first index
+  //   iterate a b              continues at a if the index on top is past the
+  //                            end of the list below it; otherwise enters a
+  //                            frame of frame_scopes[b] holding the element
+  //                            and moves the index on
+  //   return_value             returns the top value
+  //
+  // The call superinstructions cover calls like those in (if (< a b) ...) and
+  // (+ x 1), which most loops and recursions are made of.
+#define LIME_OPCODES(OP)                                                \
+  OP(push_constant) OP(load_variable) OP(load_global) OP(execute)       \
+  OP(pop) OP(jump) OP(jump_if_false) OP(jump_if_true)                   \
+  OP(check_undefined) OP(define) OP(set_variable) OP(enter_call)        \
+  OP(call1) OP(call2) OP(call3) OP(call2_constant)                      \
+  OP(call2_jump_if_false) OP(call2_jump_if_true) OP(enter_scope)       \
+  OP(leave_scope) OP(start_iteration) OP(iterate) OP(return_value)
+
+#define LIME_OPCODE_NAME(name) name,
+
+  enum class opcode : unsigned char { LIME_OPCODES(LIME_OPCODE_NAME) };
+
+  class instruction {
+  public:
+    opcode op;
+    int a, b;
+  };
+
+  class variable_ref {
+  public:
+    symbol sym;
+    vector< location > locations;
+    global_binding binding;
+  };
+
+  class definition {
+  public:
+    symbol sym;
+    int index;
+  };
+
+  // A call of a variable with one to three arguments. enter_call finds the
+  // function on the stack: if it has that arity (see lambda::arity), the code
+  // that follows evaluates the arguments and calls it; otherwise
+  // the function is dropped and the call is made by the tree node compiled
+  // from expr, which handles lambdas, macros and partial applications. Its
+  // result is pushed and execution continues at end, or if the call is the
+  // test of a branch, the branch is taken on it.
+  class call_site {
+  public:
+    int n_args;
+    value expr;
+    // the scopes expr is compiled in, kept until the tree node is needed
+    scope_chain scopes;
+    bool tail;
+    intrusive_ptr< node > code;
+    int end;
+    // for a test: where to jump, on which result, and whether to evaluate it
+    // again first
+    int branch;
+    bool jump_when, evaluate;
+  };
+
+  const char* const if_error_msg = "first argument to 'if' must evaluate to boolean.";
+
+  class bytecode : public node {
+  public:
+    bytecode() : epoch(-1) {}
+    value execute(const shared_ptr< environment >& env_p);
+    vector< instruction > code;
+    vector< value > constants;
+    vector< variable_ref > variables;
+    vector< intrusive_ptr< node > > nodes;
+    vector< definition > definitions;
+    vector< call_site > calls;
+    vector< shared_ptr< scope > > frame_scopes;
+    int stack_size;
+    // The global functions the code relies on (see inlines_not); once one of
+    // them is marked, the expression is run as a tree compiled from its
+    // source in its scopes instead.
+    vector< symbol > dependencies;
+    value source;
+    scope_chain scopes;
+    bool tail;
+  private:
+    void check_dependencies()
+    {
+      for (symbol sym: dependencies)
+        if (is_assigned(sym) && !fallback) {
+          fallback = compile_tree(source, scopes, tail);
+          scopes.clear();
+        }
+      epoch = assignment_epoch;
+    }
+    long epoch;
+    intrusive_ptr< node > fallback;
+    static const int n_small_stack = 8;
+    // the tree node a call site falls back to, compiled when first needed
+    node* call_code(call_site& site)
+    {
+      if (!site.code) {
+        site.code = compile_tree(site.expr, site.scopes, site.tail);
+        site.scopes.clear();
+      }
+      return site.code.get();
+    }
+  };
+
+  // With GCC and Clang each instruction jumps straight to the next one's
+  // handler through a table of label addresses; elsewhere it goes back to a
+  // switch.
+#ifdef __GNUC__
+#define LIME_LABEL_ADDRESS(name) &&name##_op,
+#define NEXT goto *labels[int(ip->op)]
+#else
+#define LIME_LABEL_CASE(name) case opcode::name: goto name##_op;
+#define NEXT goto dispatch
+#endif
+
+  value bytecode::execute(const shared_ptr< environment >& outer_env_p)
+  {
+    if (epoch != assignment_epoch)
+      check_dependencies();
+    if (fallback)
+      return fallback->execute(outer_env_p);
+    // the frames of the local blocks and for-each iterations being run, the
+    // innermost of which the code runs in
+    vector< shared_ptr< environment > > frames;
+    const shared_ptr< environment >* env_pp = &outer_env_p;
+    value small_stack[n_small_stack];
+    vector< value > large_stack;
+    value* sp = small_stack;
+    if (stack_size > n_small_stack) {
+      large_stack.resize(stack_size);
+      sp = large_stack.data();
+    }
+    const instruction* start = code.data();
+    const instruction* ip = start;
+#ifdef __GNUC__
+    static void* const labels[] = { LIME_OPCODES(LIME_LABEL_ADDRESS) };
+    NEXT;
+#else
+  dispatch:
+    switch (ip->op) {
+      LIME_OPCODES(LIME_LABEL_CASE)
+    }
+#endif
+
+  push_constant_op:
+    *sp++ = constants[ip->a];
+    ++ip;
+    NEXT;
+
+  load_variable_op: {
+      const variable_ref& var = variables[ip->a];
+      value* var_p = bound(var.locations.front(), env_pp->get());
+      if (var_p && !var_p->is(type::reference))
+        *sp++ = *var_p;
+      else
+        *sp++ = load_variable(var.sym, var.locations, *env_pp);
+      ++ip;
+      NEXT;
+    }
+
+  load_global_op: {
+      variable_ref& var = variables[ip->a];
+      *sp++ = var.binding.get(var.sym, var.locations, *env_pp);
+      ++ip;
+      NEXT;
+    }
+
+  execute_op:
+    *sp++ = nodes[ip->a]->execute(*env_pp);
+    ++ip;
+    NEXT;
+
+  pop_op:
+    *--sp = nil();
+    ++ip;
+    NEXT;
+
+  jump_op:
+    ip = start + ip->a;
+    NEXT;
+
+  jump_if_false_op:
+  jump_if_true_op: {
+      value cond = move(*--sp);
+      if (ip->b && !cond.is_bool())
+        cond = eval(cond, *env_pp);
+      check(cond.is_bool(), if_error_msg);
+      if (cond.get_bool() == (ip->op == opcode::jump_if_true))
+        ip = start + ip->a;
+      else
+        ++ip;
+      NEXT;
+    }
+
+  check_undefined_op: {
+      const definition& def = definitions[ip->a];
+      check(!(*env_pp)->variable(def.index),
+            "attempting to redefine symbol '", def.sym.name(), "'.");
+      ++ip;
+      NEXT;
+    }
+
+  define_op:
+    (*env_pp)->slot(definitions[ip->a].index) = move(sp[-1]);
+    ++ip;
+    NEXT;
+
+  set_variable_op: {
+      const variable_ref& var = variables[ip->a];
+      const location& loc = var.locations.front();
+      value* var_p = bound(loc, env_pp->get());
+      if (var_p && loc.depth == 0 && !var_p->is(type::reference))
+        *var_p = move(sp[-1]);
+      else {
+        assign_variable(var.sym, var.locations, sp[-1], *env_pp);
+        sp[-1] = nil();
+      }
+      ++ip;
+      NEXT;
+    }
+
+  enter_call_op: {
+      call_site& site = calls[ip->a];
+      const value& func = sp[-1];
+      if (func.is(type::lambda) && func.get_lambda()->arity() == site.n_args) {
+        ++ip;
+        NEXT;
+      }
+      sp[-1] = call_code(site)->execute(*env_pp);
+      if (site.branch < 0) {
+        ip = start + site.end;
+        NEXT;
+      }
+      value cond = move(*--sp);
+      if (site.evaluate && !cond.is_bool())
+        cond = eval(cond, *env_pp);
+      check(cond.is_bool(), if_error_msg);
+      ip = start + (cond.get_bool() == site.jump_when ? site.branch : site.end);
+      NEXT;
+    }
+
+  call1_op: {
+      lambda* lambda_p = sp[-2].get_lambda();
+      value result = ip->b ? lambda_p->tail_call_values(sp - 1, 1) :
+                             lambda_p->call1(sp[-1]);
+      *--sp = nil();
+      sp[-1] = move(result);
+      ++ip;
+      NEXT;
+    }
+
+  call2_op: {
+      lambda* lambda_p = sp[-3].get_lambda();
+      value result = ip->b ? lambda_p->tail_call_values(sp - 2, 2) :
+                             lambda_p->call2(sp[-2], sp[-1]);
+      *--sp = nil();
+      *--sp = nil();
+      sp[-1] = move(result);
+      ++ip;
+      NEXT;
+    }
+
+  call3_op: {
+      lambda* lambda_p = sp[-4].get_lambda();
+      value result = ip->b ? lambda_p->tail_call_values(sp - 3, 3) :
+                             lambda_p->call3(sp[-3], sp[-2], sp[-1]);
+      *--sp = nil();
+      *--sp = nil();
+      *--sp = nil();
+      sp[-1] = move(result);
+      ++ip;
+      NEXT;
+    }
+
+  call2_constant_op: {
+      value arg1 = move(*--sp);
+      sp[-1] = sp[-1].get_lambda()->call2(arg1, constants[ip->a]);
+      ++ip;
+      NEXT;
+    }
+
+  call2_jump_if_false_op:
+  call2_jump_if_true_op: {
+      value arg2 = move(*--sp);
+      value arg1 = move(*--sp);
+      value func = move(*--sp);
+      value cond = func.get_lambda()->call2(arg1, arg2);
+      if (ip->b && !cond.is_bool())
+        cond = eval(cond, *env_pp);
+      check(cond.is_bool(), if_error_msg);
+      if (cond.get_bool() == (ip->op == opcode::call2_jump_if_true))
+        ip = start + ip->a;
+      else
+        ++ip;
+      NEXT;
+    }
+
+  enter_scope_op:
+    frames.push_back(nested_environment(*env_pp, frame_scopes[ip->a]));
+    env_pp = &frames.back();
+    ++ip;
+    NEXT;
+
+  leave_scope_op:
+    frames.pop_back();
+    env_pp = frames.empty() ? &outer_env_p : &frames.back();
+    ++ip;
+    NEXT;
+
+  start_iteration_op:
+    check(sp[-1].is(type::list), "second argument to 'for-each' must be a list.");
+    *sp++ = 0;
+    ++ip;
+    NEXT;
+
+  iterate_op: {
+      const list& lst = sp[-2].get_list();
+      long i = sp[-1].get_int();
+      if (i == lst.size()) {
+        ip = start + ip->a;
+        NEXT;
+      }
+      frames.push_back(nested_environment(*env_pp, frame_scopes[ip->b]));
+      env_pp = &frames.back();
+      (*env_pp)->slot(0) = lst[i];
+      sp[-1] = i + 1;
+      ++ip;
+      NEXT;
+    }
+
+  return_value_op:
+    return move(*--sp);
+  }
+
+#undef NEXT
+
+  // true for the forms the bytecode compiler translates itself: control flow,
+  // the loops and local blocks, definitions and assignments of symbols, and
+  // calls of variables with one to three arguments. lambda and defmacro, and
+  // ill-formed special forms, are left to the tree, which reports the errors;
+  // the body of a lambda is compiled on its own.
+  bool compiles_to_bytecode(const list& expr)
+  {
+    if (expr.empty() || !expr.front().is_symbol())
+      return false;
+    symbol sym = expr.front().get_symbol();
+    int size = expr.size();
+    if (!is_special_form(sym))
+      return size >= 2 && size <= 4;
+    if (sym == if_sym)
+      return size == 4;
+    if (sym == define_sym || sym == set_sym)
+      return size == 3 && expr[1].is_symbol();
+    if (sym == while_sym || sym == and_sym || sym == or_sym)
+      return size == 3;
+    if (sym == for_sym)
+      return size == 5 && expr[1].is_symbol();
+    if (sym == for_each_sym)
+      return size == 4 && expr[1].is_symbol();
+    return sym == begin_sym || sym == local_sym;
+  }
+
+  // the jumps and branching calls to be pointed at a place in the code
+  class label {
+  public:
+    vector< int > jumps, calls;
+  };
+
+  class bytecode_compiler {
+  public:
+    explicit bytecode_compiler(scope_chain& s)
+      : scopes(s), code_p(make_object< bytecode >()), depth(0), max_depth(0) {}
+    intrusive_ptr< node > compile(const list& expr, bool tail)
+    {
+      compile_form(expr, tail);
+      emit(opcode::return_value);
+      code_p->stack_size = max_depth;
+      if (!code_p->dependencies.empty()) {
+        code_p->source = expr;
+        code_p->scopes = scopes;
+        code_p->tail = tail;
+      }
+      return code_p;
+    }
+  private:
+    int emit(opcode op, int a = 0, int b = 0)
+    {
+      depth += stack_effect(op);
+      if (depth > max_depth)
+        max_depth = depth;
+      code_p->code.push_back(instruction { op, a, b });
+      return code_p->code.size() - 1;
+    }
+    static int stack_effect(opcode op)
+    {
+      switch (op) {
+      case opcode::push_constant:
+      case opcode::load_variable:
+      case opcode::load_global:
+      case opcode::execute:
+      case opcode::start_iteration:
+        return 1;
+      case opcode::pop:
+      case opcode::jump_if_false:
+      case opcode::jump_if_true:
+      case opcode::call1:
+      case opcode::call2_constant:
+      case opcode::return_value:
+        return -1;
+      case opcode::call2:
+        return -2;
+      case opcode::call3:
+      case opcode::call2_jump_if_false:
+      case opcode::call2_jump_if_true:
+        return -3;
+      default:
+        return 0;
+      }
+    }
+    int here() const
+    {
+      return code_p->code.size();
+    }
+    void place(const label& l)
+    {
+      for (int i: l.jumps)
+        code_p->code[i].a = here();
+      for (int i: l.calls)
+        code_p->calls[i].branch = here();
+    }
+    void jump_if(bool when, label& target, bool evaluate)
+    {
+      target.jumps.push_back(emit(when ? opcode::jump_if_true : opcode::jump_if_false,
+                                  0, evaluate));
+    }
+    void depend_on(symbol sym)
+    {
+      for (symbol dep: code_p->dependencies)
+        if (dep == sym)
+          return;
+      code_p->dependencies.push_back(sym);
+    }
+    void push_constant(const value& val)
+    {
+      code_p->constants.push_back(val);
+      emit(opcode::push_constant, code_p->constants.size() - 1);
+    }
+    void execute_tree(const value& expr, bool tail)
+    {
+      code_p->nodes.push_back(compile_tree(expr, scopes, tail));
+      emit(opcode::execute, code_p->nodes.size() - 1);
+    }
+    int add_variable(symbol sym)
+    {
+      code_p->variables.push_back(variable_ref { sym, resolve(sym, scopes) });
+      return code_p->variables.size() - 1;
+    }
+    void load(symbol sym)
+    {
+      int var = add_variable(sym);
+      bool global = code_p->variables[var].locations.size() == 1;
+      emit(global ? opcode::load_global : opcode::load_variable, var);
+    }
+    // code that pushes the value of expr
+    void compile_value(const value& expr, bool tail)
+    {
+      switch (expr.get_type()) {
+      case type::symbol:
+        load(expr.get_symbol());
+        break;
+      case type::list:
+        if (compiles_to_bytecode(expr.get_list()))
+          compile_form(expr.get_list(), tail);
+        else
+          execute_tree(expr, tail);
+        break;
+      case type::reference:
+      case type::node:
+        execute_tree(expr, tail);
+        break;
+      default:
+        push_constant(expr);
+      }
+    }
+    void compile_form(const list& expr, bool tail)
+    {
+      symbol sym = expr.front().get_symbol();
+      bool inline_not = inlines_not(expr, scopes);
+      if (inline_not)
+        depend_on(not_sym);
+      if (!is_special_form(sym) && !inline_not)
+        compile_call(expr, tail, nullptr, false, false);
+      else if (sym == if_sym) {
+        label else_branch, end;
+        compile_test(expr[1], false, else_branch, false);
+        compile_value(expr[2], tail);
+        end.jumps.push_back(emit(opcode::jump));
+        --depth;
+        place(else_branch);
+        compile_value(expr[3], tail);
+        place(end);
+      }
+      else if (sym == begin_sym)
+        compile_sequence(expr, tail);
+      else if (sym == local_sym) {
+        emit(opcode::enter_scope, frame_scope(make_shared< scope >(), expr, 1));
+        compile_sequence(expr, tail);
+        leave_scope();
+      }
+      else if (sym == for_sym)
+        compile_value(for_loop(expr), tail);
+      else if (sym == for_each_sym) {
+        label end;
+        compile_value(expr[2], false);
+        emit(opcode::start_iteration);
+        int loop = here();
+        auto scope_p = make_shared< scope >();
+        scope_p->add(expr[1].get_symbol());
+        end.jumps.push_back(emit(opcode::iterate, 0, frame_scope(scope_p, expr, 3)));
+        compile_value(expr[3], false);
+        emit(opcode::pop);
+        leave_scope();
+        emit(opcode::jump, loop);
+        place(end);
+        emit(opcode::pop);
+        emit(opcode::pop);
+        push_constant(nil());
+      }
+      else if (sym == define_sym) {
+        symbol var = expr[1].get_symbol();
+        code_p->definitions.push_back(definition { var, definition_slot(var, scopes) });
+        int def = code_p->definitions.size() - 1;
+        emit(opcode::check_undefined, def);
+        compile_value(expr[2], false);
+        emit(opcode::define, def);
+      }
+      else if (sym == set_sym) {
+        int var = add_variable(expr[1].get_symbol());
+        mark_assigned(expr[1].get_symbol());
+        compile_value(expr[2], false);
+        emit(opcode::set_variable, var);
+      }
+      else if (sym == while_sym) {
+        label end;
+        int loop = here();
+        compile_test(expr[1], false, end, true);
+        compile_value(expr[2], false);
+        emit(opcode::pop);
+        emit(opcode::jump, loop);
+        place(end);
+        push_constant(nil());
+      }
+      else { // and, or, not
+        bool is_and = sym == and_sym;
+        label short_circuit, end;
+        compile_test(expr[1], sym == or_sym, short_circuit, false);
+        if (sym == not_sym)
+          push_constant(false);
+        else
+          compile_value(expr[2], tail);
+        end.jumps.push_back(emit(opcode::jump));
+        --depth;
+        place(short_circuit);
+        push_constant(!is_and);
+        place(end);
+      }
+    }
+    void compile_sequence(const list& expr, bool tail)
+    {
+      if (expr.size() == 1)
+        push_constant(nil());
+      for (int i = 1; i < expr.size(); ++i) {
+        compile_value(expr[i], tail && i + 1 == expr.size());
+        if (i + 1 < expr.size())
+          emit(opcode::pop);
+      }
+    }
+    // Gives the forms of expr from first on frames of scope_p, in which they
+    // are compiled until leave_scope; returns its index in frame_scopes.
+    int frame_scope(const shared_ptr< scope >& scope_p, const list& expr, int first)
+    {
+      push_scope(scope_p, expr, first, scopes);
+      code_p->frame_scopes.push_back(scope_p);
+      return code_p->frame_scopes.size() - 1;
+    }
+    void leave_scope()
+    {
+      scopes.pop_back();
+      emit(opcode::leave_scope);
+    }
+    // code that jumps to target if expr is when, continuing otherwise; with
+    // evaluate, expr's value is evaluated again unless it is a boolean
+    void compile_test(const value& expr, bool when, label& target, bool evaluate)
+    {
+      if (!expr.is(type::list) || !compiles_to_bytecode(expr.get_list())) {
+        compile_value(expr, false);
+        jump_if(when, target, evaluate);
+        return;
+      }
+      const list& lst = expr.get_list();
+      symbol sym = lst.front().get_symbol();
+      if (!is_special_form(sym) && lst.size() == 3)
+        compile_call(lst, false, &target, when, evaluate);
+      else if (inlines_not(lst, scopes)) {
+        depend_on(not_sym);
+        compile_test(lst[1], !when, target, false);
+      }
+      else if (sym == and_sym || sym == or_sym) {
+        // the first test decides the result when it is false for and, true for
+        // or; the second test's value is the result
+        bool decisive = sym == or_sym;
+        if (when == decisive)
+          compile_test(lst[1], decisive, target, false);
+        label skip;
+        if (when != decisive)
+          compile_test(lst[1], decisive, skip, false);
+        compile_test(lst[2], when, target, evaluate);
+        place(skip);
+      }
+      else {
+        compile_value(expr, false);
+        jump_if(when, target, evaluate);
+      }
+    }
+    // A call of a variable with one to three arguments; with a target, it is
+    // a test with two arguments, jumping there if its result is when.
+    void compile_call(const list& expr, bool tail, label* target, bool when,
+                      bool evaluate)
+    {
+      int n_args = expr.size() - 1;
+      load(expr.front().get_symbol());
+      code_p->calls.push_back(call_site { n_args, expr, scopes, tail, nullptr, 0, -1,
+                                          when, evaluate });
+      int site = code_p->calls.size() - 1;
+      emit(opcode::enter_call, site);
+      const value& last = expr.back();
+      bool constant_last = n_args == 2 && !target && !tail && !last.is(type::list) &&
+        !last.is_symbol() && !last.is(type::reference) && !last.is(type::node);
+      for (int i = 1; i <= n_args; ++i)
+        if (i < n_args || !constant_last)
+          compile_value(expr[i], false);
+      if (target) {
+        opcode op = when ? opcode::call2_jump_if_true : opcode::call2_jump_if_false;
+        target->jumps.push_back(emit(op, 0, evaluate));
+        target->calls.push_back(site);
+      }
+      else if (constant_last) {
+        code_p->constants.push_back(last);
+        emit(opcode::call2_constant, code_p->constants.size() - 1);
+      }
+      else
+        emit(n_args == 1 ? opcode::call1 : n_args == 2 ? opcode::call2 : opcode::call3, 0,
+             tail);
+      code_p->calls[site].end = here();
+    }
+    scope_chain& scopes;
+    intrusive_ptr< bytecode > code_p;
+    int depth, max_depth;
+  };
+
+  intrusive_ptr< node > compile_bytecode(const list& expr, scope_chain& scopes, bool tail)
+  {
+    if (!compiles_to_bytecode(expr))
+      return nullptr;
+    return bytecode_compiler(scopes).compile(expr, tail);
+  }
+
+} // namespace lime
@@ -0,0 +1,14 @@
+#!/bin/bash
+# Runs every tests/*.lm with the given options and compares its output with
+# the .expected file next to it.
+cd "$(dirname "$0")/.."
+failed=0
+for source in tests/*.lm; do
+  output=$(_=bin/lime bin/lime "$@" "$source" 2>&1)
+  if [ "$output" != "$(cat "${source%.lm}.expected")" ]; then
+    echo "FAILED: $source $*"
+    diff <(echo "$output") "${source%.lm}.expected" | head -20
+    failed=1
+  fi
+done
+exit $failed